@@ -0,0 +1,309 @@
+// Microbenchmarks for the linearham hot spots, across gene lengths and flex
+// sizes.
+//
+// Usage: bench [--format=csv|json] [--filter=<substring>] [--reps=<n>]
+//              [--warmup=<n>] [--min-time-ms=<ms>]
+//
+// Each benchmark is run `warmup` times untimed, then timed in `reps` samples.
+// A sample runs the benchmark enough times in a row to take at least
+// `min-time-ms`, so that fast kernels aren't swamped by timer resolution. We
+// report the minimum, median, mean and standard deviation of the time per
+// call over the samples. Only benchmarks whose name contains the filter are
+// run. Results go to standard output.
+//
+// Timings are only meaningful for an optimized build; see the '-O3' line in
+// SConstruct.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "core.hpp"
+#include "smooshable_cache.hpp"
+#include "smooshable_chain.hpp"
+
+
+namespace {
+
+struct Options {
+  std::string format = "csv";
+  std::string filter;
+  int reps = 10;
+  int warmup = 3;
+  double min_time_ms = 1.;
+};
+
+
+struct Benchmark {
+  std::string name;
+  int gene_length;
+  int flex;
+  std::function<double()> run;
+};
+
+
+struct Result {
+  const Benchmark* benchmark;
+  long iterations;
+  double min_ns, median_ns, mean_ns, stddev_ns;
+};
+
+
+// Results are summed into this so that the compiler can't drop the work.
+volatile double sink;
+
+
+// A random stochastic vector or matrix (by rows) with positive entries.
+Eigen::MatrixXd RandomProbs(int rows, int cols) {
+  Eigen::MatrixXd m = Eigen::MatrixXd::Random(rows, cols).array() + 1.5;
+  return m.array().colwise() / m.rowwise().sum().array();
+}
+
+
+// A germline gene with random parameters over a four-letter alphabet.
+linearham::Germline RandomGermline(int length) {
+  Eigen::VectorXd landing = 0.5 * RandomProbs(1, length).transpose();
+  Eigen::MatrixXd emission_matrix = RandomProbs(length, 4).transpose();
+  Eigen::VectorXd next_transition =
+      (Eigen::VectorXd::Random(length - 1).array() + 1.) / 2.;
+  return linearham::Germline(landing, emission_matrix, next_transition);
+}
+
+
+Eigen::VectorXi RandomRead(int length) {
+  Eigen::VectorXi read(length);
+  for (int i = 0; i < length; i++) read(i) = std::rand() % 4;
+  return read;
+}
+
+
+linearham::Smooshable RandomSmooshable(int left_flex, int right_flex) {
+  Eigen::MatrixXd m = 1e-3 * RandomProbs(left_flex + 1, right_flex + 1);
+  return linearham::Smooshable(m);
+}
+
+
+std::vector<Benchmark> Benchmarks() {
+  using namespace linearham;
+  std::vector<Benchmark> benchmarks;
+  for (int length : {20, 100, 300}) {
+    auto e =
+        std::make_shared<Eigen::VectorXd>(RandomProbs(1, length).transpose());
+    auto A = std::make_shared<Eigen::MatrixXd>(length, length);
+    benchmarks.push_back({"SubProductMatrix", length, 0, [e, A]() {
+                            SubProductMatrix(*e, *A);
+                            return (*A)(0, 0);
+                          }});
+
+    auto landing =
+        std::make_shared<Eigen::VectorXd>(RandomProbs(1, length).transpose());
+    auto next_transition = std::make_shared<Eigen::VectorXd>(
+        (Eigen::VectorXd::Random(length - 1).array() + 1.) / 2.);
+    benchmarks.push_back(
+        {"BuildTransition", length, 0, [landing, next_transition]() {
+           return BuildTransition(*landing, *next_transition)(0, 0);
+         }});
+  }
+
+  for (int length : {20, 100, 300}) {
+    for (int flex : {2, 5, 10}) {
+      auto germline = std::make_shared<Germline>(RandomGermline(length));
+      auto read = std::make_shared<Eigen::VectorXi>(RandomRead(length));
+      auto match = std::make_shared<Eigen::MatrixXd>(flex + 1, flex + 1);
+      benchmarks.push_back(
+          {"MatchMatrix", length, flex, [germline, read, match, flex]() {
+             germline->MatchMatrix(0, *read, flex, flex, *match);
+             return (*match)(0, 0);
+           }});
+
+      // Scoring the same window against the same gene again, with and
+      // without a cache; after the first call the cache always hits.
+      benchmarks.push_back(
+          {"SmooshableGermline", length, flex, [germline, read, flex]() {
+             SmooshableGermline s(*germline, 0, *read, flex, flex);
+             return s.marginal()(0, 0);
+           }});
+      auto cache = std::make_shared<SmooshableCache>(16);
+      benchmarks.push_back(
+          {"SmooshableCache", length, flex, [germline, read, cache, flex]() {
+             return cache->GetGermline(germline, 0, *read, flex, flex)
+                 ->marginal()(0, 0);
+           }});
+    }
+  }
+
+  for (int flex : {2, 5, 10, 20, 40}) {
+    auto A = std::make_shared<Eigen::MatrixXd>(RandomProbs(flex + 1, flex + 1));
+    auto B = std::make_shared<Eigen::MatrixXd>(RandomProbs(flex + 1, flex + 1));
+    auto C = std::make_shared<Eigen::MatrixXd>(flex + 1, flex + 1);
+    auto C_idx = std::make_shared<Eigen::MatrixXi>(flex + 1, flex + 1);
+    benchmarks.push_back({"BinaryMax", 0, flex, [A, B, C, C_idx]() {
+                            BinaryMax(*A, *B, *C, *C_idx);
+                            return (*C)(0, 0);
+                          }});
+
+    auto s_a = std::make_shared<Smooshable>(RandomSmooshable(flex, flex));
+    auto s_b = std::make_shared<Smooshable>(RandomSmooshable(flex, flex));
+    benchmarks.push_back({"Smoosh", 0, flex, [s_a, s_b]() {
+                            return Smoosh(*s_a, *s_b).first.marginal()(0, 0);
+                          }});
+
+    // A chain shaped like a V(D)J chain: 1 x flex, then flex x flex.
+    auto originals = std::make_shared<SmooshableVector>();
+    originals->push_back(RandomSmooshable(0, flex));
+    for (int i = 0; i < 5; i++) {
+      originals->push_back(RandomSmooshable(flex, flex));
+    }
+    originals->push_back(RandomSmooshable(flex, 0));
+    benchmarks.push_back({"SmooshableChain", 0, flex, [originals]() {
+                            SmooshableChain chain(*originals);
+                            return chain.fully_smooshed().marginal()(0, 0);
+                          }});
+  }
+  return benchmarks;
+}
+
+
+double Seconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+
+Result Run(const Benchmark& benchmark, const Options& options) {
+  typedef std::chrono::steady_clock Clock;
+  double total = 0.;
+  for (int i = 0; i < options.warmup; i++) total += benchmark.run();
+
+  // Double the number of iterations per sample until a sample is long enough.
+  long iterations = 1;
+  while (true) {
+    Clock::time_point start = Clock::now();
+    for (long i = 0; i < iterations; i++) total += benchmark.run();
+    if (Seconds(Clock::now() - start) * 1e3 >= options.min_time_ms) break;
+    iterations *= 2;
+  }
+
+  std::vector<double> samples;
+  for (int rep = 0; rep < options.reps; rep++) {
+    Clock::time_point start = Clock::now();
+    for (long i = 0; i < iterations; i++) total += benchmark.run();
+    samples.push_back(Seconds(Clock::now() - start) * 1e9 / iterations);
+  }
+  sink = sink + total;
+
+  Result result;
+  result.benchmark = &benchmark;
+  result.iterations = iterations;
+  std::sort(samples.begin(), samples.end());
+  result.min_ns = samples.front();
+  int middle = samples.size() / 2;
+  result.median_ns = (samples.size() % 2 == 1)
+                         ? samples[middle]
+                         : (samples[middle - 1] + samples[middle]) / 2.;
+  double sum = 0., sum_sq = 0.;
+  for (double sample : samples) {
+    sum += sample;
+    sum_sq += sample * sample;
+  }
+  result.mean_ns = sum / samples.size();
+  result.stddev_ns =
+      std::sqrt(std::max(0., sum_sq / samples.size() -
+                                 result.mean_ns * result.mean_ns));
+  return result;
+}
+
+
+void WriteCSV(std::ostream& out, const std::vector<Result>& results,
+              const Options& options) {
+  out << "name,gene_length,flex,iterations,reps,min_ns,median_ns,mean_ns,"
+         "stddev_ns\n";
+  for (const Result& result : results) {
+    out << result.benchmark->name << "," << result.benchmark->gene_length
+        << "," << result.benchmark->flex << "," << result.iterations << ","
+        << options.reps << "," << result.min_ns << "," << result.median_ns
+        << "," << result.mean_ns << "," << result.stddev_ns << "\n";
+  }
+}
+
+
+void WriteJSON(std::ostream& out, const std::vector<Result>& results,
+               const Options& options) {
+  out << "[\n";
+  for (unsigned int i = 0; i < results.size(); i++) {
+    const Result& result = results[i];
+    out << "  {\"name\": \"" << result.benchmark->name
+        << "\", \"gene_length\": " << result.benchmark->gene_length
+        << ", \"flex\": " << result.benchmark->flex
+        << ", \"iterations\": " << result.iterations
+        << ", \"reps\": " << options.reps << ", \"min_ns\": " << result.min_ns
+        << ", \"median_ns\": " << result.median_ns
+        << ", \"mean_ns\": " << result.mean_ns
+        << ", \"stddev_ns\": " << result.stddev_ns << "}"
+        << ((i + 1 < results.size()) ? "," : "") << "\n";
+  }
+  out << "]\n";
+}
+
+
+// Parse `--key=value` arguments into options, returning false on a bad one.
+bool ParseOptions(int argc, char* argv[], Options& options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || equals == std::string::npos) {
+      return false;
+    }
+    std::string key = arg.substr(2, equals - 2);
+    std::istringstream value(arg.substr(equals + 1));
+    if (key == "format") {
+      value >> options.format;
+      if (options.format != "csv" && options.format != "json") return false;
+    } else if (key == "filter") {
+      value >> options.filter;
+    } else if (key == "reps") {
+      value >> options.reps;
+      if (options.reps < 1) return false;
+    } else if (key == "warmup") {
+      value >> options.warmup;
+    } else if (key == "min-time-ms") {
+      value >> options.min_time_ms;
+    } else {
+      return false;
+    }
+    if (value.fail()) return false;
+  }
+  return true;
+}
+}
+
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--format=csv|json] [--filter=<substring>] [--reps=<n>]"
+              << " [--warmup=<n>] [--min-time-ms=<ms>]" << std::endl;
+    return 1;
+  }
+
+  std::srand(0);
+  std::vector<Benchmark> benchmarks = Benchmarks();
+  std::vector<Result> results;
+  for (const Benchmark& benchmark : benchmarks) {
+    if (benchmark.name.find(options.filter) == std::string::npos) continue;
+    results.push_back(Run(benchmark, options));
+  }
+
+  std::cout << std::setprecision(6);
+  if (options.format == "json") {
+    WriteJSON(std::cout, results, options);
+  } else {
+    WriteCSV(std::cout, results, options);
+  }
+  return 0;
+}
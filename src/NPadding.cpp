@@ -6,6 +6,19 @@
 namespace linearham {
 
 
+/// @brief Constructor for NPadding starting from its parameters.
+/// @param[in] n_self_transition_prob
+/// The probability of staying in the padding state.
+/// @param[in] n_emission_vector
+/// The emission probabilities of the padding state.
+NPadding::NPadding(double n_self_transition_prob,
+                   SharedMatrix<Eigen::VectorXd> n_emission_vector)
+    : n_self_transition_prob_(n_self_transition_prob),
+      n_emission_vector_(std::move(n_emission_vector)) {
+  CacheStepProb();
+};
+
+
 /// @brief Constructor for NPadding starting from a YAML file.
 /// @param[in] root
 /// A root node associated with a germline YAML file.
@@ -25,8 +38,8 @@ NPadding::NPadding(YAML::Node root) {
   // Either we parse a "insert_left_N" or "insert_right_N" state (or neither).
   assert((gstart == 2) ^ (gend == (root["states"].size() - 2)));
 
-  // Allocate space for the NPadding protected data members.
-  n_emission_vector_.setZero(alphabet.size());
+  // Allocate space for the NPadding data.
+  Eigen::VectorXd n_emission_vector = Eigen::VectorXd::Zero(alphabet.size());
 
   // Initialize local variables.
   int n_index, n_check_ind;
@@ -59,9 +72,9 @@ NPadding::NPadding(YAML::Node root) {
   YAML::Node check_state = root["states"][n_check_ind];
   assert(nstate["name"].as<std::string>() == nname);
 
-  assert((  // Double parens apparently needed for such macros.
-      nstate["transitions"].as<std::map<std::string, double>>() ==
-      check_state["transitions"].as<std::map<std::string, double>>()));
+  // partis writes these out separately, so they can differ in the last few
+  // bits (e.g. an "end" probability of 0.040000000000000036 versus 0.04).
+  assert(is_equal_prob_maps(nstate["transitions"], check_state["transitions"]));
 
   std::vector<std::string> state_names;
   Eigen::VectorXd probs;
@@ -84,7 +97,42 @@ NPadding::NPadding(YAML::Node root) {
 
   for (unsigned int j = 0; j < state_names.size(); j++) {
     assert(probs[j] == 0.25);
-    n_emission_vector_[alphabet_map[state_names[j]]] = probs[j];
+    n_emission_vector[alphabet_map[state_names[j]]] = probs[j];
+  }
+  n_emission_vector_ = std::move(n_emission_vector);
+  CacheStepProb();
+};
+
+
+/// @brief Work out whether padding probabilities are geometric, and if so
+/// cache the log probability of each step.
+void NPadding::CacheStepProb() {
+  n_emission_uniform_ =
+      n_emission_vector_.size() > 0 &&
+      (n_emission_vector_.array() == n_emission_vector_(0)).all();
+  n_log_step_prob_ =
+      n_emission_uniform_
+          ? std::log(n_self_transition_prob_ * n_emission_vector_(0))
+          : 0.;
+};
+
+
+/// @brief The log probability of emitting a run of bases from the padding
+/// state, taking a self-transition before each one.
+/// @param[in] emission_indices
+/// The indices of the bases.
+///
+/// With partis parameters every base is equally likely, so this is just the
+/// length of the run times a cached log probability.
+double NPadding::LogPaddingProb(
+    const Eigen::Ref<const Eigen::VectorXi>& emission_indices) const {
+  if (n_emission_uniform_) {
+    return emission_indices.size() * n_log_step_prob_;
+  }
+  double log_prob = emission_indices.size() * std::log(n_self_transition_prob_);
+  for (int i = 0; i < emission_indices.size(); i++) {
+    log_prob += std::log(n_emission_vector_(emission_indices(i)));
   }
+  return log_prob;
 };
 }
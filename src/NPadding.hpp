@@ -1,6 +1,7 @@
 #ifndef LINEARHAM_NPADDING_
 #define LINEARHAM_NPADDING_
 
+#include "shared_matrix.hpp"
 #include "yaml_utils.hpp"
 
 /// @file NPadding.hpp
@@ -14,14 +15,31 @@ namespace linearham {
 class NPadding {
  protected:
   double n_self_transition_prob_;
-  Eigen::VectorXd n_emission_vector_;
+  SharedMatrix<Eigen::VectorXd> n_emission_vector_;
+  // If every base is equally likely to be emitted, the log probability of
+  // each padding base (a self-transition and an emission), so that the
+  // probability of a run of padding is geometric in its length.
+  bool n_emission_uniform_;
+  double n_log_step_prob_;
+
+  void CacheStepProb();
 
  public:
-  NPadding(){};
+  NPadding()
+      : n_self_transition_prob_(0.),
+        n_emission_uniform_(false),
+        n_log_step_prob_(0.){};
+  NPadding(double n_self_transition_prob,
+           SharedMatrix<Eigen::VectorXd> n_emission_vector);
   NPadding(YAML::Node root);
 
   double n_self_transition_prob() const { return n_self_transition_prob_; };
-  Eigen::VectorXd n_emission_vector() const { return n_emission_vector_; };
+  const Eigen::Map<const Eigen::VectorXd>& n_emission_vector() const {
+    return n_emission_vector_;
+  };
+
+  double LogPaddingProb(
+      const Eigen::Ref<const Eigen::VectorXi>& emission_indices) const;
 };
 }
 
@@ -36,11 +36,14 @@ NTInsertion::NTInsertion(YAML::Node root) {
          (gend == (root["states"].size() - 2)));
   int gcount = gend - gstart + 1;
 
-  // Allocate space for the NTInsertion protected data members.
-  n_landing_in_.setZero(alphabet.size());
-  n_landing_out_.setZero(alphabet.size(), gcount);
-  n_emission_matrix_.setZero(alphabet.size(), alphabet.size());
-  n_transition_.setZero(alphabet.size(), alphabet.size());
+  // Allocate space for the NTInsertion data.
+  Eigen::VectorXd n_landing_in = Eigen::VectorXd::Zero(alphabet.size());
+  Eigen::MatrixXd n_landing_out =
+      Eigen::MatrixXd::Zero(alphabet.size(), gcount);
+  Eigen::MatrixXd n_emission_matrix =
+      Eigen::MatrixXd::Zero(alphabet.size(), alphabet.size());
+  Eigen::MatrixXd n_transition =
+      Eigen::MatrixXd::Zero(alphabet.size(), alphabet.size());
 
   // Parse the init state.
   YAML::Node init_state = root["states"][0];
@@ -54,7 +57,7 @@ NTInsertion::NTInsertion(YAML::Node root) {
   // The init state has landing probabilities in each of the NTI states.
   for (unsigned int i = 0; i < state_names.size(); i++) {
     if (std::regex_match(state_names[i], match, nrgx)) {
-      n_landing_in_[alphabet_map[match[1]]] = probs[i];
+      n_landing_in[alphabet_map[match[1]]] = probs[i];
     } else {
       assert(std::regex_match(state_names[i], match, grgx));
     }
@@ -72,10 +75,10 @@ NTInsertion::NTInsertion(YAML::Node root) {
     for (unsigned int j = 0; j < state_names.size(); j++) {
       if (std::regex_match(state_names[j], match, grgx)) {
         // Get probabilities of going from NTI to germline genes.
-        n_landing_out_(alphabet_ind, std::stoi(match[1])) = probs[j];
+        n_landing_out(alphabet_ind, std::stoi(match[1])) = probs[j];
       } else if (std::regex_match(state_names[j], match, nrgx)) {
         // Get probabilities of going between NTI states.
-        n_transition_(alphabet_ind, alphabet_map[match[1]]) = probs[j];
+        n_transition(alphabet_ind, alphabet_map[match[1]]) = probs[j];
       } else {
         assert(0);
       }
@@ -86,8 +89,12 @@ NTInsertion::NTInsertion(YAML::Node root) {
     assert(is_equal_string_vecs(state_names, alphabet));
 
     for (unsigned int j = 0; j < state_names.size(); j++) {
-      n_emission_matrix_(alphabet_map[state_names[j]], alphabet_ind) = probs[j];
+      n_emission_matrix(alphabet_map[state_names[j]], alphabet_ind) = probs[j];
     }
   }
+  n_landing_in_ = std::move(n_landing_in);
+  n_landing_out_ = std::move(n_landing_out);
+  n_emission_matrix_ = std::move(n_emission_matrix);
+  n_transition_ = std::move(n_transition);
 };
 }
@@ -1,6 +1,7 @@
 #ifndef LINEARHAM_NTINSERTION_
 #define LINEARHAM_NTINSERTION_
 
+#include "shared_matrix.hpp"
 #include "yaml_utils.hpp"
 
 /// @file NTInsertion.hpp
@@ -13,19 +14,35 @@ namespace linearham {
 /// regions.
 class NTInsertion {
  protected:
-  Eigen::VectorXd n_landing_in_;
-  Eigen::MatrixXd n_landing_out_;
-  Eigen::MatrixXd n_emission_matrix_;
-  Eigen::MatrixXd n_transition_;
+  SharedMatrix<Eigen::VectorXd> n_landing_in_;
+  SharedMatrix<Eigen::MatrixXd> n_landing_out_;
+  SharedMatrix<Eigen::MatrixXd> n_emission_matrix_;
+  SharedMatrix<Eigen::MatrixXd> n_transition_;
 
  public:
   NTInsertion(){};
+  NTInsertion(SharedMatrix<Eigen::VectorXd> n_landing_in,
+              SharedMatrix<Eigen::MatrixXd> n_landing_out,
+              SharedMatrix<Eigen::MatrixXd> n_emission_matrix,
+              SharedMatrix<Eigen::MatrixXd> n_transition)
+      : n_landing_in_(std::move(n_landing_in)),
+        n_landing_out_(std::move(n_landing_out)),
+        n_emission_matrix_(std::move(n_emission_matrix)),
+        n_transition_(std::move(n_transition)){};
   NTInsertion(YAML::Node root);
 
-  Eigen::VectorXd n_landing_in() const { return n_landing_in_; };
-  Eigen::MatrixXd n_landing_out() const { return n_landing_out_; };
-  Eigen::MatrixXd n_emission_matrix() const { return n_emission_matrix_; };
-  Eigen::MatrixXd n_transition() const { return n_transition_; };
+  const Eigen::Map<const Eigen::VectorXd>& n_landing_in() const {
+    return n_landing_in_;
+  };
+  const Eigen::Map<const Eigen::MatrixXd>& n_landing_out() const {
+    return n_landing_out_;
+  };
+  const Eigen::Map<const Eigen::MatrixXd>& n_emission_matrix() const {
+    return n_emission_matrix_;
+  };
+  const Eigen::Map<const Eigen::MatrixXd>& n_transition() const {
+    return n_transition_;
+  };
 };
 }
 
@@ -15,6 +15,8 @@ namespace linearham {
 class VGermline : public Germline, public NPadding {
  public:
   VGermline(){};
+  VGermline(Germline germline, NPadding n_padding)
+      : Germline(std::move(germline)), NPadding(std::move(n_padding)){};
   VGermline(YAML::Node root) : Germline(root), NPadding(root){};
 };
 
@@ -22,6 +24,8 @@ class VGermline : public Germline, public NPadding {
 class DGermline : public Germline, public NTInsertion {
  public:
   DGermline(){};
+  DGermline(Germline germline, NTInsertion nt_insertion)
+      : Germline(std::move(germline)), NTInsertion(std::move(nt_insertion)){};
   DGermline(YAML::Node root) : Germline(root), NTInsertion(root){};
 };
 
@@ -29,6 +33,10 @@ class DGermline : public Germline, public NTInsertion {
 class JGermline : public Germline, public NTInsertion, public NPadding {
  public:
   JGermline(){};
+  JGermline(Germline germline, NTInsertion nt_insertion, NPadding n_padding)
+      : Germline(std::move(germline)),
+        NTInsertion(std::move(nt_insertion)),
+        NPadding(std::move(n_padding)){};
   JGermline(YAML::Node root)
       : Germline(root), NTInsertion(root), NPadding(root){};
 };
@@ -0,0 +1,96 @@
+#include "compact_index_matrix.hpp"
+
+/// @file compact_index_matrix.cpp
+/// @brief Implementation of the CompactIndexMatrix class.
+
+namespace linearham {
+
+
+/// @brief Constructor for a matrix of zeros.
+/// @param[in] rows
+/// Number of rows.
+/// @param[in] cols
+/// Number of columns.
+/// @param[in] max_value
+/// The largest value the matrix will need to hold, which picks the width.
+CompactIndexMatrix::CompactIndexMatrix(int rows, int cols, int max_value)
+    : rows_(rows),
+      cols_(cols),
+      width_(WidthFor(max_value)),
+      data_(rows * cols * width_, 0){};
+
+
+/// @brief Constructor copying an Eigen matrix, in the narrowest width that
+/// holds its largest entry.
+CompactIndexMatrix::CompactIndexMatrix(
+    const Eigen::Ref<const Eigen::MatrixXi>& m)
+    : CompactIndexMatrix(m.rows(), m.cols(), (m.size() > 0) ? m.maxCoeff() : 0) {
+  Assign(m);
+};
+
+
+/// @brief The number of bytes per entry needed to hold values up to
+/// `max_value`.
+int CompactIndexMatrix::WidthFor(int max_value) {
+  assert(max_value >= 0);
+  if (max_value <= UINT8_MAX) return 1;
+  if (max_value <= UINT16_MAX) return 2;
+  return 4;
+};
+
+
+/// @brief Copy the entries of an Eigen matrix of the same dimensions, all of
+/// which must fit in the width.
+///
+/// This is how the Viterbi indices that Smoosh writes as 32-bit integers get
+/// narrowed.
+void CompactIndexMatrix::Assign(const Eigen::Ref<const Eigen::MatrixXi>& m) {
+  assert(m.rows() == rows_ && m.cols() == cols_);
+  if (width_ == 1) {
+    // The common case, without the switch per entry.
+    uint8_t* out = data_.data();
+    for (int i = 0; i < rows_; i++) {
+      for (int j = 0; j < cols_; j++) {
+        assert(0 <= m(i, j) && m(i, j) <= UINT8_MAX);
+        *out++ = m(i, j);
+      }
+    }
+    return;
+  }
+  for (int i = 0; i < rows_; i++) {
+    for (int j = 0; j < cols_; j++) Set(i, j, m(i, j));
+  }
+};
+
+
+/// @brief A copy of one row, such as one Viterbi path.
+std::vector<int> CompactIndexMatrix::Row(int row) const {
+  std::vector<int> values(cols_);
+  for (int j = 0; j < cols_; j++) values[j] = (*this)(row, j);
+  return values;
+};
+
+
+/// @brief A copy of the matrix at full width.
+Eigen::MatrixXi CompactIndexMatrix::ToMatrix() const {
+  Eigen::MatrixXi m(rows_, cols_);
+  for (int i = 0; i < rows_; i++) {
+    for (int j = 0; j < cols_; j++) m(i, j) = (*this)(i, j);
+  }
+  return m;
+};
+
+
+/// @brief Whether two matrices have the same dimensions and entries, whatever
+/// their widths.
+bool CompactIndexMatrix::operator==(const CompactIndexMatrix& other) const {
+  if (rows_ != other.rows_ || cols_ != other.cols_) return false;
+  if (width_ == other.width_) return data_ == other.data_;
+  for (int i = 0; i < rows_; i++) {
+    for (int j = 0; j < cols_; j++) {
+      if ((*this)(i, j) != other(i, j)) return false;
+    }
+  }
+  return true;
+};
+}
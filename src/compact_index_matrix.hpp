@@ -0,0 +1,107 @@
+#ifndef LINEARHAM_COMPACT_INDEX_MATRIX_
+#define LINEARHAM_COMPACT_INDEX_MATRIX_
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <Eigen/Dense>
+
+/// @file compact_index_matrix.hpp
+/// @brief Headers for the CompactIndexMatrix class.
+
+namespace linearham {
+
+
+/// @brief A matrix of small nonnegative integers, such as Viterbi indices,
+/// stored in the narrowest of 8, 16 or 32 bits that holds them all.
+///
+/// Viterbi indices are bounded by a flex, which is usually well under 256, so
+/// this takes a quarter of the memory of an Eigen::MatrixXi. Entries are
+/// stored row-major in one flat buffer, so that a row (such as one Viterbi
+/// path) is contiguous.
+class CompactIndexMatrix {
+ protected:
+  int rows_;
+  int cols_;
+  // Bytes per entry: 1, 2 or 4.
+  int width_;
+  std::vector<uint8_t> data_;
+
+  friend class SmooshableArena;
+
+ public:
+  CompactIndexMatrix() : rows_(0), cols_(0), width_(1){};
+  CompactIndexMatrix(int rows, int cols, int max_value);
+  explicit CompactIndexMatrix(const Eigen::Ref<const Eigen::MatrixXi>& m);
+
+  static int WidthFor(int max_value);
+
+  int rows() const { return rows_; };
+  int cols() const { return cols_; };
+  int size() const { return rows_ * cols_; };
+  bool empty() const { return size() == 0; };
+  /// @brief The number of bytes per entry.
+  int width() const { return width_; };
+  /// @brief The number of bytes of storage.
+  size_t bytes() const { return data_.size(); };
+
+  int operator()(int row, int col) const;
+  void Set(int row, int col, int value);
+  void Assign(const Eigen::Ref<const Eigen::MatrixXi>& m);
+
+  std::vector<int> Row(int row) const;
+  Eigen::MatrixXi ToMatrix() const;
+
+  bool operator==(const CompactIndexMatrix& other) const;
+  bool operator!=(const CompactIndexMatrix& other) const {
+    return !(*this == other);
+  };
+};
+
+
+/// @brief An entry of the matrix.
+inline int CompactIndexMatrix::operator()(int row, int col) const {
+  assert(0 <= row && row < rows_ && 0 <= col && col < cols_);
+  int i = row * cols_ + col;
+  switch (width_) {
+    case 1:
+      return data_[i];
+    case 2: {
+      uint16_t value;
+      std::memcpy(&value, &data_[2 * i], 2);
+      return value;
+    }
+    default: {
+      int32_t value;
+      std::memcpy(&value, &data_[4 * i], 4);
+      return value;
+    }
+  }
+};
+
+
+/// @brief Set an entry of the matrix, which must fit in its width.
+inline void CompactIndexMatrix::Set(int row, int col, int value) {
+  assert(0 <= row && row < rows_ && 0 <= col && col < cols_);
+  assert(0 <= value && WidthFor(value) <= width_);
+  int i = row * cols_ + col;
+  switch (width_) {
+    case 1:
+      data_[i] = value;
+      break;
+    case 2: {
+      uint16_t narrow = value;
+      std::memcpy(&data_[2 * i], &narrow, 2);
+      break;
+    }
+    default: {
+      int32_t wide = value;
+      std::memcpy(&data_[4 * i], &wide, 4);
+      break;
+    }
+  }
+};
+}
+
+#endif  // LINEARHAM_COMPACT_INDEX_MATRIX_
@@ -0,0 +1,93 @@
+#ifndef LINEARHAM_FIXED_SMOOSHABLE_
+#define LINEARHAM_FIXED_SMOOSHABLE_
+
+#include "smooshable.hpp"
+
+/// @file fixed_smooshable.hpp
+/// @brief Headers for the FixedSmooshable class template.
+
+namespace linearham {
+
+
+/// @brief A globally scaled Smooshable whose flexes are known at compile time.
+///
+/// The matrices are fixed-size Eigen matrices, so they live inside the object
+/// (on the stack, for a local) rather than on the heap, and smooshing them
+/// unrolls completely. This is meant for small flexes; Smoosh on plain
+/// Smooshables already dispatches small square smooshes to the same kind of
+/// kernels.
+template <int LeftFlex, int RightFlex>
+class FixedSmooshable {
+ public:
+  typedef Eigen::Matrix<double, LeftFlex + 1, RightFlex + 1> Matrix;
+  typedef Eigen::Matrix<int, LeftFlex + 1, RightFlex + 1> IndexMatrix;
+
+ protected:
+  Matrix marginal_;
+  Matrix viterbi_;
+  int scaler_count_;
+
+ public:
+  FixedSmooshable() : scaler_count_(0){};
+  explicit FixedSmooshable(const Smooshable& smooshable);
+
+  int left_flex() const { return LeftFlex; };
+  int right_flex() const { return RightFlex; };
+
+  int scaler_count() const { return scaler_count_; };
+  int& scaler_count() { return scaler_count_; };
+
+  const Matrix& marginal() const { return marginal_; };
+  Matrix& marginal() { return marginal_; };
+  const Matrix& viterbi() const { return viterbi_; };
+  Matrix& viterbi() { return viterbi_; };
+
+  Smooshable ToSmooshable() const;
+};
+
+
+/// @brief Constructor copying a Smooshable with matching flexes.
+/// @param[in] smooshable
+/// A globally scaled Smooshable with both marginal and Viterbi probabilities.
+template <int LeftFlex, int RightFlex>
+FixedSmooshable<LeftFlex, RightFlex>::FixedSmooshable(
+    const Smooshable& smooshable)
+    : marginal_(smooshable.marginal()),
+      viterbi_(smooshable.viterbi()),
+      scaler_count_(smooshable.scaler_count()) {
+  assert(smooshable.scaling() == Scaling::kGlobal);
+  assert(smooshable.mode() == SmooshMode::kBoth);
+};
+
+
+/// @brief Copy into a Smooshable.
+template <int LeftFlex, int RightFlex>
+Smooshable FixedSmooshable<LeftFlex, RightFlex>::ToSmooshable() const {
+  Smooshable smooshable(LeftFlex, RightFlex);
+  smooshable.marginal() = marginal_;
+  smooshable.viterbi() = viterbi_;
+  smooshable.scaler_count() = scaler_count_;
+  return smooshable;
+};
+
+
+/// @brief Smoosh two fixed-size smooshables, as Smoosh does for Smooshables.
+template <int LeftFlex, int MidFlex, int RightFlex>
+std::pair<FixedSmooshable<LeftFlex, RightFlex>,
+          typename FixedSmooshable<LeftFlex, RightFlex>::IndexMatrix>
+Smoosh(const FixedSmooshable<LeftFlex, MidFlex>& s_a,
+       const FixedSmooshable<MidFlex, RightFlex>& s_b) {
+  FixedSmooshable<LeftFlex, RightFlex> s_out;
+  typename FixedSmooshable<LeftFlex, RightFlex>::IndexMatrix viterbi_idx;
+  s_out.marginal().noalias() = s_a.marginal() * s_b.marginal();
+  SmallBinaryMax(s_a.viterbi(), s_b.viterbi(), s_out.viterbi(), viterbi_idx);
+  s_out.scaler_count() = s_a.scaler_count() + s_b.scaler_count();
+  // check for underflow
+  int k = ScaleMatrix(s_out.marginal());
+  if (k > 0) s_out.viterbi() *= pow(SCALE_FACTOR, k);
+  s_out.scaler_count() += k;
+  return std::make_pair(s_out, viterbi_idx);
+};
+}
+
+#endif  // LINEARHAM_FIXED_SMOOSHABLE_
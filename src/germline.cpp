@@ -1,4 +1,5 @@
 #include "germline.hpp"
+#include "instrumentation.hpp"
 
 /// @file germline.cpp
 /// @brief The germline object.
@@ -16,13 +17,34 @@ namespace linearham {
 /// Vector of probabilities of transitioning to the next match state.
 Germline::Germline(Eigen::VectorXd& landing, Eigen::MatrixXd& emission_matrix,
                    Eigen::VectorXd& next_transition)
-    : emission_matrix_(emission_matrix) {
+    : emission_matrix_(Eigen::MatrixXd(emission_matrix)) {
   assert(landing.size() == emission_matrix_.cols());
   assert(landing.size() == next_transition.size() + 1);
-  transition_ = BuildTransition(landing, next_transition);
-  assert(transition_.cols() == emission_matrix_.cols());
+  transition_ = LinearTransition(landing, next_transition);
+  assert(transition_.length() == emission_matrix_.cols());
 };
 
+/// @brief Constructor for Germline from already-built parts.
+/// @param[in] name
+/// The gene name.
+/// @param[in] emission_matrix
+/// Matrix of emission probabilities, with rows as the states and columns as the
+/// sites.
+/// @param[in] transition
+/// The transition probabilities.
+/// @param[in] gene_prob
+/// The probability of the gene.
+Germline::Germline(std::string name,
+                   SharedMatrix<Eigen::MatrixXd> emission_matrix,
+                   LinearTransition transition, double gene_prob)
+    : name_(std::move(name)),
+      emission_matrix_(std::move(emission_matrix)),
+      transition_(std::move(transition)),
+      gene_prob_(gene_prob) {
+  assert(transition_.length() == emission_matrix_.cols());
+};
+
+
 /// @brief Constructor for Germline starting from a YAML file.
 /// @param[in] root
 /// A root node associated with a germline YAML file.
@@ -33,6 +55,7 @@ Germline::Germline(YAML::Node root) {
   std::unordered_map<std::string, int> alphabet_map;
   std::tie(alphabet, alphabet_map) = get_alphabet(root);
   std::string gname = root["name"].as<std::string>();
+  name_ = get_gene_name(root);
 
   // In the YAML file, states of the germline gene are denoted
   // [germline name]_[position]. The vector of probabilities of various
@@ -55,7 +78,8 @@ Germline::Germline(YAML::Node root) {
 
   // Create the Germline data structures.
   Eigen::VectorXd landing = Eigen::VectorXd::Zero(gcount);
-  emission_matrix_.setZero(alphabet.size(), gcount);
+  Eigen::MatrixXd emission_matrix =
+      Eigen::MatrixXd::Zero(alphabet.size(), gcount);
   Eigen::VectorXd next_transition = Eigen::VectorXd::Zero(gcount - 1);
 
   // Store the gene probability.
@@ -110,13 +134,14 @@ Germline::Germline(YAML::Node root) {
     assert(is_equal_string_vecs(state_names, alphabet));
 
     for (unsigned int j = 0; j < state_names.size(); j++) {
-      emission_matrix_(alphabet_map[state_names[j]], gindex) = probs[j];
+      emission_matrix(alphabet_map[state_names[j]], gindex) = probs[j];
     }
   }
 
   // Build the Germline transition matrix.
-  transition_ = BuildTransition(landing, next_transition);
-  assert(transition_.cols() == emission_matrix_.cols());
+  emission_matrix_ = std::move(emission_matrix);
+  transition_ = LinearTransition(landing, next_transition);
+  assert(transition_.length() == emission_matrix_.cols());
 };
 
 
@@ -139,9 +164,9 @@ Germline::Germline(YAML::Node root) {
 /// `i+start` entry of the germline sequence.
 void Germline::EmissionVector(
     const Eigen::Ref<const Eigen::VectorXi>& emission_indices, int start,
-    Eigen::Ref<Eigen::VectorXd> emission) {
+    Eigen::Ref<Eigen::VectorXd> emission) const {
   int length = emission_indices.size();
-  assert(this->length() <= start + length);
+  assert(start + length <= this->length());
   VectorByIndices(
       emission_matrix_.block(0, start, emission_matrix_.rows(), length),
       emission_indices, emission);
@@ -159,6 +184,9 @@ void Germline::EmissionVector(
 /// How many alternative end points should we allow on the right side?
 /// @param[out] match
 /// Storage for the matrix of match probabilities.
+/// @param[in] include_landing
+/// If false, leave out the probability of landing at the start point; see
+/// LinearTransition::Block.
 ///
 /// The match matrix has (zero-indexed) \f$i,j\f$th entry equal to the
 /// probability of a linear match starting at `start+i` and ending
@@ -166,20 +194,50 @@ void Germline::EmissionVector(
 /// Note that we don't need a "stop" parameter because we can give
 /// `emission_indices` a vector of any length (given the constraints
 /// on maximal length).
+///
+/// Only the `(left_flex+1) x (right_flex+1)` block is computed, so the cost is
+/// linear in the length of the read segment rather than quadratic.
+void Germline::MatchMatrix(
+    int start, const Eigen::Ref<const Eigen::VectorXi>& emission_indices,
+    int left_flex, int right_flex, Eigen::Ref<Eigen::MatrixXd> match,
+    bool include_landing) const {
+  Eigen::VectorXd emission(emission_indices.size());
+  Eigen::MatrixXd transition_block(left_flex + 1, right_flex + 1);
+  MatchMatrix(start, emission_indices, left_flex, right_flex, match,
+              include_landing, emission, transition_block);
+};
+
+
+/// @brief Prepares a matrix of match probabilities as the other MatchMatrix
+/// does, in scratch storage given by the caller.
+/// @param[out] emission
+/// Scratch vector of the length of `emission_indices`.
+/// @param[out] transition_block
+/// Scratch matrix of the dimensions of `match`.
+///
+/// The other parameters are as for the other MatchMatrix. Nothing is
+/// allocated, so with scratch from a SmooshableArena this is free of heap
+/// traffic.
 void Germline::MatchMatrix(
     int start, const Eigen::Ref<const Eigen::VectorXi>& emission_indices,
-    int left_flex, int right_flex, Eigen::Ref<Eigen::MatrixXd> match) {
+    int left_flex, int right_flex, Eigen::Ref<Eigen::MatrixXd> match,
+    bool include_landing, Eigen::Ref<Eigen::VectorXd> emission,
+    Eigen::Ref<Eigen::MatrixXd> transition_block) const {
   int length = emission_indices.size();
   assert(0 <= left_flex && left_flex <= length - 1);
   assert(0 <= right_flex && right_flex <= length - 1);
-  assert(this->length() <= start + length);
-  Eigen::VectorXd emission(length);
-  /// @todo Inefficient. Shouldn't calculate fullMatch then cut it down.
-  Eigen::MatrixXd fullMatch(length, length);
+  assert(start + length <= this->length());
+  assert(match.rows() == left_flex + 1);
+  assert(match.cols() == right_flex + 1);
+  assert(emission.size() == length);
+  assert(transition_block.rows() == match.rows());
+  assert(transition_block.cols() == match.cols());
+  LINEARHAM_TIME(kMatchMatrix);
   EmissionVector(emission_indices, start, emission);
-  BuildMatchMatrix(transition_.block(start, start, length, length), emission,
-                   fullMatch);
-  match = fullMatch.block(0, length - right_flex - 1, left_flex + 1,
-                          right_flex + 1);
+  int first_col = length - right_flex - 1;
+  SubProductBlock(emission, 0, first_col, match);
+  transition_.Block(start, start + first_col, transition_block,
+                    include_landing);
+  match.array() *= transition_block.array();
 };
 }
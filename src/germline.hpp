@@ -1,6 +1,7 @@
 #ifndef LINEARHAM_GERMLINE_
 #define LINEARHAM_GERMLINE_
 
+#include "linear_transition.hpp"
 #include "yaml_utils.hpp"
 
 /// @file germline.hpp
@@ -11,30 +12,48 @@ namespace linearham {
 
 /// @brief The HMM representation of a germline gene, without reference to any
 /// reads.
+///
+/// The matrices may live in a mapped GermlineFile (see SharedMatrix), so
+/// copies of a Germline share them.
 class Germline {
  protected:
-  Eigen::MatrixXd emission_matrix_;
-  Eigen::MatrixXd transition_;
+  std::string name_;
+  SharedMatrix<Eigen::MatrixXd> emission_matrix_;
+  LinearTransition transition_;
   double gene_prob_;
 
  public:
   Germline(){};
   Germline(Eigen::VectorXd& landing, Eigen::MatrixXd& emission_matrix,
            Eigen::VectorXd& next_transition);
+  Germline(std::string name, SharedMatrix<Eigen::MatrixXd> emission_matrix,
+           LinearTransition transition, double gene_prob);
   Germline(YAML::Node root);
 
-  Eigen::MatrixXd emission_matrix() const { return emission_matrix_; };
-  Eigen::MatrixXd transition() const { return transition_; };
+  const std::string& name() const { return name_; };
+  const Eigen::Map<const Eigen::MatrixXd>& emission_matrix() const {
+    return emission_matrix_;
+  };
+  // The dense transition matrix is built on demand; see LinearTransition.
+  Eigen::MatrixXd transition() const { return transition_.Dense(); };
+  const LinearTransition& linear_transition() const { return transition_; };
   double gene_prob() const { return gene_prob_; };
-  int length() const { return transition_.cols(); };
+  int length() const { return transition_.length(); };
 
   void EmissionVector(const Eigen::Ref<const Eigen::VectorXi>& emission_indices,
-                      int start, Eigen::Ref<Eigen::VectorXd> emission);
+                      int start, Eigen::Ref<Eigen::VectorXd> emission) const;
 
   void MatchMatrix(int start,
                    const Eigen::Ref<const Eigen::VectorXi>& emission_indices,
                    int left_flex, int right_flex,
-                   Eigen::Ref<Eigen::MatrixXd> match);
+                   Eigen::Ref<Eigen::MatrixXd> match,
+                   bool include_landing = true) const;
+  void MatchMatrix(int start,
+                   const Eigen::Ref<const Eigen::VectorXi>& emission_indices,
+                   int left_flex, int right_flex,
+                   Eigen::Ref<Eigen::MatrixXd> match, bool include_landing,
+                   Eigen::Ref<Eigen::VectorXd> emission,
+                   Eigen::Ref<Eigen::MatrixXd> transition_block) const;
 };
 }
 
@@ -0,0 +1,346 @@
+#include "germline_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include "instrumentation.hpp"
+
+/// @file germline_file.cpp
+/// @brief Reading and writing binary germline set files.
+///
+/// A germline set file holds every gene of a GermlineStore in the form that
+/// the classes keep in memory, so loading one involves no YAML or regex
+/// parsing. The layout, in native byte order, is
+///
+/// - a FileHeader, followed by one uint64 byte offset per gene;
+/// - for each gene, a RecordHeader, the gene name, and then the arrays
+///   landing, fall_off, log_prefix, zero_prefix (int32) and emission_matrix,
+///   then n_emission_vector for genes with padding (V and J), then
+///   n_landing_in, n_landing_out, n_emission_matrix and n_transition for genes
+///   with non-templated insertions (D and J).
+///
+/// Matrices are column-major, and everything starts on an 8-byte boundary so
+/// that the arrays can be used in place once the file is mapped.
+
+namespace linearham {
+
+
+namespace {
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t gene_count;
+};
+
+struct RecordHeader {
+  uint32_t type;
+  uint32_t name_size;
+  uint32_t length;
+  uint32_t alphabet_size;
+  double gene_prob;
+  double n_self_transition_prob;
+};
+
+size_t Aligned(size_t size) { return (size + 7) / 8 * 8; };
+
+
+// Appends `count` objects to the buffer, padding to the next 8-byte boundary.
+template <class T>
+void Append(std::vector<char>& buffer, const T* data, size_t count) {
+  const char* bytes = reinterpret_cast<const char*>(data);
+  buffer.insert(buffer.end(), bytes, bytes + count * sizeof(T));
+  buffer.resize(Aligned(buffer.size()), 0);
+};
+
+
+void AppendRecord(std::vector<char>& buffer, char type,
+                  const Germline& germline, const NPadding* n_padding,
+                  const NTInsertion* nt_insertion) {
+  const LinearTransition& transition = germline.linear_transition();
+  RecordHeader header;
+  header.type = type;
+  header.name_size = germline.name().size();
+  header.length = germline.length();
+  header.alphabet_size = germline.emission_matrix().rows();
+  header.gene_prob = germline.gene_prob();
+  header.n_self_transition_prob =
+      (n_padding == nullptr) ? 0. : n_padding->n_self_transition_prob();
+  Append(buffer, &header, 1);
+  Append(buffer, germline.name().data(), header.name_size);
+  Append(buffer, transition.landing().data(), header.length);
+  Append(buffer, transition.fall_off().data(), header.length);
+  Append(buffer, transition.log_prefix().data(), header.length);
+  std::vector<int32_t> zero_prefix(transition.zero_prefix().data(),
+                                   transition.zero_prefix().data() +
+                                       header.length);
+  Append(buffer, zero_prefix.data(), header.length);
+  Append(buffer, germline.emission_matrix().data(),
+         germline.emission_matrix().size());
+  if (n_padding != nullptr) {
+    Append(buffer, n_padding->n_emission_vector().data(),
+           n_padding->n_emission_vector().size());
+  }
+  if (nt_insertion != nullptr) {
+    Append(buffer, nt_insertion->n_landing_in().data(),
+           nt_insertion->n_landing_in().size());
+    Append(buffer, nt_insertion->n_landing_out().data(),
+           nt_insertion->n_landing_out().size());
+    Append(buffer, nt_insertion->n_emission_matrix().data(),
+           nt_insertion->n_emission_matrix().size());
+    Append(buffer, nt_insertion->n_transition().data(),
+           nt_insertion->n_transition().size());
+  }
+};
+
+
+// Walks through a mapped file, checking that everything we take lies inside
+// of it.
+class Cursor {
+ protected:
+  const char* data_;
+  size_t size_;
+  size_t offset_;
+
+ public:
+  Cursor(const void* data, size_t size, size_t offset)
+      : data_(static_cast<const char*>(data)), size_(size), offset_(offset){};
+
+  // Dividing rather than multiplying, so that no count can overflow.
+  template <class T>
+  const T* Take(uint64_t count) {
+    if (offset_ > size_ || count > (size_ - offset_) / sizeof(T)) {
+      throw std::runtime_error("Germline set file is truncated.");
+    }
+    const T* data = reinterpret_cast<const T*>(data_ + offset_);
+    offset_ = Aligned(offset_ + count * sizeof(T));
+    return data;
+  };
+};
+
+
+template <class T>
+std::vector<std::pair<std::string, T>> SortedByName(
+    const std::unordered_map<std::string, T>& germlines) {
+  std::vector<std::pair<std::string, T>> sorted(germlines.begin(),
+                                                germlines.end());
+  std::sort(sorted.begin(), sorted.end(),
+            [](const std::pair<std::string, T>& a,
+               const std::pair<std::string, T>& b) { return a.first < b.first; });
+  return sorted;
+};
+}
+
+
+// GermlineRecord
+
+/// @brief Build the germline part of the record, mapping its arrays in the
+/// file.
+Germline GermlineRecord::BuildGermline() const {
+  LinearTransition transition(
+      SharedMatrix<Eigen::VectorXd>(landing_data, length, 1, mapping),
+      SharedMatrix<Eigen::VectorXd>(fall_off_data, length, 1, mapping),
+      SharedMatrix<Eigen::VectorXd>(log_prefix_data, length, 1, mapping),
+      SharedMatrix<Eigen::VectorXi>(zero_prefix_data, length, 1, mapping));
+  return Germline(name,
+                  SharedMatrix<Eigen::MatrixXd>(emission_matrix_data,
+                                                alphabet_size, length, mapping),
+                  std::move(transition), gene_prob);
+};
+
+
+/// @brief Build the padding part of the record, mapping its arrays in the
+/// file.
+NPadding GermlineRecord::BuildNPadding() const {
+  assert(has_n_padding());
+  return NPadding(n_self_transition_prob,
+                  SharedMatrix<Eigen::VectorXd>(n_emission_vector_data,
+                                                alphabet_size, 1, mapping));
+};
+
+
+/// @brief Build the non-templated insertion part of the record, mapping its
+/// arrays in the file.
+NTInsertion GermlineRecord::BuildNTInsertion() const {
+  assert(has_nt_insertion());
+  return NTInsertion(
+      SharedMatrix<Eigen::VectorXd>(n_landing_in_data, alphabet_size, 1,
+                                    mapping),
+      SharedMatrix<Eigen::MatrixXd>(n_landing_out_data, alphabet_size, length,
+                                    mapping),
+      SharedMatrix<Eigen::MatrixXd>(n_emission_matrix_data, alphabet_size,
+                                    alphabet_size, mapping),
+      SharedMatrix<Eigen::MatrixXd>(n_transition_data, alphabet_size,
+                                    alphabet_size, mapping));
+};
+
+
+// GermlineFile
+
+/// @brief Map a germline set file into memory and index its records.
+/// @param[in] path
+/// Path to a file written by WriteGermlineFile.
+GermlineFile::GermlineFile(std::string path) : size_(0) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Can't open germline set " + path);
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size < 0 ||
+      static_cast<size_t>(file_stat.st_size) < sizeof(FileHeader)) {
+    close(fd);
+    throw std::runtime_error(path + " is not a germline set file.");
+  }
+  size_ = file_stat.st_size;
+  void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("Can't map germline set " + path);
+  }
+  // Unmapped when the last of us and the genes built from us goes.
+  size_t size = size_;
+  mapping_ = std::shared_ptr<const void>(
+      data, [size](const void* p) { munmap(const_cast<void*>(p), size); });
+
+  Cursor cursor(data, size_, 0);
+  const FileHeader* header = cursor.Take<FileHeader>(1);
+  if (std::memcmp(header->magic, GERMLINE_FILE_MAGIC, 8) != 0) {
+    throw std::runtime_error(path + " is not a germline set file.");
+  }
+  if (header->version != GERMLINE_FILE_VERSION) {
+    throw std::runtime_error(path + " has germline set file version " +
+                             std::to_string(header->version) +
+                             ", but we need version " +
+                             std::to_string(GERMLINE_FILE_VERSION) + ".");
+  }
+  const uint64_t* offsets = cursor.Take<uint64_t>(header->gene_count);
+  // No array can hold more doubles than fit in the file, and the sizes have
+  // to fit in an int.
+  uint64_t max_size = std::min<uint64_t>(size_ / sizeof(double),
+                                         std::numeric_limits<int>::max());
+
+  records_.resize(header->gene_count);
+  for (unsigned int i = 0; i < header->gene_count; i++) {
+    // The writer starts records on 8-byte boundaries (see Aligned), and the
+    // arrays in them are only aligned if the record is.
+    if (offsets[i] != Aligned(offsets[i])) {
+      throw std::runtime_error(path + " is not a germline set file.");
+    }
+    Cursor record_cursor(data, size_, offsets[i]);
+    const RecordHeader* record_header = record_cursor.Take<RecordHeader>(1);
+    GermlineRecord& record = records_[i];
+    record.mapping = mapping_;
+    record.type = record_header->type;
+    if (record.type != 'V' && record.type != 'D' && record.type != 'J') {
+      throw std::runtime_error(path + " has a gene of unknown type.");
+    }
+    if (record_header->length > max_size ||
+        record_header->alphabet_size > max_size) {
+      throw std::runtime_error(path + " has a gene of impossible size.");
+    }
+    const char* name = record_cursor.Take<char>(record_header->name_size);
+    record.name.assign(name, record_header->name_size);
+    record.length = record_header->length;
+    record.alphabet_size = record_header->alphabet_size;
+    record.gene_prob = record_header->gene_prob;
+    record.n_self_transition_prob = record_header->n_self_transition_prob;
+
+    // Each is at most 2^31, so their products can't overflow.
+    uint64_t ell = record.length, alpha = record.alphabet_size;
+    record.landing_data = record_cursor.Take<double>(ell);
+    record.fall_off_data = record_cursor.Take<double>(ell);
+    record.log_prefix_data = record_cursor.Take<double>(ell);
+    record.zero_prefix_data = record_cursor.Take<int32_t>(ell);
+    record.emission_matrix_data = record_cursor.Take<double>(alpha * ell);
+    record.n_emission_vector_data = nullptr;
+    record.n_landing_in_data = nullptr;
+    record.n_landing_out_data = nullptr;
+    record.n_emission_matrix_data = nullptr;
+    record.n_transition_data = nullptr;
+    if (record.has_n_padding()) {
+      record.n_emission_vector_data = record_cursor.Take<double>(alpha);
+    }
+    if (record.has_nt_insertion()) {
+      record.n_landing_in_data = record_cursor.Take<double>(alpha);
+      record.n_landing_out_data = record_cursor.Take<double>(alpha * ell);
+      record.n_emission_matrix_data = record_cursor.Take<double>(alpha * alpha);
+      record.n_transition_data = record_cursor.Take<double>(alpha * alpha);
+    }
+  }
+};
+
+
+/// @brief Add every gene in the file to a GermlineStore.
+/// @param[in] store
+/// The store to add to.
+void GermlineFile::LoadInto(GermlineStore& store) const {
+  LINEARHAM_TIME(kGermlineLoading);
+  LINEARHAM_COUNT(kGermlinesLoaded, records_.size());
+  for (const GermlineRecord& record : records_) {
+    switch (record.type) {
+      case 'V':
+        store.Add(VGermline(record.BuildGermline(), record.BuildNPadding()));
+        break;
+      case 'D':
+        store.Add(
+            DGermline(record.BuildGermline(), record.BuildNTInsertion()));
+        break;
+      case 'J':
+        store.Add(JGermline(record.BuildGermline(), record.BuildNTInsertion(),
+                            record.BuildNPadding()));
+        break;
+    }
+  }
+};
+
+
+// Functions
+
+/// @brief Write all of the genes in a GermlineStore to a germline set file.
+/// @param[in] store
+/// The genes to write.
+/// @param[in] path
+/// Where to write them.
+void WriteGermlineFile(const GermlineStore& store, std::string path) {
+  auto v_germlines = SortedByName(store.v_germlines());
+  auto d_germlines = SortedByName(store.d_germlines());
+  auto j_germlines = SortedByName(store.j_germlines());
+
+  FileHeader header;
+  std::memcpy(header.magic, GERMLINE_FILE_MAGIC, 8);
+  header.version = GERMLINE_FILE_VERSION;
+  header.gene_count = store.size();
+
+  // Records go after the header and offset table; we fill in the offsets as
+  // we go.
+  std::vector<char> buffer;
+  Append(buffer, &header, 1);
+  size_t offsets_start = buffer.size();
+  std::vector<uint64_t> offsets;
+  buffer.resize(offsets_start + header.gene_count * sizeof(uint64_t), 0);
+
+  for (const auto& v : v_germlines) {
+    offsets.push_back(buffer.size());
+    AppendRecord(buffer, 'V', *v.second, v.second.get(), nullptr);
+  }
+  for (const auto& d : d_germlines) {
+    offsets.push_back(buffer.size());
+    AppendRecord(buffer, 'D', *d.second, nullptr, d.second.get());
+  }
+  for (const auto& j : j_germlines) {
+    offsets.push_back(buffer.size());
+    AppendRecord(buffer, 'J', *j.second, j.second.get(), j.second.get());
+  }
+  assert(offsets.size() == header.gene_count);
+  std::memcpy(buffer.data() + offsets_start, offsets.data(),
+              offsets.size() * sizeof(uint64_t));
+
+  std::ofstream out(path, std::ios::binary);
+  out.write(buffer.data(), buffer.size());
+  if (!out) throw std::runtime_error("Can't write germline set " + path);
+};
+}
@@ -0,0 +1,117 @@
+#ifndef LINEARHAM_GERMLINE_FILE_
+#define LINEARHAM_GERMLINE_FILE_
+
+#include <cstdint>
+#include <memory>
+#include "germline_store.hpp"
+
+/// @file germline_file.hpp
+/// @brief Headers for reading and writing binary germline set files.
+
+namespace linearham {
+
+
+const char GERMLINE_FILE_MAGIC[8] = {'L', 'H', 'G', 'E', 'R', 'M', 'S', '\0'};
+const uint32_t GERMLINE_FILE_VERSION = 1;
+
+
+/// @brief A view of one gene in a memory-mapped germline set file.
+///
+/// The accessors are Eigen maps pointing straight into the mapped file, and
+/// the genes built from a record map its arrays too, so nothing is ever
+/// copied out of the file. Each record holds on to the mapping, which lasts
+/// as long as any gene built from it.
+class GermlineRecord {
+ public:
+  std::shared_ptr<const void> mapping;
+  char type;
+  std::string name;
+  int length;
+  int alphabet_size;
+  double gene_prob;
+  double n_self_transition_prob;
+
+  const double* landing_data;
+  const double* fall_off_data;
+  const double* log_prefix_data;
+  const int32_t* zero_prefix_data;
+  const double* emission_matrix_data;
+  const double* n_emission_vector_data;
+  const double* n_landing_in_data;
+  const double* n_landing_out_data;
+  const double* n_emission_matrix_data;
+  const double* n_transition_data;
+
+  bool has_n_padding() const { return type != 'D'; };
+  bool has_nt_insertion() const { return type != 'V'; };
+
+  Eigen::Map<const Eigen::VectorXd> landing() const {
+    return Eigen::Map<const Eigen::VectorXd>(landing_data, length);
+  };
+  Eigen::Map<const Eigen::VectorXd> fall_off() const {
+    return Eigen::Map<const Eigen::VectorXd>(fall_off_data, length);
+  };
+  Eigen::Map<const Eigen::VectorXd> log_prefix() const {
+    return Eigen::Map<const Eigen::VectorXd>(log_prefix_data, length);
+  };
+  Eigen::Map<const Eigen::VectorXi> zero_prefix() const {
+    return Eigen::Map<const Eigen::VectorXi>(zero_prefix_data, length);
+  };
+  Eigen::Map<const Eigen::MatrixXd> emission_matrix() const {
+    return Eigen::Map<const Eigen::MatrixXd>(emission_matrix_data,
+                                             alphabet_size, length);
+  };
+  Eigen::Map<const Eigen::VectorXd> n_emission_vector() const {
+    return Eigen::Map<const Eigen::VectorXd>(n_emission_vector_data,
+                                             alphabet_size);
+  };
+  Eigen::Map<const Eigen::VectorXd> n_landing_in() const {
+    return Eigen::Map<const Eigen::VectorXd>(n_landing_in_data, alphabet_size);
+  };
+  Eigen::Map<const Eigen::MatrixXd> n_landing_out() const {
+    return Eigen::Map<const Eigen::MatrixXd>(n_landing_out_data,
+                                             alphabet_size, length);
+  };
+  Eigen::Map<const Eigen::MatrixXd> n_emission_matrix() const {
+    return Eigen::Map<const Eigen::MatrixXd>(n_emission_matrix_data,
+                                             alphabet_size, alphabet_size);
+  };
+  Eigen::Map<const Eigen::MatrixXd> n_transition() const {
+    return Eigen::Map<const Eigen::MatrixXd>(n_transition_data, alphabet_size,
+                                             alphabet_size);
+  };
+
+  Germline BuildGermline() const;
+  NPadding BuildNPadding() const;
+  NTInsertion BuildNTInsertion() const;
+};
+
+
+/// @brief A read-only, memory-mapped germline set file, as written by
+/// WriteGermlineFile.
+///
+/// Opening one of these costs a single mmap, and several processes opening the
+/// same file share one copy of it in the page cache. The file is unmapped
+/// once both this and every gene loaded from it are gone, so a GermlineFile
+/// needn't outlive the GermlineStore it was loaded into.
+class GermlineFile {
+ protected:
+  std::shared_ptr<const void> mapping_;
+  size_t size_;
+  std::vector<GermlineRecord> records_;
+
+ public:
+  GermlineFile(std::string path);
+  GermlineFile(const GermlineFile&) = delete;
+  GermlineFile& operator=(const GermlineFile&) = delete;
+
+  const std::vector<GermlineRecord>& records() const { return records_; };
+
+  void LoadInto(GermlineStore& store) const;
+};
+
+
+void WriteGermlineFile(const GermlineStore& store, std::string path);
+}
+
+#endif  // LINEARHAM_GERMLINE_FILE_
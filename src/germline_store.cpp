@@ -0,0 +1,134 @@
+#include "germline_store.hpp"
+
+#include <dirent.h>
+#include <algorithm>
+#include <stdexcept>
+#include "instrumentation.hpp"
+
+/// @file germline_store.cpp
+/// @brief Implementation of the GermlineStore class.
+
+namespace linearham {
+
+
+namespace {
+
+// Put a gene into a list sorted by name, replacing any of the same name.
+template <class GermlinePtr>
+void AddSorted(std::vector<GermlinePtr>& sorted, const GermlinePtr& germline) {
+  auto it = std::lower_bound(
+      sorted.begin(), sorted.end(), germline,
+      [](const GermlinePtr& a, const GermlinePtr& b) {
+        return a->name() < b->name();
+      });
+  if (it != sorted.end() && (*it)->name() == germline->name()) {
+    *it = germline;
+  } else {
+    sorted.insert(it, germline);
+  }
+}
+}
+
+
+/// @brief Constructor loading every germline YAML file in a directory.
+/// @param[in] dir_path
+/// Path to a directory of partis HMM YAML files, such as a partis
+/// `hmm_params` directory.
+GermlineStore::GermlineStore(std::string dir_path) {
+  LINEARHAM_TIME(kGermlineLoading);
+  DIR* dir = opendir(dir_path.c_str());
+  if (dir == nullptr) {
+    throw std::runtime_error("Can't open germline directory " + dir_path);
+  }
+  std::vector<std::string> yaml_paths;
+  for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+    std::string file_name = entry->d_name;
+    if (file_name.size() > 5 &&
+        file_name.substr(file_name.size() - 5, 5) == ".yaml") {
+      yaml_paths.push_back(dir_path + "/" + file_name);
+    }
+  }
+  closedir(dir);
+  // Load in a reproducible order.
+  std::sort(yaml_paths.begin(), yaml_paths.end());
+  for (const std::string& yaml_path : yaml_paths) {
+    AddYAML(get_yaml_root(yaml_path));
+  }
+  LINEARHAM_COUNT(kGermlinesLoaded, yaml_paths.size());
+};
+
+
+/// @brief Add the gene described by a germline YAML file.
+/// @param[in] root
+/// A root node associated with a germline YAML file.
+void GermlineStore::AddYAML(YAML::Node root) {
+  switch (get_germline_type(root)) {
+    case 'V':
+      Add(VGermline(root));
+      break;
+    case 'D':
+      Add(DGermline(root));
+      break;
+    case 'J':
+      Add(JGermline(root));
+      break;
+  }
+};
+
+
+/// @brief Add a V gene, keyed by its name.
+void GermlineStore::Add(VGermline v_germline) {
+  std::string name = v_germline.name();
+  v_germlines_[name] = std::make_shared<const VGermline>(std::move(v_germline));
+  AddSorted(sorted_v_germlines_, v_germlines_[name]);
+};
+
+
+/// @brief Add a D gene, keyed by its name.
+void GermlineStore::Add(DGermline d_germline) {
+  std::string name = d_germline.name();
+  d_germlines_[name] = std::make_shared<const DGermline>(std::move(d_germline));
+  AddSorted(sorted_d_germlines_, d_germlines_[name]);
+};
+
+
+/// @brief Add a J gene, keyed by its name.
+void GermlineStore::Add(JGermline j_germline) {
+  std::string name = j_germline.name();
+  j_germlines_[name] = std::make_shared<const JGermline>(std::move(j_germline));
+  AddSorted(sorted_j_germlines_, j_germlines_[name]);
+};
+
+
+/// @brief Look up a V gene.
+/// @param[in] name
+/// The gene name, e.g. IGHV1-2*04.
+/// @return
+/// The gene, or a null pointer if the store doesn't have it.
+VGermlinePtr GermlineStore::v_germline(const std::string& name) const {
+  auto it = v_germlines_.find(name);
+  return (it == v_germlines_.end()) ? nullptr : it->second;
+};
+
+
+/// @brief Look up a D gene.
+/// @param[in] name
+/// The gene name, e.g. IGHD7-27*01.
+/// @return
+/// The gene, or a null pointer if the store doesn't have it.
+DGermlinePtr GermlineStore::d_germline(const std::string& name) const {
+  auto it = d_germlines_.find(name);
+  return (it == d_germlines_.end()) ? nullptr : it->second;
+};
+
+
+/// @brief Look up a J gene.
+/// @param[in] name
+/// The gene name, e.g. IGHJ4*01.
+/// @return
+/// The gene, or a null pointer if the store doesn't have it.
+JGermlinePtr GermlineStore::j_germline(const std::string& name) const {
+  auto it = j_germlines_.find(name);
+  return (it == j_germlines_.end()) ? nullptr : it->second;
+};
+}
@@ -0,0 +1,77 @@
+#ifndef LINEARHAM_GERMLINE_STORE_
+#define LINEARHAM_GERMLINE_STORE_
+
+#include <memory>
+#include "VDJgermline.hpp"
+
+/// @file germline_store.hpp
+/// @brief Headers for the GermlineStore class.
+
+namespace linearham {
+
+
+typedef std::shared_ptr<const VGermline> VGermlinePtr;
+typedef std::shared_ptr<const DGermline> DGermlinePtr;
+typedef std::shared_ptr<const JGermline> JGermlinePtr;
+
+
+/// @brief A read-only collection of V, D and J germline genes, keyed by gene
+/// name.
+///
+/// Each gene is stored exactly once and handed out as a pointer to const, so
+/// looking up a gene never copies its matrices. Once loading is done a store
+/// is never modified, so it can be shared between worker threads without
+/// locking.
+///
+/// Besides the maps by name, the store keeps the genes of each type in a
+/// list sorted by name, so that they can be gone through (or a subset picked
+/// out by index) in a reproducible order without sorting anything.
+class GermlineStore {
+ protected:
+  std::unordered_map<std::string, VGermlinePtr> v_germlines_;
+  std::unordered_map<std::string, DGermlinePtr> d_germlines_;
+  std::unordered_map<std::string, JGermlinePtr> j_germlines_;
+  std::vector<VGermlinePtr> sorted_v_germlines_;
+  std::vector<DGermlinePtr> sorted_d_germlines_;
+  std::vector<JGermlinePtr> sorted_j_germlines_;
+
+ public:
+  GermlineStore(){};
+  GermlineStore(std::string dir_path);
+
+  void AddYAML(YAML::Node root);
+  void Add(VGermline v_germline);
+  void Add(DGermline d_germline);
+  void Add(JGermline j_germline);
+
+  VGermlinePtr v_germline(const std::string& name) const;
+  DGermlinePtr d_germline(const std::string& name) const;
+  JGermlinePtr j_germline(const std::string& name) const;
+
+  const std::unordered_map<std::string, VGermlinePtr>& v_germlines() const {
+    return v_germlines_;
+  };
+  const std::unordered_map<std::string, DGermlinePtr>& d_germlines() const {
+    return d_germlines_;
+  };
+  const std::unordered_map<std::string, JGermlinePtr>& j_germlines() const {
+    return j_germlines_;
+  };
+
+  const std::vector<VGermlinePtr>& sorted_v_germlines() const {
+    return sorted_v_germlines_;
+  };
+  const std::vector<DGermlinePtr>& sorted_d_germlines() const {
+    return sorted_d_germlines_;
+  };
+  const std::vector<JGermlinePtr>& sorted_j_germlines() const {
+    return sorted_j_germlines_;
+  };
+
+  int size() const {
+    return v_germlines_.size() + d_germlines_.size() + j_germlines_.size();
+  };
+};
+}
+
+#endif  // LINEARHAM_GERMLINE_STORE_
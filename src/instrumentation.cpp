@@ -0,0 +1,207 @@
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "instrumentation.hpp"
+
+/// @file instrumentation.cpp
+/// @brief Implementation of counters and timers on the hot paths.
+
+namespace linearham {
+
+
+namespace {
+
+const int kCounterCount = static_cast<int>(Counter::kCount);
+const int kStageCount = static_cast<int>(Stage::kCount);
+
+const char* const kCounterNames[kCounterCount] = {
+    "reads annotated", "germlines loaded", "Smoosh FLOPs",
+    "rescale iterations"};
+const char* const kStageNames[kStageCount] = {
+    "germline loading", "MatchMatrix", "Smoosh", "batch Smoosh",
+    "max-product", "Viterbi unwinding"};
+
+
+// The counts of one thread. Only that thread writes them, so an update is a
+// relaxed load and store rather than a locked read-modify-write; they are
+// atomic so that the report can read them from another thread.
+struct ThreadCounts {
+  std::atomic<long> counters[kCounterCount];
+  std::atomic<long> stage_calls[kStageCount];
+  std::atomic<long> stage_nanoseconds[kStageCount];
+
+  ThreadCounts() { Reset(); };
+
+  void Reset() {
+    for (auto& counter : counters) counter.store(0);
+    for (auto& calls : stage_calls) calls.store(0);
+    for (auto& nanoseconds : stage_nanoseconds) nanoseconds.store(0);
+  };
+};
+
+
+void Add(std::atomic<long>& count, long n) {
+  count.store(count.load(std::memory_order_relaxed) + n,
+              std::memory_order_relaxed);
+}
+
+
+// The counts of every thread that has recorded anything. They outlive their
+// threads, so that work done by a finished ThreadPool is still reported, and
+// are never freed, so that the report at exit can't outlive them.
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadCounts>> thread_counts;
+};
+
+
+Registry& GetRegistry() {
+  static Registry* registry = new Registry;
+  return *registry;
+}
+
+
+ThreadCounts& LocalCounts() {
+  thread_local ThreadCounts* counts = nullptr;
+  if (counts == nullptr) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.thread_counts.emplace_back(new ThreadCounts);
+    counts = registry.thread_counts.back().get();
+  }
+  return *counts;
+}
+
+
+// Sum a count over every thread.
+template <class F>
+long Total(F count) {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  long total = 0;
+  for (const auto& counts : registry.thread_counts) {
+    total += count(*counts).load(std::memory_order_relaxed);
+  }
+  return total;
+}
+}
+
+
+/// @brief Add to a counter of the calling thread.
+void AddToCounter(Counter counter, long n) {
+  Add(LocalCounts().counters[static_cast<int>(counter)], n);
+};
+
+
+/// @brief Record one call to a stage by the calling thread.
+/// @param[in] stage
+/// The stage.
+/// @param[in] nanoseconds
+/// How long the call took.
+void AddToStage(Stage stage, long nanoseconds) {
+  ThreadCounts& counts = LocalCounts();
+  Add(counts.stage_calls[static_cast<int>(stage)], 1);
+  Add(counts.stage_nanoseconds[static_cast<int>(stage)], nanoseconds);
+};
+
+
+/// @brief A counter, summed over threads.
+long CounterTotal(Counter counter) {
+  return Total([counter](ThreadCounts& counts) -> std::atomic<long>& {
+    return counts.counters[static_cast<int>(counter)];
+  });
+};
+
+
+/// @brief The number of calls to a stage, summed over threads.
+long StageCalls(Stage stage) {
+  return Total([stage](ThreadCounts& counts) -> std::atomic<long>& {
+    return counts.stage_calls[static_cast<int>(stage)];
+  });
+};
+
+
+/// @brief The time spent in a stage, summed over threads.
+long StageNanoseconds(Stage stage) {
+  return Total([stage](ThreadCounts& counts) -> std::atomic<long>& {
+    return counts.stage_nanoseconds[static_cast<int>(stage)];
+  });
+};
+
+
+/// @brief Write a table of the counters and stage timings, summed over
+/// threads.
+/// @param[in] out
+/// Where to write it.
+///
+/// Times are summed over threads, so with several threads they can add up to
+/// more than the wall time. If any reads were annotated, we also report the
+/// average per read.
+void WriteInstrumentationReport(std::ostream& out) {
+  long read_count = CounterTotal(Counter::kReadsAnnotated);
+  std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(3);
+  size_t thread_count;
+  {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    thread_count = registry.thread_counts.size();
+  }
+  out << "linearham instrumentation (" << thread_count << " threads)\n";
+  out << std::left << std::setw(20) << "stage" << std::right << std::setw(14)
+      << "calls" << std::setw(14) << "total ms" << std::setw(14) << "mean us"
+      << std::setw(14) << "calls/read" << "\n";
+  for (int i = 0; i < kStageCount; i++) {
+    long calls = StageCalls(static_cast<Stage>(i));
+    double ms = StageNanoseconds(static_cast<Stage>(i)) * 1e-6;
+    out << std::left << std::setw(20) << kStageNames[i] << std::right
+        << std::setw(14) << calls << std::setw(14) << ms << std::setw(14)
+        << ((calls > 0) ? 1e3 * ms / calls : 0.) << std::setw(14)
+        << ((read_count > 0) ? static_cast<double>(calls) / read_count : 0.)
+        << "\n";
+  }
+  out << std::left << std::setw(20) << "counter" << std::right << std::setw(14)
+      << "total" << std::setw(14) << "per read" << "\n";
+  for (int i = 0; i < kCounterCount; i++) {
+    long total = CounterTotal(static_cast<Counter>(i));
+    out << std::left << std::setw(20) << kCounterNames[i] << std::right
+        << std::setw(14) << total << std::setw(14)
+        << ((read_count > 0) ? static_cast<double>(total) / read_count : 0.)
+        << "\n";
+  }
+  out.flags(flags);
+};
+
+
+/// @brief Zero every count of every thread.
+///
+/// Threads that are recording at the same time may lose some of their
+/// counts.
+void ResetInstrumentation() {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (const auto& counts : registry.thread_counts) counts->Reset();
+};
+
+
+#ifdef LINEARHAM_INSTRUMENT
+namespace {
+
+// Writes the report at exit, if anything was recorded.
+struct ReportAtExit {
+  ~ReportAtExit() {
+    Registry& registry = GetRegistry();
+    bool recorded;
+    {
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      recorded = !registry.thread_counts.empty();
+    }
+    if (recorded) WriteInstrumentationReport(std::cerr);
+  };
+} report_at_exit;
+}
+#endif
+}
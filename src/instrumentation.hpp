@@ -0,0 +1,95 @@
+#ifndef LINEARHAM_INSTRUMENTATION_
+#define LINEARHAM_INSTRUMENTATION_
+
+#include <chrono>
+#include <ostream>
+
+/// @file instrumentation.hpp
+/// @brief Headers for counters and timers on the hot paths.
+///
+/// The hot paths record what they do with the LINEARHAM_COUNT and
+/// LINEARHAM_TIME macros, which do nothing unless LINEARHAM_INSTRUMENT is
+/// defined (see SConstruct). With it defined, each thread keeps its own
+/// counts, which are added up into a report written to standard error at
+/// exit.
+
+namespace linearham {
+
+
+/// @brief Things that get counted.
+enum class Counter {
+  kReadsAnnotated,
+  kGermlinesLoaded,
+  kSmooshFlops,
+  kScaleIterations,
+  kCount
+};
+
+
+/// @brief Stages that get timed. Timers nest, so the time of a stage includes
+/// that of any stage it calls (a Smoosh includes its max-product, say).
+///
+/// kMaxProduct covers every Viterbi max-product kernel: BinaryMax,
+/// SmallBinaryMax (the fixed-size smooshes) and MaxPlusProduct (kLog).
+/// kBatchSmoosh is a whole SmooshableBatch smoosh, whose max-product is fused
+/// with its marginal product.
+enum class Stage {
+  kGermlineLoading,
+  kMatchMatrix,
+  kSmoosh,
+  kBatchSmoosh,
+  kMaxProduct,
+  kViterbiUnwinding,
+  kCount
+};
+
+
+void AddToCounter(Counter counter, long n);
+void AddToStage(Stage stage, long nanoseconds);
+long CounterTotal(Counter counter);
+long StageCalls(Stage stage);
+long StageNanoseconds(Stage stage);
+void WriteInstrumentationReport(std::ostream& out);
+void ResetInstrumentation();
+
+
+/// @brief Adds the time from its construction to its destruction to a stage.
+class ScopedTimer {
+ protected:
+  Stage stage_;
+  std::chrono::steady_clock::time_point start_;
+
+ public:
+  explicit ScopedTimer(Stage stage)
+      : stage_(stage), start_(std::chrono::steady_clock::now()){};
+  ~ScopedTimer() {
+    AddToStage(stage_, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start_)
+                           .count());
+  };
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+}
+
+
+#define LINEARHAM_CONCAT_INNER_(a, b) a##b
+#define LINEARHAM_CONCAT_(a, b) LINEARHAM_CONCAT_INNER_(a, b)
+
+#ifdef LINEARHAM_INSTRUMENT
+#define LINEARHAM_COUNT(counter, n) \
+  ::linearham::AddToCounter(::linearham::Counter::counter, (n))
+#define LINEARHAM_TIME(stage)                                    \
+  ::linearham::ScopedTimer LINEARHAM_CONCAT_(linearham_timer_, \
+                                             __LINE__)(          \
+      ::linearham::Stage::stage)
+#else
+#define LINEARHAM_COUNT(counter, n) \
+  do {                              \
+  } while (0)
+#define LINEARHAM_TIME(stage) \
+  do {                        \
+  } while (0)
+#endif
+
+#endif  // LINEARHAM_INSTRUMENTATION_
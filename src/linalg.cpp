@@ -1,4 +1,13 @@
 #include "linalg.hpp"
+#include "instrumentation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
 
 /// @file linalg.cpp
 /// @brief Some simple linear algebra routines.
@@ -13,6 +22,188 @@
 namespace linearham {
 
 
+// Max-product kernel helpers.
+//
+// Each "pack" wraps a SIMD register of doubles (or a single double for the
+// scalar fallback) with the handful of operations needed by the max-product
+// kernel below. Argmax indices are carried in double registers so that they can
+// be selected with the same mask as the maxima, and are converted to int when
+// they are stored.
+namespace {
+
+#if defined(__AVX__)
+struct AvxPack {
+  typedef __m256d V;
+  static const int kLanes = 4;
+  static V Load(const double* p) { return _mm256_loadu_pd(p); };
+  static V Set1(double x) { return _mm256_set1_pd(x); };
+  static V Mul(V a, V b) { return _mm256_mul_pd(a, b); };
+  static V Add(V a, V b) { return _mm256_add_pd(a, b); };
+  // Strict comparison, so earlier indices win ties.
+  static void Update(V prod, V j, V& best, V& idx) {
+    V mask = _mm256_cmp_pd(prod, best, _CMP_GT_OQ);
+    best = _mm256_blendv_pd(best, prod, mask);
+    idx = _mm256_blendv_pd(idx, j, mask);
+  };
+  static void Store(V best, V idx, double* c, int* c_idx) {
+    _mm256_storeu_pd(c, best);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(c_idx),
+                     _mm256_cvtpd_epi32(idx));
+  };
+};
+#endif
+
+#if defined(__SSE2__)
+struct Sse2Pack {
+  typedef __m128d V;
+  static const int kLanes = 2;
+  static V Load(const double* p) { return _mm_loadu_pd(p); };
+  static V Set1(double x) { return _mm_set1_pd(x); };
+  static V Mul(V a, V b) { return _mm_mul_pd(a, b); };
+  static V Add(V a, V b) { return _mm_add_pd(a, b); };
+  static void Update(V prod, V j, V& best, V& idx) {
+    V mask = _mm_cmpgt_pd(prod, best);
+    best = _mm_or_pd(_mm_and_pd(mask, prod), _mm_andnot_pd(mask, best));
+    idx = _mm_or_pd(_mm_and_pd(mask, j), _mm_andnot_pd(mask, idx));
+  };
+  static void Store(V best, V idx, double* c, int* c_idx) {
+    _mm_storeu_pd(c, best);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(c_idx), _mm_cvtpd_epi32(idx));
+  };
+};
+#endif
+
+struct ScalarPack {
+  typedef double V;
+  static const int kLanes = 1;
+  static V Load(const double* p) { return *p; };
+  static V Set1(double x) { return x; };
+  static V Mul(V a, V b) { return a * b; };
+  static V Add(V a, V b) { return a + b; };
+  static void Update(V prod, V j, V& best, V& idx) {
+    if (prod > best) {
+      best = prod;
+      idx = j;
+    }
+  };
+  static void Store(V best, V idx, double* c, int* c_idx) {
+    *c = best;
+    *c_idx = int(idx);
+  };
+};
+
+#if defined(__AVX__)
+typedef AvxPack WidePack;
+#elif defined(__SSE2__)
+typedef Sse2Pack WidePack;
+#else
+typedef ScalarPack WidePack;
+#endif
+
+// The "product" that is maximized over: Times for probabilities, Plus for
+// log-probabilities.
+struct Times {
+  template <class Pack>
+  static typename Pack::V Apply(typename Pack::V a, typename Pack::V b) {
+    return Pack::Mul(a, b);
+  };
+};
+
+struct Plus {
+  template <class Pack>
+  static typename Pack::V Apply(typename Pack::V a, typename Pack::V b) {
+    return Pack::Add(a, b);
+  };
+};
+
+// Rows of C handled per cache block, and columns per register block.
+const int kMaxProductBlockRows = 64;
+const int kMaxProductBlockCols = 4;
+
+
+// Computes the max-product for `Pack::kLanes` rows of C starting at row i and
+// `Cols` columns starting at column k. The running maxima for the whole
+// register block stay in registers while we sweep over the columns of A.
+template <class Pack, class Op, int Cols>
+inline void MaxProductTile(const Eigen::Ref<const Eigen::MatrixXd>& A,
+                           const Eigen::Ref<const Eigen::MatrixXd>& B, int i,
+                           int k, Eigen::Ref<Eigen::MatrixXd>& C,
+                           Eigen::Ref<Eigen::MatrixXi>& C_idx) {
+  typename Pack::V best[Cols], idx[Cols];
+  typename Pack::V a = Pack::Load(A.data() + i);
+  for (int c = 0; c < Cols; c++) {
+    best[c] = Op::template Apply<Pack>(a, Pack::Set1(B(0, k + c)));
+    idx[c] = Pack::Set1(0.);
+  }
+  for (int j = 1; j < A.cols(); j++) {
+    a = Pack::Load(A.data() + j * A.outerStride() + i);
+    typename Pack::V j_pack = Pack::Set1(double(j));
+    for (int c = 0; c < Cols; c++) {
+      Pack::Update(Op::template Apply<Pack>(a, Pack::Set1(B(j, k + c))),
+                   j_pack, best[c], idx[c]);
+    }
+  }
+  for (int c = 0; c < Cols; c++) {
+    Pack::Store(best[c], idx[c], &C(i, k + c), &C_idx(i, k + c));
+  }
+}
+
+
+// Computes the max-product for the `height` rows of C starting at row i and
+// `Cols` columns starting at column k.
+template <class Op, int Cols>
+inline void MaxProductBlock(const Eigen::Ref<const Eigen::MatrixXd>& A,
+                            const Eigen::Ref<const Eigen::MatrixXd>& B, int i,
+                            int height, int k, Eigen::Ref<Eigen::MatrixXd>& C,
+                            Eigen::Ref<Eigen::MatrixXi>& C_idx) {
+  int r = i;
+  for (; r + WidePack::kLanes <= i + height; r += WidePack::kLanes) {
+    MaxProductTile<WidePack, Op, Cols>(A, B, r, k, C, C_idx);
+  }
+  for (; r < i + height; r++) {
+    MaxProductTile<ScalarPack, Op, Cols>(A, B, r, k, C, C_idx);
+  }
+}
+
+
+// Computes C_{i,k} := max_j Op(A_{i,j}, B_{j,k}) and the corresponding argmax.
+template <class Op>
+void MaxProduct(const Eigen::Ref<const Eigen::MatrixXd>& A,
+                const Eigen::Ref<const Eigen::MatrixXd>& B,
+                Eigen::Ref<Eigen::MatrixXd>& C,
+                Eigen::Ref<Eigen::MatrixXi>& C_idx) {
+  for (int i = 0; i < C.rows(); i += kMaxProductBlockRows) {
+    int height = std::min(kMaxProductBlockRows, int(C.rows()) - i);
+    int k = 0;
+    for (; k + kMaxProductBlockCols <= C.cols(); k += kMaxProductBlockCols) {
+      MaxProductBlock<Op, kMaxProductBlockCols>(A, B, i, height, k, C, C_idx);
+    }
+    for (; k < C.cols(); k++) {
+      MaxProductBlock<Op, 1>(A, B, i, height, k, C, C_idx);
+    }
+  }
+}
+
+
+// Below this, a sum of shifted exponentials may have lost precision to
+// denormals, so LogSumExpProduct recomputes the entry directly.
+const double kLogSumExpFloor =
+    std::ldexp(std::numeric_limits<double>::min(), 53);
+
+
+// Computes log sum_j exp(A_{i,j} + B_{j,k}) for a single entry, shifting by
+// the largest term.
+double LogSumExpEntry(const Eigen::Ref<const Eigen::MatrixXd>& A,
+                      const Eigen::Ref<const Eigen::MatrixXd>& B, int i,
+                      int k) {
+  Eigen::ArrayXd terms = A.row(i).transpose() + B.col(k);
+  double shift = terms.maxCoeff();
+  if (!std::isfinite(shift)) return shift;
+  return shift + std::log((terms - shift).exp().sum());
+}
+}
+
+
 /// @brief This function takes the coefficient-wise product of b and every
 /// column of A.
 /// @param[in] b Input vector.
@@ -76,6 +267,53 @@ void SubProductMatrix(const Eigen::Ref<const Eigen::VectorXd>& e,
 }
 
 
+/// @brief This function builds a block of the matrix of sub-products.
+/// @param[in] e Input vector.
+/// @param[in] row Index of the first row of the block.
+/// @param[in] col Index of the first column of the block.
+/// @param[out] A Output matrix.
+///
+/// Fills A with the block of the SubProductMatrix of e whose upper left corner
+/// is at (row, col), without building the rest of it:
+///  \f[
+///  A_{i,j} := \prod_{k=\mathrm{row}+i}^{\mathrm{col}+j} e_k.
+///  \f]
+/// Empty products are taken to be one.
+/// The products over the stretch of e shared by all the entries are computed
+/// once, so the cost is linear in `col - row` plus the size of the block.
+/// Nothing is allocated: the column products are kept in a row of A.
+void SubProductBlock(const Eigen::Ref<const Eigen::VectorXd>& e, int row,
+                     int col, Eigen::Ref<Eigen::MatrixXd> A) {
+  assert(0 <= row && row + A.rows() <= e.size());
+  assert(0 <= col && col + A.cols() <= e.size());
+  // Rows that start at or before the first column are a product over the
+  // shared stretch row+i to col, times the column products
+  // r_j := prod_{k=col+1}^{col+j} e_k, which we put in the last such row.
+  int last = std::min(int(A.rows()) - 1, col - row);
+  if (last >= 0) {
+    A(last, 0) = 1.;
+    for (int j = 1; j < A.cols(); j++) {
+      A(last, j) = A(last, j - 1) * e(col + j);
+    }
+    double last_product = e.segment(row + last, col - row - last + 1).prod();
+    double row_product = last_product;
+    for (int i = last - 1; i >= 0; i--) {
+      row_product *= e(row + i);
+      A.row(i) = row_product * A.row(last);
+    }
+    A.row(last) *= last_product;
+  }
+  // Any remaining rows start inside the block, so we fill them directly.
+  for (int i = std::max(0, col - row + 1); i < A.rows(); i++) {
+    double running = 1.;
+    for (int j = 0; j < A.cols(); j++) {
+      if (col + j >= row + i) running *= e(col + j);
+      A(i, j) = running;
+    }
+  }
+}
+
+
 /// @brief This function extracts a vector of entries of a matrix by row index.
 /// @param[in] A Input matrix.
 /// @param[in] a Input vector of indices.
@@ -98,7 +336,7 @@ void VectorByIndices(const Eigen::Ref<const Eigen::MatrixXd>& A,
 }
 
 
-/// @brief This function extracts a vector of entries of a matrix by row index.
+/// @brief This function computes the max-product of two matrices.
 /// @param[in] A Input matrix.
 /// @param[in] B Input matrix.
 /// @param[out] C Output matrix containing the matrix product maximum.
@@ -111,6 +349,13 @@ void VectorByIndices(const Eigen::Ref<const Eigen::MatrixXd>& A,
 /// C_{i,k} := \max_j A_{i,j} B_{j,k}
 /// \f]
 /// and `C_idx` is the corresponding argmax.
+/// Ties go to the smallest j, as with Eigen's `maxCoeff`.
+///
+/// This is a "tropical" matrix product, so we compute it the way one would a
+/// GEMM: blocks of rows of A are kept hot in cache while we sweep over the
+/// columns of B, and each block is processed with SIMD registers holding
+/// several rows times several columns of C at once.
+/// No temporaries are allocated.
 void BinaryMax(const Eigen::Ref<const Eigen::MatrixXd>& A,
                const Eigen::Ref<const Eigen::MatrixXd>& B,
                Eigen::Ref<Eigen::MatrixXd> C,
@@ -120,15 +365,75 @@ void BinaryMax(const Eigen::Ref<const Eigen::MatrixXd>& A,
   assert(C.cols() == B.cols());
   assert(C.rows() == C_idx.rows());
   assert(C.cols() == C_idx.cols());
-  int idx;
-  Eigen::VectorXd util(A.cols());
-  /// @todo Make faster by doing matrix-wise rather than vector-wise product.
-  for (int i = 0; i < C.rows(); i++) {
-    for (int k = 0; k < C.cols(); k++) {
-      util = A.row(i).transpose().array().cwiseProduct(B.col(k).array());
-      util.maxCoeff(&idx);
-      C_idx(i, k) = idx;
-      C(i, k) = util(idx);
+  LINEARHAM_TIME(kMaxProduct);
+  MaxProduct<Times>(A, B, C, C_idx);
+}
+
+
+/// @brief This function computes the max-plus product of two matrices.
+/// @param[in] A Input matrix.
+/// @param[in] B Input matrix.
+/// @param[out] C Output matrix containing the max-plus product.
+/// @param[out] C_idx Output matrix containing the corresponding argmax.
+///
+/// This is BinaryMax for log-probabilities:
+/// \f[
+/// C_{i,k} := \max_j A_{i,j} + B_{j,k}
+/// \f]
+/// with the same tie-breaking.
+void MaxPlusProduct(const Eigen::Ref<const Eigen::MatrixXd>& A,
+                    const Eigen::Ref<const Eigen::MatrixXd>& B,
+                    Eigen::Ref<Eigen::MatrixXd> C,
+                    Eigen::Ref<Eigen::MatrixXi> C_idx) {
+  assert(A.cols() == B.rows());
+  assert(C.rows() == A.rows());
+  assert(C.cols() == B.cols());
+  assert(C.rows() == C_idx.rows());
+  assert(C.cols() == C_idx.cols());
+  assert(A.cols() > 0);
+  LINEARHAM_TIME(kMaxProduct);
+  MaxProduct<Plus>(A, B, C, C_idx);
+}
+
+
+/// @brief This function computes the log-sum-exp product of two matrices.
+/// @param[in] A Input matrix.
+/// @param[in] B Input matrix.
+/// @param[out] C Output matrix.
+///
+/// This is the matrix product for log-probabilities:
+/// \f[
+/// C_{i,k} := \log \sum_j \exp(A_{i,j} + B_{j,k}).
+/// \f]
+/// We shift each row of A and each column of B by its maximum, exponentiate,
+/// and hand the result to Eigen's (vectorized) matrix product, so
+/// \f[
+/// C_{i,k} = a_i + b_k + \log \sum_j e^{A_{i,j} - a_i} e^{B_{j,k} - b_k}.
+/// \f]
+/// The rare entries whose shifted sum is too small to be represented to full
+/// precision are recomputed directly with the per-entry maximum as the shift.
+void LogSumExpProduct(const Eigen::Ref<const Eigen::MatrixXd>& A,
+                      const Eigen::Ref<const Eigen::MatrixXd>& B,
+                      Eigen::Ref<Eigen::MatrixXd> C) {
+  assert(A.cols() == B.rows());
+  assert(C.rows() == A.rows());
+  assert(C.cols() == B.cols());
+  // Rows (columns) that are entirely -inf have probability zero; shifting them
+  // by zero rather than -inf keeps NaNs out of the exponentials.
+  auto FiniteOrZero = [](double x) { return std::isfinite(x) ? x : 0.; };
+  Eigen::VectorXd a_max = A.rowwise().maxCoeff().unaryExpr(FiniteOrZero);
+  Eigen::RowVectorXd b_max = B.colwise().maxCoeff().unaryExpr(FiniteOrZero);
+  Eigen::MatrixXd A_exp = (A.colwise() - a_max).array().exp();
+  Eigen::MatrixXd B_exp = (B.rowwise() - b_max).array().exp();
+  C.noalias() = A_exp * B_exp;
+
+  for (int k = 0; k < C.cols(); k++) {
+    for (int i = 0; i < C.rows(); i++) {
+      if (C(i, k) >= kLogSumExpFloor) {
+        C(i, k) = std::log(C(i, k)) + a_max(i) + b_max(k);
+      } else {
+        C(i, k) = LogSumExpEntry(A, B, i, k);
+      }
     }
   }
 }
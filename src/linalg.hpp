@@ -3,6 +3,7 @@
 
 #include <Eigen/Dense>
 #include <iostream>
+#include "instrumentation.hpp"
 
 /// @file linalg.hpp
 /// @brief Linear algebra routines.
@@ -21,6 +22,9 @@ void RowVecMatCwise(const Eigen::Ref<const Eigen::RowVectorXd>& b,
 void SubProductMatrix(const Eigen::Ref<const Eigen::VectorXd>& e,
                       Eigen::Ref<Eigen::MatrixXd> A);
 
+void SubProductBlock(const Eigen::Ref<const Eigen::VectorXd>& e, int row,
+                     int col, Eigen::Ref<Eigen::MatrixXd> A);
+
 void VectorByIndices(const Eigen::Ref<const Eigen::MatrixXd>& A,
                      const Eigen::Ref<const Eigen::VectorXi>& a,
                      Eigen::Ref<Eigen::VectorXd> b);
@@ -29,6 +33,54 @@ void BinaryMax(const Eigen::Ref<const Eigen::MatrixXd>& A,
                const Eigen::Ref<const Eigen::MatrixXd>& B,
                Eigen::Ref<Eigen::MatrixXd> C,
                Eigen::Ref<Eigen::MatrixXi> C_idx);
+
+void MaxPlusProduct(const Eigen::Ref<const Eigen::MatrixXd>& A,
+                    const Eigen::Ref<const Eigen::MatrixXd>& B,
+                    Eigen::Ref<Eigen::MatrixXd> C,
+                    Eigen::Ref<Eigen::MatrixXi> C_idx);
+
+void LogSumExpProduct(const Eigen::Ref<const Eigen::MatrixXd>& A,
+                      const Eigen::Ref<const Eigen::MatrixXd>& B,
+                      Eigen::Ref<Eigen::MatrixXd> C);
+
+
+/// @brief BinaryMax for small matrices of any Eigen type.
+/// @param[in] A
+/// Left matrix.
+/// @param[in] B
+/// Right matrix.
+/// @param[out] C
+/// Storage for the max-product.
+/// @param[out] C_idx
+/// Storage for the argmax indices.
+///
+/// This is a plain triple loop with the same tie-breaking as BinaryMax. For
+/// fixed-size matrices the trip counts are compile-time constants, so the
+/// loops unroll and everything stays in registers; for anything but small
+/// matrices, use BinaryMax.
+template <class MatrixA, class MatrixB, class MatrixC, class MatrixIdx>
+void SmallBinaryMax(const MatrixA& A, const MatrixB& B, MatrixC&& C,
+                    MatrixIdx&& C_idx) {
+  assert(A.cols() == B.rows());
+  assert(C.rows() == A.rows() && C.cols() == B.cols());
+  assert(C_idx.rows() == C.rows() && C_idx.cols() == C.cols());
+  LINEARHAM_TIME(kMaxProduct);
+  for (int k = 0; k < B.cols(); k++) {
+    for (int i = 0; i < A.rows(); i++) {
+      double best = A(i, 0) * B(0, k);
+      int best_j = 0;
+      for (int j = 1; j < A.cols(); j++) {
+        double prod = A(i, j) * B(j, k);
+        if (prod > best) {
+          best = prod;
+          best_j = j;
+        }
+      }
+      C(i, k) = best;
+      C_idx(i, k) = best_j;
+    }
+  }
+};
 }
 
 #endif  // LINEARHAM_LINALG_
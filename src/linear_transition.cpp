@@ -0,0 +1,112 @@
+#include "linear_transition.hpp"
+
+/// @file linear_transition.cpp
+/// @brief Implementation of the LinearTransition class.
+
+namespace linearham {
+
+
+/// @brief Constructor for LinearTransition.
+/// @param[in] landing
+/// Vector of probabilities of landing somewhere to begin the match.
+/// @param[in] next_transition
+/// Vector of probabilities of transitioning to the next match state.
+///
+/// The arguments are the same as for BuildTransition.
+LinearTransition::LinearTransition(
+    const Eigen::Ref<const Eigen::VectorXd>& landing,
+    const Eigen::Ref<const Eigen::VectorXd>& next_transition)
+    : landing_(Eigen::VectorXd(landing)) {
+  int ell = next_transition.size() + 1;
+  assert(landing.size() == ell);
+  Eigen::VectorXd fall_off(ell);
+  fall_off.head(ell - 1).array() = 1. - next_transition.array();
+  fall_off(ell - 1) = 1.;
+
+  Eigen::VectorXd log_prefix(ell);
+  Eigen::VectorXi zero_prefix(ell);
+  log_prefix(0) = 0.;
+  zero_prefix(0) = 0;
+  for (int k = 0; k < ell - 1; k++) {
+    bool is_zero = (next_transition(k) == 0.);
+    log_prefix(k + 1) =
+        log_prefix(k) + (is_zero ? 0. : std::log(next_transition(k)));
+    zero_prefix(k + 1) = zero_prefix(k) + is_zero;
+  }
+  fall_off_ = std::move(fall_off);
+  log_prefix_ = std::move(log_prefix);
+  zero_prefix_ = std::move(zero_prefix);
+};
+
+
+/// @brief Constructor from the compact representation itself, e.g. as
+/// mapped from a file.
+LinearTransition::LinearTransition(SharedMatrix<Eigen::VectorXd> landing,
+                                   SharedMatrix<Eigen::VectorXd> fall_off,
+                                   SharedMatrix<Eigen::VectorXd> log_prefix,
+                                   SharedMatrix<Eigen::VectorXi> zero_prefix)
+    : landing_(std::move(landing)),
+      fall_off_(std::move(fall_off)),
+      log_prefix_(std::move(log_prefix)),
+      zero_prefix_(std::move(zero_prefix)) {
+  assert(fall_off_.size() == length());
+  assert(log_prefix_.size() == length());
+  assert(zero_prefix_.size() == length());
+};
+
+
+/// @brief The probability of a match starting at i and ending at j.
+double LinearTransition::operator()(int i, int j) const {
+  assert(0 <= i && i < length());
+  assert(0 <= j && j < length());
+  if (i > j || zero_prefix_(j) != zero_prefix_(i)) return 0.;
+  return landing_(i) * fall_off_(j) * std::exp(log_prefix_(j) - log_prefix_(i));
+};
+
+
+/// @brief Fill a block of the transition matrix.
+/// @param[in] row
+/// The start point of the first row of the block.
+/// @param[in] col
+/// The end point of the first column of the block.
+/// @param[out] block
+/// Storage for the block, which has entries
+/// \f[
+/// \mathrm{block}_{i,j} = M_{\mathrm{row}+i, \mathrm{col}+j}.
+/// \f]
+/// @param[in] include_landing
+/// If false, leave out the landing factor \f$b_i\f$, for when something else
+/// (such as an NTInsertion) accounts for how we arrive at the start point.
+void LinearTransition::Block(int row, int col,
+                             Eigen::Ref<Eigen::MatrixXd> block,
+                             bool include_landing) const {
+  assert(0 <= row && row + block.rows() <= length());
+  assert(0 <= col && col + block.cols() <= length());
+  int height = block.rows();
+  for (int j = 0; j < block.cols(); j++) {
+    block.col(j) =
+        (log_prefix_(col + j) - log_prefix_.segment(row, height).array())
+            .exp() *
+        fall_off_(col + j);
+    if (include_landing) {
+      block.col(j).array() *= landing_.segment(row, height).array();
+    }
+    // Zero out matches that would end before they start or that pass through
+    // a zero transition.
+    for (int i = 0; i < height; i++) {
+      if (row + i > col + j ||
+          zero_prefix_(col + j) != zero_prefix_(row + i)) {
+        block(i, j) = 0.;
+      }
+    }
+  }
+};
+
+
+/// @brief The full transition matrix, as BuildTransition would make it.
+Eigen::MatrixXd LinearTransition::Dense() const {
+  Eigen::MatrixXd dense(length(), length());
+  Block(0, 0, dense);
+  return dense;
+};
+}
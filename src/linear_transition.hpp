@@ -0,0 +1,66 @@
+#ifndef LINEARHAM_LINEAR_TRANSITION_
+#define LINEARHAM_LINEAR_TRANSITION_
+
+#include "core.hpp"
+#include "shared_matrix.hpp"
+
+/// @file linear_transition.hpp
+/// @brief Headers for the LinearTransition class.
+
+namespace linearham {
+
+
+/// @brief The transition probabilities of a linear germline HMM, stored
+/// compactly.
+///
+/// BuildTransition materializes the \f$\ell \times \ell\f$ matrix
+/// \f[
+/// M_{i,j} := b_i (1-a_j) \prod_{k=i}^{j-1} a_k,
+/// \f]
+/// where \f$b\f$ is the landing vector and \f$a\f$ is next_transition.
+/// Here we only keep \f$b\f$, the fall-off probabilities \f$1-a_j\f$ and
+/// cumulative sums of \f$\log a_k\f$, which is enough to evaluate any entry in
+/// constant time and any block in time proportional to its size.
+///
+/// The vectors are SharedMatrix objects, so that they can live in a mapped
+/// GermlineFile, and copies of a LinearTransition share them.
+class LinearTransition {
+ protected:
+  SharedMatrix<Eigen::VectorXd> landing_;
+  SharedMatrix<Eigen::VectorXd> fall_off_;
+  // log_prefix_(j) is the sum of log(a_k) over the nonzero a_k with k < j,
+  // and zero_prefix_(j) counts the a_k with k < j that are zero.
+  SharedMatrix<Eigen::VectorXd> log_prefix_;
+  SharedMatrix<Eigen::VectorXi> zero_prefix_;
+
+ public:
+  LinearTransition(){};
+  LinearTransition(const Eigen::Ref<const Eigen::VectorXd>& landing,
+                   const Eigen::Ref<const Eigen::VectorXd>& next_transition);
+  LinearTransition(SharedMatrix<Eigen::VectorXd> landing,
+                   SharedMatrix<Eigen::VectorXd> fall_off,
+                   SharedMatrix<Eigen::VectorXd> log_prefix,
+                   SharedMatrix<Eigen::VectorXi> zero_prefix);
+
+  int length() const { return landing_.size(); };
+  const Eigen::Map<const Eigen::VectorXd>& landing() const {
+    return landing_;
+  };
+  const Eigen::Map<const Eigen::VectorXd>& fall_off() const {
+    return fall_off_;
+  };
+  const Eigen::Map<const Eigen::VectorXd>& log_prefix() const {
+    return log_prefix_;
+  };
+  const Eigen::Map<const Eigen::VectorXi>& zero_prefix() const {
+    return zero_prefix_;
+  };
+
+  double operator()(int i, int j) const;
+  void Block(int row, int col, Eigen::Ref<Eigen::MatrixXd> block,
+             bool include_landing = true) const;
+  Eigen::MatrixXd Dense() const;
+};
+}
+
+#endif  // LINEARHAM_LINEAR_TRANSITION_
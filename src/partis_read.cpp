@@ -0,0 +1,83 @@
+#include "partis_read.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+/// @file partis_read.cpp
+/// @brief Implementation of the PartisRead class.
+
+namespace linearham {
+
+
+/// @brief Constructor from the columns of a partis `hmm_input` CSV row.
+/// @param[in] name
+/// The `names` column.
+/// @param[in] seq
+/// The `seqs` column.
+/// @param[in] boundsbounds
+/// The `boundsbounds` column, a JSON map from window key to a pair of ints.
+/// @param[in] relpos
+/// The `relpos` column, a JSON map from gene name to int.
+/// @param[in] only_genes
+/// The `only_genes` column, a colon-separated list of gene names.
+PartisRead::PartisRead(std::string name, std::string seq,
+                       const std::string& boundsbounds,
+                       const std::string& relpos,
+                       const std::string& only_genes)
+    : name_(std::move(name)), seq_(std::move(seq)) {
+  emission_indices_ = SequenceToIndices(seq_);
+
+  // JSON is YAML, so we can use the YAML parser.
+  std::map<std::string, std::pair<int, int>> bb_map =
+      YAML::Load(boundsbounds)
+          .as<std::map<std::string, std::pair<int, int>>>();
+  for (const auto& entry : bb_map) {
+    if (entry.second.first > entry.second.second) {
+      throw std::runtime_error("Bad boundsbounds window " + entry.first +
+                               " for read " + name_);
+    }
+    windows_[entry.first] = {entry.second.first, entry.second.second};
+  }
+  relpos_ = YAML::Load(relpos).as<std::map<std::string, int>>();
+
+  std::istringstream genes(only_genes);
+  std::string gene;
+  while (std::getline(genes, gene, ':')) {
+    if (!gene.empty()) only_genes_.push_back(gene);
+  }
+};
+
+
+/// @brief Look up a boundsbounds window.
+/// @param[in] key
+/// One of `v_l`, `v_r`, `d_l`, `d_r`, `j_l` and `j_r`.
+FlexWindow PartisRead::window(const std::string& key) const {
+  auto it = windows_.find(key);
+  if (it == windows_.end()) {
+    throw std::runtime_error("Read " + name_ + " has no " + key + " window");
+  }
+  return it->second;
+};
+
+
+// Functions
+
+/// @brief Convert a nucleotide sequence to indices into NUKE_ALPHABET.
+/// @param[in] seq
+/// The sequence.
+/// @return The indices, which can be used as `emission_indices`.
+///
+/// @todo Ambiguous bases (N) would need their own emission probabilities.
+Eigen::VectorXi SequenceToIndices(const std::string& seq) {
+  Eigen::VectorXi indices(seq.size());
+  for (unsigned int i = 0; i < seq.size(); i++) {
+    size_t index = NUKE_ALPHABET.find(seq[i]);
+    if (index == std::string::npos) {
+      throw std::runtime_error(std::string("Unexpected base '") + seq[i] +
+                               "' in sequence");
+    }
+    indices(i) = index;
+  }
+  return indices;
+};
+}
@@ -0,0 +1,66 @@
+#ifndef LINEARHAM_PARTIS_READ_
+#define LINEARHAM_PARTIS_READ_
+
+#include <map>
+#include "yaml_utils.hpp"
+
+/// @file partis_read.hpp
+/// @brief Headers for the PartisRead class.
+
+namespace linearham {
+
+
+/// @brief The nucleotides, in the (sorted) order of the rows of germline
+/// emission matrices.
+const std::string NUKE_ALPHABET = "ACGT";
+
+
+/// @brief A half-open range `[start, end)` of read positions.
+struct FlexWindow {
+  int start;
+  int end;
+
+  int size() const { return end - start; };
+};
+
+
+/// @brief One row of a partis `hmm_input` CSV file: a read along with the
+/// candidate genes and alignment windows from partis' Smith-Waterman step.
+///
+/// The boundsbounds windows are keyed `v_l`, `v_r`, `d_l`, `d_r`, `j_l` and
+/// `j_r`. A `_l` window holds the possible first read positions of a gene's
+/// match and an `_r` window the possible ends, one past its last position.
+/// The relpos of a gene is the read position of the gene's first base.
+class PartisRead {
+ protected:
+  std::string name_;
+  std::string seq_;
+  Eigen::VectorXi emission_indices_;
+  std::map<std::string, FlexWindow> windows_;
+  std::map<std::string, int> relpos_;
+  std::vector<std::string> only_genes_;
+
+ public:
+  PartisRead(){};
+  PartisRead(std::string name, std::string seq,
+             const std::string& boundsbounds, const std::string& relpos,
+             const std::string& only_genes);
+
+  const std::string& name() const { return name_; };
+  const std::string& seq() const { return seq_; };
+  int length() const { return seq_.size(); };
+  const Eigen::VectorXi& emission_indices() const { return emission_indices_; };
+  const std::vector<std::string>& only_genes() const { return only_genes_; };
+
+  FlexWindow window(const std::string& key) const;
+  bool has_relpos(const std::string& gene) const {
+    return relpos_.count(gene) > 0;
+  };
+  int relpos(const std::string& gene) const { return relpos_.at(gene); };
+};
+
+
+Eigen::VectorXi SequenceToIndices(const std::string& seq);
+}
+
+#endif  // LINEARHAM_PARTIS_READ_
@@ -0,0 +1,70 @@
+#ifndef LINEARHAM_SHARED_MATRIX_
+#define LINEARHAM_SHARED_MATRIX_
+
+#include <memory>
+#include <new>
+#include <Eigen/Dense>
+
+/// @file shared_matrix.hpp
+/// @brief Headers for the SharedMatrix class template.
+
+namespace linearham {
+
+
+/// @brief A read-only Eigen matrix (or vector) whose storage is shared.
+///
+/// This is an Eigen::Map, so it can be used wherever a matrix can be read,
+/// together with a pointer keeping its storage alive. The storage is either a
+/// matrix handed over on construction, which copies then share, or memory
+/// owned by something else, such as the mapping of a GermlineFile. Either
+/// way, copying a SharedMatrix never copies its entries.
+template <class M>
+class SharedMatrix : public Eigen::Map<const M> {
+ public:
+  typedef Eigen::Map<const M> Map;
+  typedef typename M::Scalar Scalar;
+
+ protected:
+  std::shared_ptr<const void> owner_;
+
+  // Point the map somewhere else, which Eigen only allows by constructing
+  // it again.
+  void Point(const Scalar* data, Eigen::Index rows, Eigen::Index cols) {
+    new (static_cast<Map*>(this)) Map(data, rows, cols);
+  };
+
+ public:
+  SharedMatrix()
+      : Map(nullptr, (M::RowsAtCompileTime == 1) ? 1 : 0,
+            (M::ColsAtCompileTime == 1) ? 1 : 0){};
+
+  /// @brief Constructor taking over a matrix.
+  SharedMatrix(M matrix) : SharedMatrix() {
+    std::shared_ptr<const M> owned =
+        std::make_shared<const M>(std::move(matrix));
+    Point(owned->data(), owned->rows(), owned->cols());
+    owner_ = std::move(owned);
+  };
+
+  /// @brief Constructor for a matrix stored (column-major) in memory that
+  /// `owner` keeps alive.
+  SharedMatrix(const Scalar* data, Eigen::Index rows, Eigen::Index cols,
+               std::shared_ptr<const void> owner)
+      : Map(data, rows, cols), owner_(std::move(owner)){};
+
+  SharedMatrix(const SharedMatrix& other)
+      : Map(other.data(), other.rows(), other.cols()),
+        owner_(other.owner_){};
+
+  SharedMatrix& operator=(const SharedMatrix& other) {
+    owner_ = other.owner_;
+    Point(other.data(), other.rows(), other.cols());
+    return *this;
+  };
+
+  /// @brief What keeps the storage alive.
+  const std::shared_ptr<const void>& owner() const { return owner_; };
+};
+}
+
+#endif  // LINEARHAM_SHARED_MATRIX_
@@ -1,4 +1,6 @@
 #include "smooshable.hpp"
+#include "instrumentation.hpp"
+#include "smooshable_arena.hpp"
 
 /// @file smooshable.cpp
 /// @brief Implementation of Smooshable class and descendants.
@@ -9,17 +11,161 @@ namespace linearham {
 // Smooshable
 
 /// @brief "Boring" constructor, which just sets up memory.
-Smooshable::Smooshable(int left_flex, int right_flex) {
-  marginal_.resize(left_flex + 1, right_flex + 1);
-  viterbi_.resize(left_flex + 1, right_flex + 1);
+Smooshable::Smooshable(int left_flex, int right_flex, Scaling scaling,
+                       SmooshMode mode)
+    : scaler_count_(0), scaling_(scaling), mode_(mode) {
+  if (has_marginal()) marginal_.resize(left_flex + 1, right_flex + 1);
+  if (has_viterbi()) viterbi_.resize(left_flex + 1, right_flex + 1);
+  if (scaling_ == Scaling::kRowCol) {
+    row_scaler_counts_.setZero(left_flex + 1);
+    col_scaler_counts_.setZero(right_flex + 1);
+  }
 };
 
 
 /// @brief Constructor starting from marginal probabilities.
-Smooshable::Smooshable(Eigen::Ref<Eigen::MatrixXd> marginal) {
-  marginal_ = marginal;
-  scaler_count_ = ScaleMatrix(marginal_);
-  viterbi_ = marginal_;
+/// @param[in] marginal
+/// Matrix of (unscaled) probabilities.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+Smooshable::Smooshable(Eigen::Ref<Eigen::MatrixXd> marginal, Scaling scaling,
+                       SmooshMode mode)
+    : scaling_(scaling), mode_(mode) {
+  SetProbabilities(marginal);
+};
+
+
+/// @brief Constructor starting from separate marginal and Viterbi
+/// probabilities.
+/// @param[in] marginal
+/// Matrix of (unscaled) marginal probabilities.
+/// @param[in] viterbi
+/// Matrix of (unscaled) Viterbi probabilities.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+Smooshable::Smooshable(Eigen::Ref<Eigen::MatrixXd> marginal,
+                       Eigen::Ref<Eigen::MatrixXd> viterbi, Scaling scaling,
+                       SmooshMode mode)
+    : scaling_(scaling), mode_(mode) {
+  assert(marginal.rows() == viterbi.rows());
+  assert(marginal.cols() == viterbi.cols());
+  SetProbabilities(has_marginal() ? Eigen::MatrixXd(marginal)
+                                  : Eigen::MatrixXd(),
+                   has_viterbi() ? Eigen::MatrixXd(viterbi)
+                                 : Eigen::MatrixXd());
+};
+
+
+/// @brief Store freshly computed probabilities, which serve as both the
+/// marginal and the Viterbi probabilities of an unsmooshed segment, in the
+/// representation given by `scaling_` and `mode_`.
+void Smooshable::SetProbabilities(Eigen::MatrixXd probs) {
+  if (scaling_ == Scaling::kLog) {
+    probs = probs.array().log();
+    scaler_count_ = 0;
+  } else if (scaling_ == Scaling::kRowCol) {
+    scaler_count_ = 0;
+    row_scaler_counts_.setZero(probs.rows());
+    col_scaler_counts_.setZero(probs.cols());
+    ScaleMatrixRowsCols(probs, row_scaler_counts_, col_scaler_counts_);
+  } else {
+    scaler_count_ = ScaleMatrix(probs);
+  }
+  if (!has_viterbi()) {
+    marginal_ = std::move(probs);
+    return;
+  }
+  // Copying into marginal_ reuses its storage if it's already the right size.
+  if (has_marginal()) marginal_ = probs;
+  viterbi_ = std::move(probs);
+};
+
+
+/// @brief Store freshly computed marginal and Viterbi probabilities in the
+/// representation given by `scaling_` and `mode_`, taking over the storage
+/// of those we keep.
+void Smooshable::SetProbabilities(Eigen::MatrixXd marginal,
+                                  Eigen::MatrixXd viterbi) {
+  scaler_count_ = 0;
+  if (has_marginal()) marginal_ = std::move(marginal);
+  if (has_viterbi()) viterbi_ = std::move(viterbi);
+  if (scaling_ == Scaling::kLog) {
+    if (has_marginal()) marginal_ = marginal_.array().log();
+    if (has_viterbi()) viterbi_ = viterbi_.array().log();
+    return;
+  }
+  if (scaling_ == Scaling::kRowCol) {
+    row_scaler_counts_.setZero(stored().rows());
+    col_scaler_counts_.setZero(stored().cols());
+    if (has_marginal() && has_viterbi()) {
+      ScaleMatrixRowsCols(marginal_, viterbi_, row_scaler_counts_,
+                          col_scaler_counts_);
+    } else {
+      ScaleMatrixRowsCols(has_marginal() ? marginal_ : viterbi_,
+                          row_scaler_counts_, col_scaler_counts_);
+    }
+    return;
+  }
+  // The Viterbi probabilities are scaled along with the marginal ones, as in
+  // Smoosh.
+  if (has_marginal()) {
+    scaler_count_ = ScaleMatrix(marginal_);
+    if (has_viterbi()) {
+      for (int k = 0; k < scaler_count_; k++) viterbi_ *= SCALE_FACTOR;
+    }
+  } else {
+    scaler_count_ = ScaleMatrix(viterbi_);
+  }
+};
+
+
+/// @brief The natural logs of the marginal probabilities, undoing any scaling.
+Eigen::MatrixXd Smooshable::LogMarginal() const {
+  return UnscaledLog(marginal_);
+};
+
+
+/// @brief The natural log of one marginal probability, undoing any scaling.
+/// @param[in] i
+/// Row of the entry.
+/// @param[in] j
+/// Column of the entry.
+///
+/// The same as `LogMarginal()(i, j)`, without building the whole matrix.
+double Smooshable::LogMarginalEntry(int i, int j) const {
+  double m = marginal_(i, j);
+  if (scaling_ == Scaling::kLog) return m;
+  int count = (scaling_ == Scaling::kRowCol)
+                  ? row_scaler_counts_(i) + col_scaler_counts_(j)
+                  : scaler_count_;
+  return std::log(m) - count * std::log(SCALE_FACTOR);
+};
+
+
+/// @brief The natural logs of the Viterbi probabilities, undoing any scaling.
+Eigen::MatrixXd Smooshable::LogViterbi() const {
+  return UnscaledLog(viterbi_);
+};
+
+
+/// @brief Undo the scaling of one of our matrices, working in log space so
+/// that the result can't underflow.
+Eigen::MatrixXd Smooshable::UnscaledLog(
+    const Eigen::Ref<const Eigen::MatrixXd>& m) const {
+  if (scaling_ == Scaling::kLog) return m;
+  if (scaling_ == Scaling::kRowCol) {
+    Eigen::MatrixXd log_m = m.array().log();
+    log_m.colwise() -=
+        row_scaler_counts_.cast<double>() * std::log(SCALE_FACTOR);
+    log_m.rowwise() -=
+        col_scaler_counts_.cast<double>().transpose() * std::log(SCALE_FACTOR);
+    return log_m;
+  }
+  return m.array().log() - scaler_count_ * std::log(SCALE_FACTOR);
 };
 
 
@@ -37,39 +183,421 @@ Smooshable::Smooshable(Eigen::Ref<Eigen::MatrixXd> marginal) {
 /// The number of alternative start points allowed on the 5' (left) side.
 /// @param[in] right_flex
 /// The number of alternative end points allowed on the 3' (right) side.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
 SmooshableGermline::SmooshableGermline(
-    Germline germline, int start,
+    const Germline& germline, int start,
     const Eigen::Ref<const Eigen::VectorXi>& emission_indices, int left_flex,
-    int right_flex)
-    : Smooshable(left_flex, right_flex) {
+    int right_flex, Scaling scaling, SmooshMode mode) {
   assert(left_flex <= emission_indices.size() - 1);
   assert(right_flex <= emission_indices.size() - 1);
-  germline.MatchMatrix(start, emission_indices, left_flex, right_flex,
-                       marginal_);
+  scaling_ = scaling;
+  mode_ = mode;
+  Eigen::MatrixXd match(left_flex + 1, right_flex + 1);
+  germline.MatchMatrix(start, emission_indices, left_flex, right_flex, match);
   // scale match matrices if necessary.
-  scaler_count_ = ScaleMatrix(marginal_);
-  viterbi_ = marginal_;
+  SetProbabilities(std::move(match));
+};
+
+
+/// @brief Constructor for a SmooshableGermline whose matrices come from an
+/// arena.
+///
+/// The parameters are as for the other constructor.
+SmooshableGermline::SmooshableGermline(
+    const Germline& germline, int start,
+    const Eigen::Ref<const Eigen::VectorXi>& emission_indices, int left_flex,
+    int right_flex, SmooshableArena& arena, Scaling scaling,
+    SmooshMode mode) {
+  assert(left_flex <= emission_indices.size() - 1);
+  assert(right_flex <= emission_indices.size() - 1);
+  scaling_ = scaling;
+  mode_ = mode;
+  Eigen::MatrixXd match = arena.TakeMatrix(left_flex + 1, right_flex + 1);
+  Eigen::MatrixXd emission = arena.TakeMatrix(emission_indices.size(), 1);
+  Eigen::MatrixXd transition_block =
+      arena.TakeMatrix(left_flex + 1, right_flex + 1);
+  germline.MatchMatrix(start, emission_indices, left_flex, right_flex, match,
+                       true, emission.col(0), transition_block);
+  arena.Give(std::move(emission));
+  arena.Give(std::move(transition_block));
+  if (has_marginal() && has_viterbi()) {
+    marginal_ = arena.TakeMatrix(left_flex + 1, right_flex + 1);
+  }
+  if (scaling_ == Scaling::kRowCol) {
+    row_scaler_counts_ = arena.TakeScalerCounts(left_flex + 1);
+    col_scaler_counts_ = arena.TakeScalerCounts(right_flex + 1);
+  }
+  SetProbabilities(std::move(match));
 };
 
 
 // Functions
 
+namespace {
+
+// The number of times a probability with log log_prob needs to be multiplied
+// by SCALE_FACTOR to bring it above SCALE_THRESHOLD.
+int LogScaleCount(double log_prob) {
+  if (!std::isfinite(log_prob)) return 0;
+  return std::max(0, static_cast<int>(std::ceil(-log_prob /
+                                                std::log(SCALE_FACTOR))) - 1);
+}
+}
+
+
+/// @brief Build a smooshable whose marginal and Viterbi probabilities are
+/// both given by their logs.
+/// @param[in] logs
+/// Matrix of log probabilities.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+///
+/// Unlike the constructors, this takes probabilities too small to be held in
+/// a double, such as those of long runs of padding: the scaling is worked out
+/// from the logs before exponentiating.
+Smooshable SmooshableFromLogs(const Eigen::Ref<const Eigen::MatrixXd>& logs,
+                              Scaling scaling, SmooshMode mode) {
+  SmooshableArena arena;
+  return SmooshableFromLogs(logs, arena, scaling, mode);
+};
+
+
+/// @brief Build a smooshable from log probabilities with matrices from an
+/// arena.
+///
+/// The other parameters are as for the other SmooshableFromLogs.
+Smooshable SmooshableFromLogs(const Eigen::Ref<const Eigen::MatrixXd>& logs,
+                              SmooshableArena& arena, Scaling scaling,
+                              SmooshMode mode) {
+  Smooshable smooshable =
+      arena.TakeSmooshable(logs.rows() - 1, logs.cols() - 1, scaling, mode);
+  Eigen::MatrixXd probs = arena.TakeMatrix(logs.rows(), logs.cols());
+  if (scaling == Scaling::kLog) {
+    probs = logs;
+  } else if (scaling == Scaling::kGlobal) {
+    int n = (logs.size() == 0) ? 0 : LogScaleCount(logs.maxCoeff());
+    probs = (logs.array() + n * std::log(SCALE_FACTOR)).exp();
+    smooshable.scaler_count() = n;
+  } else {
+    for (int j = 0; j < logs.cols(); j++) {
+      int n = (logs.rows() == 0) ? 0 : LogScaleCount(logs.col(j).maxCoeff());
+      probs.col(j) = (logs.col(j).array() + n * std::log(SCALE_FACTOR)).exp();
+      smooshable.col_scaler_counts()(j) = n;
+    }
+    ScaleMatrixRowsCols(probs, smooshable.row_scaler_counts(),
+                        smooshable.col_scaler_counts());
+  }
+  if (smooshable.has_marginal()) smooshable.marginal() = probs;
+  if (smooshable.has_viterbi()) smooshable.viterbi() = probs;
+  arena.Give(std::move(probs));
+  return smooshable;
+};
+
+
 /// @brief Scales a matrix by SCALE_FACTOR as many times as needed to bring at
 /// least one entry of the matrix above SCALE_THRESHOLD.
 ///
 /// @param[in] m
 /// Matrix.
 /// @return Number of times we multiplied by SCALE_FACTOR.
+///
+/// A matrix of zeros (such as the probabilities of an impossible alignment)
+/// is left alone.
 int ScaleMatrix(Eigen::Ref<Eigen::MatrixXd> m) {
+  if (m.size() == 0) return 0;
+  int n = ScaleCount(m.maxCoeff());
+  // One factor at a time, since SCALE_FACTOR^n overflows for n > 3.
+  for (int k = 0; k < n; k++) m *= SCALE_FACTOR;
+  return n;
+}
+
+
+/// @brief The number of times something whose largest entry is `max` needs
+/// to be multiplied by SCALE_FACTOR to bring that entry above
+/// SCALE_THRESHOLD.
+///
+/// Zero if `max` isn't positive. Every rescaling goes through here, so that
+/// it is counted in one place (see instrumentation.hpp).
+int ScaleCount(double max) {
+  if (max <= 0.) return 0;
   int n = 0;
-  while ((m.array() < SCALE_THRESHOLD).all()) {
-    m *= SCALE_FACTOR;
+  while (max < SCALE_THRESHOLD) {
+    max *= SCALE_FACTOR;
     n++;
   }
+  LINEARHAM_COUNT(kScaleIterations, n);
   return n;
 }
 
 
+/// @brief Scales each row, and then each column, of a matrix by SCALE_FACTOR
+/// as many times as needed to bring at least one of its entries above
+/// SCALE_THRESHOLD.
+///
+/// @param[in,out] m
+/// Matrix.
+/// @param[in,out] row_counts
+/// Number of times each row has been multiplied by SCALE_FACTOR, which we add
+/// to.
+/// @param[in,out] col_counts
+/// Number of times each column has been multiplied by SCALE_FACTOR, which we
+/// add to.
+///
+/// Only rows and columns that need it are touched, so a matrix that is
+/// already in range costs one pass to find the maxima. As with ScaleMatrix,
+/// rows and columns of zeros are left alone.
+void ScaleMatrixRowsCols(Eigen::Ref<Eigen::MatrixXd> m,
+                         Eigen::Ref<Eigen::VectorXi> row_counts,
+                         Eigen::Ref<Eigen::VectorXi> col_counts) {
+  Eigen::MatrixXd no_follower;
+  ScaleMatrixRowsCols(m, no_follower, row_counts, col_counts);
+}
+
+
+/// @brief Scales the rows and columns of a matrix as the other
+/// ScaleMatrixRowsCols does, and scales a second matrix of the same
+/// dimensions (or an empty one) in just the same way.
+///
+/// This keeps Viterbi probabilities on the scale of the marginal ones.
+void ScaleMatrixRowsCols(Eigen::Ref<Eigen::MatrixXd> m,
+                         Eigen::Ref<Eigen::MatrixXd> follower,
+                         Eigen::Ref<Eigen::VectorXi> row_counts,
+                         Eigen::Ref<Eigen::VectorXi> col_counts) {
+  assert(row_counts.size() == m.rows());
+  assert(col_counts.size() == m.cols());
+  assert(follower.size() == 0 ||
+         (follower.rows() == m.rows() && follower.cols() == m.cols()));
+  if (m.size() == 0) return;
+  for (int i = 0; i < m.rows(); i++) {
+    int n = ScaleCount(m.row(i).maxCoeff());
+    row_counts(i) += n;
+    for (; n > 0; n--) {
+      m.row(i) *= SCALE_FACTOR;
+      if (follower.size() > 0) follower.row(i) *= SCALE_FACTOR;
+    }
+  }
+  for (int j = 0; j < m.cols(); j++) {
+    int n = ScaleCount(m.col(j).maxCoeff());
+    col_counts(j) += n;
+    for (; n > 0; n--) {
+      m.col(j) *= SCALE_FACTOR;
+      if (follower.size() > 0) follower.col(j) *= SCALE_FACTOR;
+    }
+  }
+}
+
+
+namespace {
+
+// The largest flex for which square smooshes get fixed-size kernels. Beyond
+// this the unrolled kernels are no faster than BinaryMax and Eigen's GEMM.
+const int kMaxFixedFlex = 7;
+
+// Smoosh (N x N) by (N x N) globally scaled smooshables with fixed-size
+// kernels, which map the smooshables' storage rather than copying it.
+template <int N>
+void FixedSquareSmoosh(const Smooshable& s_a, const Smooshable& s_b,
+                       Smooshable& s_out, Eigen::MatrixXi& viterbi_idx) {
+  typedef Eigen::Matrix<double, N, N> Matrix;
+  typedef Eigen::Map<const Matrix, 0, Eigen::OuterStride<>> ConstMap;
+  typedef Eigen::Map<Matrix, 0, Eigen::OuterStride<>> Map;
+  if (s_out.has_marginal()) {
+    Map(s_out.marginal().data(),
+        Eigen::OuterStride<>(s_out.marginal().outerStride()))
+        .noalias() =
+        ConstMap(s_a.marginal().data(),
+                 Eigen::OuterStride<>(s_a.marginal().outerStride())) *
+        ConstMap(s_b.marginal().data(),
+                 Eigen::OuterStride<>(s_b.marginal().outerStride()));
+  }
+  if (s_out.has_viterbi()) {
+    SmallBinaryMax(
+        ConstMap(s_a.viterbi().data(),
+                 Eigen::OuterStride<>(s_a.viterbi().outerStride())),
+        ConstMap(s_b.viterbi().data(),
+                 Eigen::OuterStride<>(s_b.viterbi().outerStride())),
+        Map(s_out.viterbi().data(),
+            Eigen::OuterStride<>(s_out.viterbi().outerStride())),
+        Eigen::Map<Eigen::Matrix<int, N, N>>(viterbi_idx.data()));
+  }
+}
+
+// x * SCALE_THRESHOLD^n, one factor at a time (or x * SCALE_FACTOR^-n if n
+// is negative), so that SCALE_THRESHOLD^n itself is never formed.
+double Rescaled(double x, int n) {
+  for (; n > 0 && x != 0.; n--) x *= SCALE_THRESHOLD;
+  for (; n < 0; n++) x *= SCALE_FACTOR;
+  return x;
+}
+
+// Whether the term t * SCALE_THRESHOLD^c beats best * SCALE_THRESHOLD^best_c.
+// Ties go to the earlier term, as in BinaryMax.
+bool TermBeats(double t, int c, double best, int best_c) {
+  if (best == 0.) return t > 0.;
+  if (c <= best_c) return t > Rescaled(best, best_c - c);
+  return Rescaled(t, c - best_c) > best;
+}
+
+// The terms of a kRowCol product whose middle indices have unequal scaler
+// counts `c`: the term for j is A(i, j) * B(j, k) * SCALE_THRESHOLD^c(j).
+// Each entry of the product is kept as a value and the scaler count of its
+// leading term, -1 if it has no nonzero terms, so that no term is lost to
+// underflow just because other entries of its row have smaller counts.
+void SumTerms(const Eigen::Ref<const Eigen::MatrixXd>& A,
+              const Eigen::Ref<const Eigen::MatrixXd>& B,
+              const Eigen::Ref<const Eigen::VectorXi>& c,
+              Eigen::Ref<Eigen::MatrixXd> C,
+              Eigen::Ref<Eigen::MatrixXi> C_exp) {
+  for (int i = 0; i < C.rows(); i++) {
+    for (int k = 0; k < C.cols(); k++) {
+      double sum = 0.;
+      int e = -1;
+      for (int j = 0; j < c.size(); j++) {
+        double t = A(i, j) * B(j, k);
+        if (t == 0.) continue;
+        if (e < 0 || c(j) < e) {
+          if (e >= 0) sum = Rescaled(sum, e - c(j));
+          e = c(j);
+        }
+        sum += Rescaled(t, c(j) - e);
+      }
+      C(i, k) = sum;
+      C_exp(i, k) = e;
+    }
+  }
+}
+
+// As SumTerms, for the max of the terms, with its index in C_idx.
+void MaxTerms(const Eigen::Ref<const Eigen::MatrixXd>& A,
+              const Eigen::Ref<const Eigen::MatrixXd>& B,
+              const Eigen::Ref<const Eigen::VectorXi>& c,
+              Eigen::Ref<Eigen::MatrixXd> C, Eigen::Ref<Eigen::MatrixXi> C_exp,
+              Eigen::Ref<Eigen::MatrixXi> C_idx) {
+  LINEARHAM_TIME(kMaxProduct);
+  for (int i = 0; i < C.rows(); i++) {
+    for (int k = 0; k < C.cols(); k++) {
+      double best = A(i, 0) * B(0, k);
+      int best_j = 0;
+      for (int j = 1; j < c.size(); j++) {
+        double t = A(i, j) * B(j, k);
+        if (TermBeats(t, c(j), best, c(best_j))) {
+          best = t;
+          best_j = j;
+        }
+      }
+      C(i, k) = best;
+      C_exp(i, k) = (best > 0.) ? c(best_j) : -1;
+      C_idx(i, k) = best_j;
+    }
+  }
+}
+
+// Bring entries kept with scaler counts `exps` (see SumTerms) to the scale
+// given by the extra row counts `rows` and column counts `cols`.
+void ApplyExponents(Eigen::Ref<Eigen::MatrixXd> m,
+                    const Eigen::Ref<const Eigen::MatrixXi>& exps,
+                    const Eigen::Ref<const Eigen::VectorXi>& rows,
+                    const Eigen::Ref<const Eigen::VectorXi>& cols) {
+  for (int i = 0; i < m.rows(); i++) {
+    for (int k = 0; k < m.cols(); k++) {
+      if (exps(i, k) >= 0) {
+        m(i, k) = Rescaled(m(i, k), exps(i, k) - rows(i) - cols(k));
+      }
+    }
+  }
+}
+
+// Smoosh smooshables with Scaling::kRowCol. The column counts of s_a and the
+// row counts of s_b both scale the shared middle index. If their sums agree,
+// they just go into the row counts of the result. Otherwise each entry of the
+// product is summed relative to the count of its leading term, and those
+// counts are then split into row and column counts of the result. Converting
+// count differences into weights on the terms instead would underflow once
+// they reach 5, dropping rows whose only terms have the larger counts.
+void RowColSmoosh(const Smooshable& s_a, const Smooshable& s_b,
+                  Smooshable& s_out, Eigen::MatrixXi& viterbi_idx) {
+  Eigen::VectorXi counts = s_a.col_scaler_counts() + s_b.row_scaler_counts();
+  int shift = counts.minCoeff();
+  s_out.scaler_count() = 0;
+  s_out.row_scaler_counts() = s_a.row_scaler_counts().array() + shift;
+  s_out.col_scaler_counts() = s_b.col_scaler_counts();
+  if (counts.maxCoeff() == shift) {
+    if (s_out.has_marginal()) {
+      s_out.marginal().noalias() = s_a.marginal() * s_b.marginal();
+    }
+    if (s_out.has_viterbi()) {
+      BinaryMax(s_a.viterbi(), s_b.viterbi(), s_out.viterbi(), viterbi_idx);
+    }
+  } else {
+    counts.array() -= shift;
+    Eigen::MatrixXi marginal_exps, viterbi_exps;
+    if (s_out.has_marginal()) {
+      marginal_exps.resize(s_out.left_flex() + 1, s_out.right_flex() + 1);
+      SumTerms(s_a.marginal(), s_b.marginal(), counts, s_out.marginal(),
+               marginal_exps);
+    }
+    if (s_out.has_viterbi()) {
+      viterbi_exps.resize(s_out.left_flex() + 1, s_out.right_flex() + 1);
+      MaxTerms(s_a.viterbi(), s_b.viterbi(), counts, s_out.viterbi(),
+               viterbi_exps, viterbi_idx);
+    }
+    // Split the counts of the leading matrix into as much as each row shares,
+    // and then as much as each column shares of what is left.
+    const Eigen::MatrixXi& exps =
+        s_out.has_marginal() ? marginal_exps : viterbi_exps;
+    Eigen::VectorXi row_exps(exps.rows()), col_exps(exps.cols());
+    for (int i = 0; i < exps.rows(); i++) {
+      int e = -1;
+      for (int k = 0; k < exps.cols(); k++) {
+        if (exps(i, k) >= 0 && (e < 0 || exps(i, k) < e)) e = exps(i, k);
+      }
+      row_exps(i) = std::max(e, 0);
+    }
+    for (int k = 0; k < exps.cols(); k++) {
+      int e = -1;
+      for (int i = 0; i < exps.rows(); i++) {
+        int rest = exps(i, k) - row_exps(i);
+        if (exps(i, k) >= 0 && (e < 0 || rest < e)) e = rest;
+      }
+      col_exps(k) = std::max(e, 0);
+    }
+    if (s_out.has_marginal()) {
+      ApplyExponents(s_out.marginal(), marginal_exps, row_exps, col_exps);
+    }
+    if (s_out.has_viterbi()) {
+      ApplyExponents(s_out.viterbi(), viterbi_exps, row_exps, col_exps);
+    }
+    s_out.row_scaler_counts() += row_exps;
+    s_out.col_scaler_counts() += col_exps;
+  }
+  if (s_out.has_marginal() && s_out.has_viterbi()) {
+    ScaleMatrixRowsCols(s_out.marginal(), s_out.viterbi(),
+                        s_out.row_scaler_counts(), s_out.col_scaler_counts());
+  } else if (s_out.has_marginal()) {
+    ScaleMatrixRowsCols(s_out.marginal(), s_out.row_scaler_counts(),
+                        s_out.col_scaler_counts());
+  } else {
+    ScaleMatrixRowsCols(s_out.viterbi(), s_out.row_scaler_counts(),
+                        s_out.col_scaler_counts());
+  }
+}
+
+typedef void (*SquareSmoosh)(const Smooshable&, const Smooshable&,
+                             Smooshable&, Eigen::MatrixXi&);
+
+// Entry n is the kernel for flex n.
+const SquareSmoosh kFixedSquareSmooshes[kMaxFixedFlex + 1] = {
+    &FixedSquareSmoosh<1>, &FixedSquareSmoosh<2>, &FixedSquareSmoosh<3>,
+    &FixedSquareSmoosh<4>, &FixedSquareSmoosh<5>, &FixedSquareSmoosh<6>,
+    &FixedSquareSmoosh<7>, &FixedSquareSmoosh<8>};
+}
+
+
 /// @brief Smoosh two smooshables!
 /// @param[in] s_a
 /// Smooshable on the left.
@@ -90,18 +618,100 @@ int ScaleMatrix(Eigen::Ref<Eigen::MatrixXd> m) {
 /// between the left and right smooshable.
 /// The equivalent entry for the Viterbi sequence just has sum replaced with
 /// max.
+///
+/// Both smooshables must use the same Scaling. In log space, the sum becomes
+/// a log-sum-exp and the product a sum, and no rescaling is needed. With
+/// per-row and per-column scaling, the scaler counts on the common segment are
+/// folded into the product, and only the rows and columns of the result that
+/// have drifted below SCALE_THRESHOLD are rescaled.
+///
+/// Both smooshables must also use the same SmooshMode, and only the quantities
+/// it asks for are computed. If there are no Viterbi probabilities,
+/// `viterbi_idx` is empty.
+///
+/// Globally scaled square smooshes with small flex go to fixed-size kernels
+/// (see FixedSmooshable), which unroll completely.
 std::pair<Smooshable, Eigen::MatrixXi> Smoosh(const Smooshable& s_a,
                                               const Smooshable& s_b) {
-  Smooshable s_out(s_a.left_flex(), s_b.right_flex());
-  Eigen::MatrixXi viterbi_idx(s_a.left_flex() + 1, s_b.right_flex() + 1);
+  Smooshable s_out(s_a.left_flex(), s_b.right_flex(), s_a.scaling(),
+                   s_a.mode());
+  Eigen::MatrixXi viterbi_idx;
+  if (s_out.has_viterbi()) {
+    viterbi_idx.resize(s_a.left_flex() + 1, s_b.right_flex() + 1);
+  }
+  Smoosh(s_a, s_b, s_out, viterbi_idx);
+  return std::make_pair(std::move(s_out), std::move(viterbi_idx));
+};
+
+
+/// @brief Smoosh two smooshables into existing storage.
+/// @param[in] s_a
+/// Smooshable on the left.
+/// @param[in] s_b
+/// Smooshable on the right.
+/// @param[out] s_out
+/// Smooshable of the right dimensions, Scaling and SmooshMode for the result,
+/// such as one from SmooshableArena::TakeSmooshable.
+/// @param[out] viterbi_idx
+/// Matrix of the right dimensions for the Viterbi index, or empty if there
+/// are no Viterbi probabilities.
+///
+/// See the other Smoosh for what this computes. With Scaling::kGlobal, which
+/// is what read annotation uses, nothing is allocated. The kLog and kRowCol
+/// smooshes still make temporaries: exponentiated copies for the
+/// log-sum-exp, and scaler count bookkeeping.
+void Smoosh(const Smooshable& s_a, const Smooshable& s_b, Smooshable& s_out,
+            Eigen::MatrixXi& viterbi_idx) {
   assert(s_a.right_flex() == s_b.left_flex());
-  s_out.marginal() = s_a.marginal() * s_b.marginal();
-  BinaryMax(s_a.viterbi(), s_b.viterbi(), s_out.viterbi(), viterbi_idx);
+  assert(s_a.scaling() == s_b.scaling());
+  assert(s_a.mode() == s_b.mode());
+  assert(s_out.left_flex() == s_a.left_flex());
+  assert(s_out.right_flex() == s_b.right_flex());
+  assert(s_out.scaling() == s_a.scaling());
+  assert(s_out.mode() == s_a.mode());
+  assert(!s_out.has_viterbi() || (viterbi_idx.rows() == s_out.left_flex() + 1 &&
+                                  viterbi_idx.cols() == s_out.right_flex() + 1));
+  LINEARHAM_TIME(kSmoosh);
+  // A multiply and an add per term of each product we compute.
+  LINEARHAM_COUNT(kSmooshFlops, 2L * (s_a.left_flex() + 1) *
+                                    (s_a.right_flex() + 1) *
+                                    (s_b.right_flex() + 1) *
+                                    (s_out.has_marginal() + s_out.has_viterbi()));
+  if (s_a.scaling() == Scaling::kLog) {
+    s_out.scaler_count() = 0;
+    if (s_out.has_marginal()) {
+      LogSumExpProduct(s_a.marginal(), s_b.marginal(), s_out.marginal());
+    }
+    if (s_out.has_viterbi()) {
+      MaxPlusProduct(s_a.viterbi(), s_b.viterbi(), s_out.viterbi(),
+                     viterbi_idx);
+    }
+    return;
+  }
+  if (s_a.scaling() == Scaling::kRowCol) {
+    RowColSmoosh(s_a, s_b, s_out, viterbi_idx);
+    return;
+  }
+  int flex = s_a.left_flex();
+  if (flex <= kMaxFixedFlex && flex == s_a.right_flex() &&
+      flex == s_b.right_flex()) {
+    kFixedSquareSmooshes[flex](s_a, s_b, s_out, viterbi_idx);
+  } else {
+    if (s_out.has_marginal()) {
+      s_out.marginal().noalias() = s_a.marginal() * s_b.marginal();
+    }
+    if (s_out.has_viterbi()) {
+      BinaryMax(s_a.viterbi(), s_b.viterbi(), s_out.viterbi(), viterbi_idx);
+    }
+  }
   s_out.scaler_count() = s_a.scaler_count() + s_b.scaler_count();
   // check for underflow
-  int k = ScaleMatrix(s_out.marginal());
-  s_out.viterbi() *= pow(SCALE_FACTOR, k);
-  s_out.scaler_count() += k;
-  return std::make_pair(s_out, viterbi_idx);
+  if (s_out.has_marginal()) {
+    int k = ScaleMatrix(s_out.marginal());
+    if (s_out.has_viterbi()) s_out.viterbi() *= pow(SCALE_FACTOR, k);
+    s_out.scaler_count() += k;
+  } else {
+    s_out.scaler_count() += ScaleMatrix(s_out.viterbi());
+  }
 };
 }
@@ -12,6 +12,30 @@ namespace linearham {
 const double SCALE_FACTOR = pow(2, 256);
 const double SCALE_THRESHOLD = (1.0 / SCALE_FACTOR);
 
+
+/// @brief How a Smooshable keeps its probabilities from underflowing.
+///
+/// With kGlobal, the matrices hold probabilities multiplied by
+/// SCALE_FACTOR^scaler_count. With kLog, they hold natural logs of
+/// probabilities and scaler_count is always zero. With kRowCol, entry (i, j)
+/// holds its probability multiplied by
+/// SCALE_FACTOR^(row_scaler_counts(i) + col_scaler_counts(j)), so a row or
+/// column that is much smaller than the rest doesn't underflow; scaler_count
+/// is again always zero.
+enum class Scaling { kGlobal, kLog, kRowCol };
+
+
+/// @brief Which quantities a Smooshable computes and stores.
+///
+/// Marginal probabilities are all that's needed for likelihoods, and Viterbi
+/// probabilities are all that's needed for annotation. The matrix for a
+/// quantity that isn't computed is left empty.
+enum class SmooshMode { kBoth, kMarginal, kViterbi };
+
+
+class SmooshableArena;
+
+
 /// @brief Abstracts something that has probabilities associated with sequence
 /// start and stop points.
 ///
@@ -23,18 +47,56 @@ class Smooshable {
   Eigen::MatrixXd marginal_;
   Eigen::MatrixXd viterbi_;
   int scaler_count_;
+  // Only used with Scaling::kRowCol.
+  Eigen::VectorXi row_scaler_counts_;
+  Eigen::VectorXi col_scaler_counts_;
+  Scaling scaling_;
+  SmooshMode mode_;
+
+  friend class SmooshableArena;
+
+  void SetProbabilities(Eigen::MatrixXd probs);
+  void SetProbabilities(Eigen::MatrixXd marginal, Eigen::MatrixXd viterbi);
+  Eigen::MatrixXd UnscaledLog(const Eigen::Ref<const Eigen::MatrixXd>& m) const;
+  // Whichever of the matrices we are storing; they have the same dimensions.
+  const Eigen::MatrixXd& stored() const {
+    return (mode_ == SmooshMode::kViterbi) ? viterbi_ : marginal_;
+  };
 
  public:
-  Smooshable(){};
-  Smooshable(int left_flex, int right_flex);
-  Smooshable(Eigen::Ref<Eigen::MatrixXd> marginal);
-
-  int left_flex() const { return marginal_.rows() - 1; };
-  int right_flex() const { return marginal_.cols() - 1; };
+  Smooshable()
+      : scaler_count_(0), scaling_(Scaling::kGlobal), mode_(SmooshMode::kBoth){};
+  Smooshable(int left_flex, int right_flex,
+             Scaling scaling = Scaling::kGlobal,
+             SmooshMode mode = SmooshMode::kBoth);
+  Smooshable(Eigen::Ref<Eigen::MatrixXd> marginal,
+             Scaling scaling = Scaling::kGlobal,
+             SmooshMode mode = SmooshMode::kBoth);
+  Smooshable(Eigen::Ref<Eigen::MatrixXd> marginal,
+             Eigen::Ref<Eigen::MatrixXd> viterbi,
+             Scaling scaling = Scaling::kGlobal,
+             SmooshMode mode = SmooshMode::kBoth);
+
+  int left_flex() const { return stored().rows() - 1; };
+  int right_flex() const { return stored().cols() - 1; };
 
   int scaler_count() const { return scaler_count_; };
   int& scaler_count() { return scaler_count_; };
 
+  const Eigen::VectorXi& row_scaler_counts() const {
+    return row_scaler_counts_;
+  };
+  Eigen::VectorXi& row_scaler_counts() { return row_scaler_counts_; };
+  const Eigen::VectorXi& col_scaler_counts() const {
+    return col_scaler_counts_;
+  };
+  Eigen::VectorXi& col_scaler_counts() { return col_scaler_counts_; };
+
+  Scaling scaling() const { return scaling_; };
+  SmooshMode mode() const { return mode_; };
+  bool has_marginal() const { return mode_ != SmooshMode::kViterbi; };
+  bool has_viterbi() const { return mode_ != SmooshMode::kMarginal; };
+
   const Eigen::Ref<const Eigen::MatrixXd> marginal() const {
     return marginal_;
   };
@@ -42,23 +104,57 @@ class Smooshable {
 
   const Eigen::Ref<const Eigen::MatrixXd> viterbi() const { return viterbi_; };
   Eigen::Ref<Eigen::MatrixXd> viterbi() { return viterbi_; };
+
+  Eigen::MatrixXd LogMarginal() const;
+  double LogMarginalEntry(int i, int j) const;
+  Eigen::MatrixXd LogViterbi() const;
 };
 
 
 /// A smooshable derived from a read aligned to a segment of germline gene.
 class SmooshableGermline : public Smooshable {
  public:
-  SmooshableGermline(Germline germline, int start,
+  SmooshableGermline(const Germline& germline, int start,
+                     const Eigen::Ref<const Eigen::VectorXi>& emission_indices,
+                     int left_flex, int right_flex,
+                     Scaling scaling = Scaling::kGlobal,
+                     SmooshMode mode = SmooshMode::kBoth);
+  SmooshableGermline(const Germline& germline, int start,
                      const Eigen::Ref<const Eigen::VectorXi>& emission_indices,
-                     int left_flex, int right_flex);
+                     int left_flex, int right_flex, SmooshableArena& arena,
+                     Scaling scaling = Scaling::kGlobal,
+                     SmooshMode mode = SmooshMode::kBoth);
 };
 
 
 // Functions
+Smooshable SmooshableFromLogs(const Eigen::Ref<const Eigen::MatrixXd>& logs,
+                              Scaling scaling = Scaling::kGlobal,
+                              SmooshMode mode = SmooshMode::kBoth);
+
+Smooshable SmooshableFromLogs(const Eigen::Ref<const Eigen::MatrixXd>& logs,
+                              SmooshableArena& arena,
+                              Scaling scaling = Scaling::kGlobal,
+                              SmooshMode mode = SmooshMode::kBoth);
+
 std::pair<Smooshable, Eigen::MatrixXi> Smoosh(const Smooshable& s_a,
                                               const Smooshable& s_b);
 
+void Smoosh(const Smooshable& s_a, const Smooshable& s_b, Smooshable& s_out,
+            Eigen::MatrixXi& viterbi_idx);
+
 int ScaleMatrix(Eigen::Ref<Eigen::MatrixXd> m);
+
+int ScaleCount(double max);
+
+void ScaleMatrixRowsCols(Eigen::Ref<Eigen::MatrixXd> m,
+                         Eigen::Ref<Eigen::VectorXi> row_counts,
+                         Eigen::Ref<Eigen::VectorXi> col_counts);
+
+void ScaleMatrixRowsCols(Eigen::Ref<Eigen::MatrixXd> m,
+                         Eigen::Ref<Eigen::MatrixXd> follower,
+                         Eigen::Ref<Eigen::VectorXi> row_counts,
+                         Eigen::Ref<Eigen::VectorXi> col_counts);
 }
 
 #endif  // LINEARHAM_SMOOSHABLE_
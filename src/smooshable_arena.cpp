@@ -0,0 +1,322 @@
+#include "smooshable_arena.hpp"
+
+/// @file smooshable_arena.cpp
+/// @brief Implementation of the SmooshableArena class.
+
+namespace linearham {
+
+
+namespace {
+
+// Move a spare matrix of the given shape out of a pool, or allocate one.
+template <class Matrix>
+Matrix TakeFromPool(std::map<std::pair<int, int>, std::vector<Matrix>>& pool,
+                    int rows, int cols, int& allocation_count) {
+  auto it = pool.find(std::make_pair(rows, cols));
+  if (it == pool.end() || it->second.empty()) {
+    allocation_count++;
+    return Matrix(rows, cols);
+  }
+  Matrix matrix = std::move(it->second.back());
+  it->second.pop_back();
+  return matrix;
+}
+
+// Put a matrix back into a pool. Empty matrices have no storage to reuse.
+template <class Matrix>
+void GiveToPool(std::map<std::pair<int, int>, std::vector<Matrix>>& pool,
+                Matrix matrix) {
+  if (matrix.size() == 0) return;
+  pool[std::make_pair(matrix.rows(), matrix.cols())].push_back(
+      std::move(matrix));
+}
+
+// Move the spare vector that is the tightest fit for `capacity` entries out
+// of a pool, or make one with that much room.
+template <class T>
+std::vector<T> TakeVectorFromPool(std::vector<std::vector<T>>& pool,
+                                  size_t capacity) {
+  auto best = pool.end();
+  for (auto it = pool.begin(); it != pool.end(); ++it) {
+    if (it->capacity() >= capacity &&
+        (best == pool.end() || it->capacity() < best->capacity())) {
+      best = it;
+    }
+  }
+  std::vector<T> vector;
+  if (best == pool.end()) {
+    vector.reserve(capacity);
+    return vector;
+  }
+  vector = std::move(*best);
+  if (best + 1 != pool.end()) *best = std::move(pool.back());
+  pool.pop_back();
+  return vector;
+}
+
+// Put an emptied vector back into a pool, keeping its storage.
+template <class T>
+void GiveVectorToPool(std::vector<std::vector<T>>& pool,
+                      std::vector<T> vector) {
+  if (vector.capacity() == 0) return;
+  vector.clear();
+  pool.push_back(std::move(vector));
+}
+}
+
+
+/// @brief Take a matrix of probabilities.
+/// @param[in] rows
+/// Number of rows.
+/// @param[in] cols
+/// Number of columns.
+/// @return A matrix of the given shape, with arbitrary entries.
+Eigen::MatrixXd SmooshableArena::TakeMatrix(int rows, int cols) {
+  return TakeFromPool(spare_matrices_, rows, cols, allocation_count_);
+};
+
+
+/// @brief Take a matrix of Viterbi indices.
+/// @param[in] rows
+/// Number of rows.
+/// @param[in] cols
+/// Number of columns.
+/// @return A matrix of the given shape, with arbitrary entries.
+Eigen::MatrixXi SmooshableArena::TakeIndexMatrix(int rows, int cols) {
+  return TakeFromPool(spare_index_matrices_, rows, cols, allocation_count_);
+};
+
+
+/// @brief Take a compact matrix of Viterbi indices.
+/// @param[in] rows
+/// Number of rows.
+/// @param[in] cols
+/// Number of columns.
+/// @param[in] max_value
+/// The largest value the matrix will need to hold.
+/// @return A matrix of the given shape and the width for `max_value`, with
+/// arbitrary entries.
+CompactIndexMatrix SmooshableArena::TakeCompactIndexMatrix(int rows, int cols,
+                                                          int max_value) {
+  int width = CompactIndexMatrix::WidthFor(max_value);
+  auto it = spare_compact_index_matrices_.find(rows * cols * width);
+  if (it == spare_compact_index_matrices_.end() || it->second.empty()) {
+    allocation_count_++;
+    return CompactIndexMatrix(rows, cols, max_value);
+  }
+  CompactIndexMatrix matrix = std::move(it->second.back());
+  it->second.pop_back();
+  matrix.rows_ = rows;
+  matrix.cols_ = cols;
+  matrix.width_ = width;
+  return matrix;
+};
+
+
+/// @brief Take a zeroed vector of scaler counts.
+/// @param[in] size
+/// Number of entries.
+Eigen::VectorXi SmooshableArena::TakeScalerCounts(int size) {
+  Eigen::VectorXi counts;
+  auto it = spare_scaler_counts_.find(size);
+  if (it == spare_scaler_counts_.end() || it->second.empty()) {
+    allocation_count_++;
+    counts.resize(size);
+  } else {
+    counts = std::move(it->second.back());
+    it->second.pop_back();
+  }
+  counts.setZero();
+  return counts;
+};
+
+
+// Give a kRowCol smooshable zeroed scaler counts for a rows x cols matrix.
+void SmooshableArena::SetScalerCounts(Smooshable& smooshable, int rows,
+                                      int cols) {
+  smooshable.row_scaler_counts_ = TakeScalerCounts(rows);
+  smooshable.col_scaler_counts_ = TakeScalerCounts(cols);
+};
+
+
+/// @brief Take a smooshable, as the "boring" Smooshable constructor would
+/// make it.
+/// @param[in] left_flex
+/// Left flex.
+/// @param[in] right_flex
+/// Right flex.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+Smooshable SmooshableArena::TakeSmooshable(int left_flex, int right_flex,
+                                           Scaling scaling, SmooshMode mode) {
+  Smooshable smooshable;
+  smooshable.scaling_ = scaling;
+  smooshable.mode_ = mode;
+  if (smooshable.has_marginal()) {
+    smooshable.marginal_ = TakeMatrix(left_flex + 1, right_flex + 1);
+  }
+  if (smooshable.has_viterbi()) {
+    smooshable.viterbi_ = TakeMatrix(left_flex + 1, right_flex + 1);
+  }
+  if (scaling == Scaling::kRowCol) {
+    SetScalerCounts(smooshable, left_flex + 1, right_flex + 1);
+  }
+  return smooshable;
+};
+
+
+/// @brief Take a smooshable holding freshly computed probabilities, as the
+/// Smooshable constructor from marginal probabilities would make it.
+/// @param[in] probs
+/// Matrix of (unscaled) probabilities, such as one from TakeMatrix, whose
+/// storage the smooshable takes over.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+Smooshable SmooshableArena::TakeSmooshable(Eigen::MatrixXd probs,
+                                           Scaling scaling, SmooshMode mode) {
+  Smooshable smooshable;
+  smooshable.scaling_ = scaling;
+  smooshable.mode_ = mode;
+  if (scaling == Scaling::kRowCol) {
+    SetScalerCounts(smooshable, probs.rows(), probs.cols());
+  }
+  // The probabilities become one of the matrices and are copied into the
+  // other.
+  if (smooshable.has_marginal() && smooshable.has_viterbi()) {
+    smooshable.marginal_ = TakeMatrix(probs.rows(), probs.cols());
+  }
+  smooshable.SetProbabilities(std::move(probs));
+  return smooshable;
+};
+
+
+/// @brief Take a smooshable holding freshly computed marginal and Viterbi
+/// probabilities, as the Smooshable constructor from both would make it.
+/// @param[in] marginal
+/// Matrix of (unscaled) marginal probabilities, whose storage the smooshable
+/// takes over.
+/// @param[in] viterbi
+/// Matrix of (unscaled) Viterbi probabilities, likewise.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+///
+/// A matrix that `mode` doesn't store goes back to the arena.
+Smooshable SmooshableArena::TakeSmooshable(Eigen::MatrixXd marginal,
+                                           Eigen::MatrixXd viterbi,
+                                           Scaling scaling, SmooshMode mode) {
+  assert(marginal.rows() == viterbi.rows());
+  assert(marginal.cols() == viterbi.cols());
+  Smooshable smooshable;
+  smooshable.scaling_ = scaling;
+  smooshable.mode_ = mode;
+  if (scaling == Scaling::kRowCol) {
+    SetScalerCounts(smooshable, marginal.rows(), marginal.cols());
+  }
+  if (!smooshable.has_marginal()) Give(std::move(marginal));
+  if (!smooshable.has_viterbi()) Give(std::move(viterbi));
+  smooshable.SetProbabilities(std::move(marginal), std::move(viterbi));
+  return smooshable;
+};
+
+
+/// @brief Take an empty vector of smooshables.
+/// @param[in] capacity
+/// How many smooshables it should have room for.
+SmooshableVector SmooshableArena::TakeSmooshableVector(size_t capacity) {
+  return TakeVectorFromPool(spare_smooshable_vectors_, capacity);
+};
+
+
+/// @brief Take an empty vector of compact index matrices.
+/// @param[in] capacity
+/// How many matrices it should have room for.
+CompactIndexMatrixVector SmooshableArena::TakeCompactIndexMatrixVector(
+    size_t capacity) {
+  return TakeVectorFromPool(spare_compact_index_matrix_vectors_, capacity);
+};
+
+
+/// @brief Take an empty vector of integers.
+/// @param[in] capacity
+/// How many entries it should have room for.
+std::vector<int> SmooshableArena::TakeIntVector(size_t capacity) {
+  return TakeVectorFromPool(spare_int_vectors_, capacity);
+};
+
+
+/// @brief Take an empty vector of pairs of integers.
+/// @param[in] capacity
+/// How many entries it should have room for.
+std::vector<std::pair<int, int>> SmooshableArena::TakePairVector(
+    size_t capacity) {
+  return TakeVectorFromPool(spare_pair_vectors_, capacity);
+};
+
+
+/// @brief Give back a matrix of probabilities.
+void SmooshableArena::Give(Eigen::MatrixXd matrix) {
+  GiveToPool(spare_matrices_, std::move(matrix));
+};
+
+
+/// @brief Give back a matrix of Viterbi indices.
+void SmooshableArena::Give(Eigen::MatrixXi matrix) {
+  GiveToPool(spare_index_matrices_, std::move(matrix));
+};
+
+
+/// @brief Give back a compact matrix of Viterbi indices.
+void SmooshableArena::Give(CompactIndexMatrix matrix) {
+  if (matrix.bytes() == 0) return;
+  spare_compact_index_matrices_[matrix.bytes()].push_back(std::move(matrix));
+};
+
+
+/// @brief Give back a vector of scaler counts.
+void SmooshableArena::GiveScalerCounts(Eigen::VectorXi counts) {
+  if (counts.size() == 0) return;
+  spare_scaler_counts_[counts.size()].push_back(std::move(counts));
+};
+
+
+/// @brief Give back the matrices (and any scaler counts) of a smooshable.
+void SmooshableArena::Give(Smooshable smooshable) {
+  Give(std::move(smooshable.marginal_));
+  Give(std::move(smooshable.viterbi_));
+  GiveScalerCounts(std::move(smooshable.row_scaler_counts_));
+  GiveScalerCounts(std::move(smooshable.col_scaler_counts_));
+};
+
+
+/// @brief Give back a vector of smooshables, along with their matrices.
+void SmooshableArena::Give(SmooshableVector smooshables) {
+  for (Smooshable& smooshable : smooshables) Give(std::move(smooshable));
+  GiveVectorToPool(spare_smooshable_vectors_, std::move(smooshables));
+};
+
+
+/// @brief Give back a vector of compact index matrices, along with the
+/// matrices.
+void SmooshableArena::Give(CompactIndexMatrixVector matrices) {
+  for (CompactIndexMatrix& matrix : matrices) Give(std::move(matrix));
+  GiveVectorToPool(spare_compact_index_matrix_vectors_, std::move(matrices));
+};
+
+
+/// @brief Give back a vector of integers.
+void SmooshableArena::Give(std::vector<int> vector) {
+  GiveVectorToPool(spare_int_vectors_, std::move(vector));
+};
+
+
+/// @brief Give back a vector of pairs of integers.
+void SmooshableArena::Give(std::vector<std::pair<int, int>> vector) {
+  GiveVectorToPool(spare_pair_vectors_, std::move(vector));
+};
+}
@@ -0,0 +1,89 @@
+#ifndef LINEARHAM_SMOOSHABLE_ARENA_
+#define LINEARHAM_SMOOSHABLE_ARENA_
+
+#include <map>
+#include "compact_index_matrix.hpp"
+#include "smooshable.hpp"
+
+/// @file smooshable_arena.hpp
+/// @brief Headers for the SmooshableArena class.
+
+namespace linearham {
+
+
+typedef std::vector<Smooshable> SmooshableVector;
+typedef std::vector<CompactIndexMatrix> CompactIndexMatrixVector;
+
+
+/// @brief A pool of matrices to build smooshables out of, so that working
+/// through many reads doesn't keep going back to the heap.
+///
+/// Eigen matrices can't be pointed at outside storage, so rather than carving
+/// matrices out of one block this keeps spare matrices (and their storage)
+/// sorted by shape. Taking a matrix of a shape that has a spare one is free;
+/// otherwise a new one is allocated. Once everything taken for a read has
+/// been given back, the next read with the same shapes allocates nothing.
+///
+/// The vectors that hold smooshables, index matrices and the bookkeeping of
+/// a SmooshableChain are pooled too. A vector is taken with the room it will
+/// need, and the spare that is the tightest fit is handed out, so that a
+/// read that needs no more room than the last one reuses the same vectors.
+///
+/// An arena is not thread-safe: use one per thread.
+class SmooshableArena {
+ protected:
+  typedef std::pair<int, int> Shape;
+  std::map<Shape, std::vector<Eigen::MatrixXd>> spare_matrices_;
+  std::map<Shape, std::vector<Eigen::MatrixXi>> spare_index_matrices_;
+  // Keyed by bytes of storage, since matrices of any shape and width with the
+  // same number of bytes can share it.
+  std::map<size_t, std::vector<CompactIndexMatrix>>
+      spare_compact_index_matrices_;
+  // The scaler counts of Scaling::kRowCol smooshables, keyed by size.
+  std::map<int, std::vector<Eigen::VectorXi>> spare_scaler_counts_;
+  std::vector<SmooshableVector> spare_smooshable_vectors_;
+  std::vector<CompactIndexMatrixVector> spare_compact_index_matrix_vectors_;
+  std::vector<std::vector<int>> spare_int_vectors_;
+  std::vector<std::vector<std::pair<int, int>>> spare_pair_vectors_;
+  int allocation_count_;
+
+  void SetScalerCounts(Smooshable& smooshable, int rows, int cols);
+
+ public:
+  SmooshableArena() : allocation_count_(0){};
+  SmooshableArena(const SmooshableArena&) = delete;
+  SmooshableArena& operator=(const SmooshableArena&) = delete;
+
+  /// @brief The number of matrices allocated because there was no spare.
+  int allocation_count() const { return allocation_count_; };
+
+  Eigen::MatrixXd TakeMatrix(int rows, int cols);
+  Eigen::MatrixXi TakeIndexMatrix(int rows, int cols);
+  CompactIndexMatrix TakeCompactIndexMatrix(int rows, int cols, int max_value);
+  Eigen::VectorXi TakeScalerCounts(int size);
+  Smooshable TakeSmooshable(int left_flex, int right_flex,
+                            Scaling scaling = Scaling::kGlobal,
+                            SmooshMode mode = SmooshMode::kBoth);
+  Smooshable TakeSmooshable(Eigen::MatrixXd probs, Scaling scaling,
+                            SmooshMode mode);
+  Smooshable TakeSmooshable(Eigen::MatrixXd marginal, Eigen::MatrixXd viterbi,
+                            Scaling scaling, SmooshMode mode);
+
+  SmooshableVector TakeSmooshableVector(size_t capacity);
+  CompactIndexMatrixVector TakeCompactIndexMatrixVector(size_t capacity);
+  std::vector<int> TakeIntVector(size_t capacity);
+  std::vector<std::pair<int, int>> TakePairVector(size_t capacity);
+
+  void Give(Eigen::MatrixXd matrix);
+  void Give(Eigen::MatrixXi matrix);
+  void Give(CompactIndexMatrix matrix);
+  void GiveScalerCounts(Eigen::VectorXi counts);
+  void Give(Smooshable smooshable);
+  void Give(SmooshableVector smooshables);
+  void Give(CompactIndexMatrixVector matrices);
+  void Give(std::vector<int> vector);
+  void Give(std::vector<std::pair<int, int>> vector);
+};
+}
+
+#endif  // LINEARHAM_SMOOSHABLE_ARENA_
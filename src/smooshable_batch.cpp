@@ -0,0 +1,163 @@
+#include "smooshable_batch.hpp"
+
+#include <algorithm>
+#include "instrumentation.hpp"
+
+/// @file smooshable_batch.cpp
+/// @brief Implementation of the SmooshableBatch class.
+
+namespace linearham {
+
+
+// How many batch members Smoosh works on at once.
+const int kBatchChunk = 32;
+
+
+/// @brief "Boring" constructor, which just sets up memory.
+/// @param[in] left_flex
+/// Left flex of every member.
+/// @param[in] right_flex
+/// Right flex of every member.
+/// @param[in] size
+/// Number of members.
+SmooshableBatch::SmooshableBatch(int left_flex, int right_flex, int size)
+    : left_flex_(left_flex), right_flex_(right_flex) {
+  marginal_.resize((left_flex + 1) * (right_flex + 1), size);
+  viterbi_.resize((left_flex + 1) * (right_flex + 1), size);
+  scaler_counts_.setZero(size);
+};
+
+
+/// @brief Constructor packing smooshables into a batch.
+/// @param[in] smooshables
+/// Globally scaled smooshables, all with the same flexes and with both
+/// marginal and Viterbi probabilities.
+SmooshableBatch::SmooshableBatch(const SmooshableVector& smooshables)
+    : SmooshableBatch(smooshables.front().left_flex(),
+                      smooshables.front().right_flex(), smooshables.size()) {
+  for (int b = 0; b < size(); b++) {
+    const Smooshable& smooshable = smooshables[b];
+    assert(smooshable.left_flex() == left_flex_);
+    assert(smooshable.right_flex() == right_flex_);
+    assert(smooshable.scaling() == Scaling::kGlobal);
+    assert(smooshable.mode() == SmooshMode::kBoth);
+    // Column-major storage matches our row numbering.
+    marginal_.col(b) = Eigen::Map<const Eigen::VectorXd>(
+        smooshable.marginal().data(), marginal_.rows());
+    viterbi_.col(b) = Eigen::Map<const Eigen::VectorXd>(
+        smooshable.viterbi().data(), viterbi_.rows());
+    scaler_counts_(b) = smooshable.scaler_count();
+  }
+};
+
+
+/// @brief Unpack one member of the batch.
+/// @param[in] member
+/// Which member.
+Smooshable SmooshableBatch::Get(int member) const {
+  Smooshable smooshable(left_flex_, right_flex_);
+  Eigen::Map<Eigen::VectorXd>(smooshable.marginal().data(), marginal_.rows()) =
+      marginal_.col(member);
+  Eigen::Map<Eigen::VectorXd>(smooshable.viterbi().data(), viterbi_.rows()) =
+      viterbi_.col(member);
+  smooshable.scaler_count() = scaler_counts_(member);
+  return smooshable;
+};
+
+
+// Functions
+
+/// @brief Smoosh two batches member by member.
+/// @param[in] s_a
+/// Batch on the left.
+/// @param[in] s_b
+/// Batch on the right, of the same size.
+/// @return (s_out, viterbi_idx)
+/// Member b of `s_out` is what Smoosh makes of member b of `s_a` and `s_b`,
+/// and `viterbi_idx` holds the corresponding Viterbi indices laid out like
+/// the batch (see GetViterbiIndex).
+///
+/// The marginal is a batch of small matrix products and the Viterbi a batch
+/// of max-products, each computed with one vectorized operation across the
+/// batch per multiply-add. Ties are broken as in BinaryMax.
+std::pair<SmooshableBatch, BatchIndexMatrix> Smoosh(
+    const SmooshableBatch& s_a, const SmooshableBatch& s_b) {
+  assert(s_a.right_flex() == s_b.left_flex());
+  assert(s_a.size() == s_b.size());
+  int rows = s_a.left_flex() + 1;
+  int inner = s_a.right_flex() + 1;
+  int cols = s_b.right_flex() + 1;
+  LINEARHAM_TIME(kBatchSmoosh);
+  // As for Smoosh: a multiply and an add per term of both products.
+  LINEARHAM_COUNT(kSmooshFlops, 4L * rows * inner * cols * s_a.size());
+  SmooshableBatch s_out(s_a.left_flex(), s_b.right_flex(), s_a.size());
+  BatchIndexMatrix viterbi_idx(rows * cols, s_a.size());
+  double marginal[kBatchChunk], viterbi[kBatchChunk];
+  int idx[kBatchChunk];
+
+  // Work through the batch a chunk of members at a time, so the rows we are
+  // working on stay in cache. The loops over a chunk are simple enough for
+  // the compiler to vectorize.
+  for (int start = 0; start < s_a.size(); start += kBatchChunk) {
+    int width = std::min(kBatchChunk, s_a.size() - start);
+    for (int k = 0; k < cols; k++) {
+      for (int i = 0; i < rows; i++) {
+        const double* a_m = &s_a.marginal()(i, start);
+        const double* a_v = &s_a.viterbi()(i, start);
+        const double* b_m = &s_b.marginal()(k * inner, start);
+        const double* b_v = &s_b.viterbi()(k * inner, start);
+        for (int c = 0; c < width; c++) {
+          marginal[c] = a_m[c] * b_m[c];
+          viterbi[c] = a_v[c] * b_v[c];
+          idx[c] = 0;
+        }
+        for (int j = 1; j < inner; j++) {
+          a_m = &s_a.marginal()(i + j * rows, start);
+          a_v = &s_a.viterbi()(i + j * rows, start);
+          b_m = &s_b.marginal()(j + k * inner, start);
+          b_v = &s_b.viterbi()(j + k * inner, start);
+          for (int c = 0; c < width; c++) {
+            marginal[c] += a_m[c] * b_m[c];
+            double prod = a_v[c] * b_v[c];
+            bool better = prod > viterbi[c];
+            viterbi[c] = better ? prod : viterbi[c];
+            idx[c] = better ? j : idx[c];
+          }
+        }
+        std::copy(marginal, marginal + width,
+                  &s_out.marginal()(i + k * rows, start));
+        std::copy(viterbi, viterbi + width,
+                  &s_out.viterbi()(i + k * rows, start));
+        std::copy(idx, idx + width, &viterbi_idx(i + k * rows, start));
+      }
+    }
+  }
+
+  // Rescale each member as Smoosh would (see ScaleMatrix).
+  s_out.scaler_counts() = s_a.scaler_counts() + s_b.scaler_counts();
+  for (int b = 0; b < s_out.size(); b++) {
+    int n = ScaleCount(s_out.marginal().col(b).maxCoeff());
+    for (int k = 0; k < n; k++) {
+      s_out.marginal().col(b) *= SCALE_FACTOR;
+      s_out.viterbi().col(b) *= SCALE_FACTOR;
+    }
+    s_out.scaler_counts()(b) += n;
+  }
+  return std::make_pair(std::move(s_out), std::move(viterbi_idx));
+};
+
+
+/// @brief Unpack the Viterbi index of one member of a batch smoosh.
+/// @param[in] viterbi_idx
+/// The batch of Viterbi indices.
+/// @param[in] left_flex
+/// The left flex of the smooshed batch.
+/// @param[in] member
+/// Which member.
+Eigen::MatrixXi GetViterbiIndex(const BatchIndexMatrix& viterbi_idx,
+                                int left_flex, int member) {
+  Eigen::VectorXi column = viterbi_idx.col(member);
+  return Eigen::Map<Eigen::MatrixXi>(column.data(), left_flex + 1,
+                                     viterbi_idx.rows() / (left_flex + 1));
+};
+}
@@ -0,0 +1,62 @@
+#ifndef LINEARHAM_SMOOSHABLE_BATCH_
+#define LINEARHAM_SMOOSHABLE_BATCH_
+
+#include "smooshable_chain.hpp"
+
+/// @file smooshable_batch.hpp
+/// @brief Headers for the SmooshableBatch class.
+
+namespace linearham {
+
+
+typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    BatchMatrix;
+typedef Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    BatchIndexMatrix;
+
+
+/// @brief A batch of globally scaled smooshables of the same shape, such as
+/// those of many reads against the same genes, stored so that smooshing works
+/// on the whole batch at once.
+///
+/// Entry (i, j) of every smooshable in the batch is stored contiguously in
+/// row `i + j * (left_flex + 1)` of a row-major matrix with one column per
+/// batch member. Smooshing two batches then does the few multiply-adds of
+/// each small matrix product on whole rows, which vectorize across the batch,
+/// rather than paying the per-call overhead of Smoosh for each member.
+class SmooshableBatch {
+ protected:
+  int left_flex_;
+  int right_flex_;
+  BatchMatrix marginal_;
+  BatchMatrix viterbi_;
+  Eigen::VectorXi scaler_counts_;
+
+ public:
+  SmooshableBatch() : left_flex_(-1), right_flex_(-1){};
+  SmooshableBatch(int left_flex, int right_flex, int size);
+  SmooshableBatch(const SmooshableVector& smooshables);
+
+  int left_flex() const { return left_flex_; };
+  int right_flex() const { return right_flex_; };
+  int size() const { return scaler_counts_.size(); };
+
+  const BatchMatrix& marginal() const { return marginal_; };
+  BatchMatrix& marginal() { return marginal_; };
+  const BatchMatrix& viterbi() const { return viterbi_; };
+  BatchMatrix& viterbi() { return viterbi_; };
+  const Eigen::VectorXi& scaler_counts() const { return scaler_counts_; };
+  Eigen::VectorXi& scaler_counts() { return scaler_counts_; };
+
+  Smooshable Get(int member) const;
+};
+
+
+std::pair<SmooshableBatch, BatchIndexMatrix> Smoosh(
+    const SmooshableBatch& s_a, const SmooshableBatch& s_b);
+
+Eigen::MatrixXi GetViterbiIndex(const BatchIndexMatrix& viterbi_idx,
+                                int left_flex, int member);
+}
+
+#endif  // LINEARHAM_SMOOSHABLE_BATCH_
@@ -0,0 +1,121 @@
+#include "smooshable_cache.hpp"
+
+#include <algorithm>
+
+/// @file smooshable_cache.cpp
+/// @brief Implementation of the SmooshableCache class.
+
+namespace linearham {
+
+
+namespace {
+
+// Fold a value into a hash, as boost::hash_combine does.
+template <class T>
+void HashCombine(size_t& hash, const T& value) {
+  hash ^= std::hash<T>()(value) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+}
+}
+
+
+bool SmooshableCache::Key::operator==(const Key& other) const {
+  return hash == other.hash && start == other.start &&
+         left_flex == other.left_flex && right_flex == other.right_flex &&
+         scaling == other.scaling && mode == other.mode &&
+         germline == other.germline &&
+         emission_count == other.emission_count &&
+         std::equal(emission_indices, emission_indices + emission_count,
+                    other.emission_indices);
+};
+
+
+/// @brief Constructor.
+/// @param[in] capacity
+/// The most smooshables to keep at once.
+SmooshableCache::SmooshableCache(int capacity)
+    : capacity_(capacity), hit_count_(0), miss_count_(0) {
+  assert(capacity_ > 0);
+};
+
+
+/// @brief The number of smooshables in the cache.
+int SmooshableCache::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+};
+
+
+/// @brief Look up a germline match smooshable, building it if it isn't in
+/// the cache.
+///
+/// The parameters are as for the SmooshableGermline constructor, except that
+/// the germline is shared, so that a new entry can hold on to it. The window
+/// of emission indices is only copied when a new entry is made.
+SmooshablePtr SmooshableCache::GetGermline(
+    const GermlinePtr& germline, int start,
+    const Eigen::Ref<const Eigen::VectorXi>& emission_indices, int left_flex,
+    int right_flex, Scaling scaling, SmooshMode mode) {
+  Key key;
+  key.germline = germline.get();
+  key.start = start;
+  key.emission_indices = emission_indices.data();
+  key.emission_count = emission_indices.size();
+  key.left_flex = left_flex;
+  key.right_flex = right_flex;
+  key.scaling = scaling;
+  key.mode = mode;
+  key.hash = std::hash<const Germline*>()(germline.get());
+  HashCombine(key.hash, start);
+  for (int i = 0; i < key.emission_count; i++) {
+    HashCombine(key.hash, key.emission_indices[i]);
+  }
+  HashCombine(key.hash, left_flex);
+  HashCombine(key.hash, right_flex);
+  HashCombine(key.hash, static_cast<int>(scaling));
+  HashCombine(key.hash, static_cast<int>(mode));
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(key);
+    if (found != index_.end()) {
+      hit_count_++;
+      entries_.splice(entries_.begin(), entries_, found->second);
+      return found->second->smooshable;
+    }
+  }
+  miss_count_++;
+  SmooshablePtr smooshable = std::make_shared<const SmooshableGermline>(
+      *germline, start, emission_indices, left_flex, right_flex, scaling,
+      mode);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = index_.find(key);
+  if (found != index_.end()) {
+    // Another thread got here first.
+    entries_.splice(entries_.begin(), entries_, found->second);
+    return found->second->smooshable;
+  }
+  // List nodes don't move, so the entry's key can point at its own window.
+  entries_.push_front({key, germline,
+                       std::vector<int>(key.emission_indices,
+                                        key.emission_indices +
+                                            key.emission_count),
+                       smooshable});
+  Entry& entry = entries_.front();
+  entry.key.emission_indices = entry.emission_indices.data();
+  index_.emplace(entry.key, entries_.begin());
+  if (static_cast<int>(entries_.size()) > capacity_) {
+    index_.erase(entries_.back().key);
+    entries_.pop_back();
+  }
+  return smooshable;
+};
+
+
+/// @brief Throw out every smooshable, leaving the counters alone.
+void SmooshableCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  index_.clear();
+  entries_.clear();
+};
+}
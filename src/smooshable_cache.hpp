@@ -0,0 +1,96 @@
+#ifndef LINEARHAM_SMOOSHABLE_CACHE_
+#define LINEARHAM_SMOOSHABLE_CACHE_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "smooshable.hpp"
+
+/// @file smooshable_cache.hpp
+/// @brief Headers for the SmooshableCache class.
+
+namespace linearham {
+
+
+typedef std::shared_ptr<const Smooshable> SmooshablePtr;
+typedef std::shared_ptr<const Germline> GermlinePtr;
+
+
+/// @brief A bounded cache of germline match smooshables, which throws out the
+/// least recently used entry when it is full.
+///
+/// Entries are keyed by germline, start, the window of emission indices,
+/// flexes, Scaling and SmooshMode. Germlines are told apart by address rather
+/// than by name, since names need not be unique (or even set). Each entry
+/// holds on to its germline, so that address can't be taken by another
+/// germline while the entry lives. The window is compared in full, so
+/// different windows with the same hash never collide. Entries are handed
+/// out as pointers to const, so they stay valid after being thrown out.
+///
+/// The read annotation pipeline (see vdj_chain.hpp) doesn't go through a
+/// cache: its windows are clipped to each read, so they rarely repeat. This
+/// is for callers that score the same window against the same gene over and
+/// over, such as a driver trying many partitions of the same reads; the
+/// "SmooshableCache" benchmark measures what a hit saves.
+///
+/// A cache may be shared between threads. Smooshables are built outside the
+/// lock, so two threads missing on the same key at once will both build it.
+class SmooshableCache {
+ protected:
+  // Keys point at their window of emission indices rather than holding it,
+  // so that a lookup can point at the caller's window without copying it.
+  // The window of an entry is owned by the entry.
+  struct Key {
+    const Germline* germline;
+    int start;
+    const int* emission_indices;
+    int emission_count;
+    int left_flex;
+    int right_flex;
+    Scaling scaling;
+    SmooshMode mode;
+    size_t hash;
+
+    bool operator==(const Key& other) const;
+  };
+  struct KeyHash {
+    size_t operator()(const Key& key) const { return key.hash; };
+  };
+  struct Entry {
+    Key key;
+    GermlinePtr germline;
+    std::vector<int> emission_indices;
+    SmooshablePtr smooshable;
+  };
+  typedef std::list<Entry> EntryList;
+
+  int capacity_;
+  // Most recently used first.
+  EntryList entries_;
+  std::unordered_map<Key, EntryList::iterator, KeyHash> index_;
+  std::mutex mutex_;
+  std::atomic<long> hit_count_;
+  std::atomic<long> miss_count_;
+
+ public:
+  SmooshableCache(int capacity);
+  SmooshableCache(const SmooshableCache&) = delete;
+  SmooshableCache& operator=(const SmooshableCache&) = delete;
+
+  int capacity() const { return capacity_; };
+  int size();
+  long hit_count() const { return hit_count_; };
+  long miss_count() const { return miss_count_; };
+
+  SmooshablePtr GetGermline(
+      const GermlinePtr& germline, int start,
+      const Eigen::Ref<const Eigen::VectorXi>& emission_indices,
+      int left_flex, int right_flex, Scaling scaling = Scaling::kGlobal,
+      SmooshMode mode = SmooshMode::kBoth);
+  void Clear();
+};
+}
+
+#endif  // LINEARHAM_SMOOSHABLE_CACHE_
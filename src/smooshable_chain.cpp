@@ -2,12 +2,30 @@
 
 #include "smooshable_chain.hpp"
 
+#include <algorithm>
+#include "instrumentation.hpp"
+#include "trace.hpp"
+
 /// @file smooshable_chain.cpp
 /// @brief Implementation of SmooshableChain class.
 
 namespace linearham {
 
 
+namespace {
+
+// Viterbi indices from Smoosh, narrowed. They index the middle dimension of
+// the smoosh, so they are at most `max_value`, the flex there.
+CompactIndexMatrix Narrowed(const Eigen::MatrixXi& viterbi_idx, int max_value) {
+  if (viterbi_idx.size() == 0) return CompactIndexMatrix();
+  CompactIndexMatrix narrowed(viterbi_idx.rows(), viterbi_idx.cols(),
+                              max_value);
+  narrowed.Assign(viterbi_idx);
+  return narrowed;
+}
+}
+
+
 /// @brief Constructor for a SmooshableChain.
 /// @param[in] originals
 /// A vector of the input smooshables.
@@ -18,67 +36,525 @@ namespace linearham {
 /// @image html http://i.imgur.com/FI6eVZp.png "Unwinding Viterbi: see code
 /// comments in SmooshableChain constructor."
 SmooshableChain::SmooshableChain(SmooshableVector originals)
-    : originals_(originals) {
-  IntMatrixVector viterbi_idxs;
-
+    : originals_(originals), viterbi_paths_unwound_(false), arena_(nullptr) {
   // If there's only one smooshable there is nothing to smoosh.
   if (originals.size() <= 1) {
     return;
   }
 
-  // Smoosh the supplied Smooshables and add the results onto the back of the
-  // corresponding vectors.
-  // The [] expression below describes how we are going to be modifying
-  // `this` and viterbi_idxs.
-  auto SmooshAndAdd = [this, &viterbi_idxs](const Smooshable& s_a,
-                                            const Smooshable& s_b) {
-    Smooshable smooshed;
-    Eigen::MatrixXi viterbi_idx;
-    std::tie(smooshed, viterbi_idx) = Smoosh(s_a, s_b);
-    // Move semantics: smooshed is dead after this call.
-    smoosheds_.push_back(std::move(smooshed));
-    viterbi_idxs.push_back(std::move(viterbi_idx));
-  };
-
   // Say we are given smooshes a, b, c,  and denote smoosh by *.
   // First make a list a*b, a*b*c.
-  SmooshAndAdd(originals_[0], originals_[1]);
+  int last = AddSmoosh(0, 1, 0);
+  for (unsigned int i = 2; i < originals_.size(); i++) {
+    last = AddSmoosh(last, i, i - 1);
+  };
+};
+
+
+/// @brief Constructor for a SmooshableChain that smooshes in parallel.
+/// @param[in] originals
+/// A vector of the input smooshables.
+/// @param[in] pool
+/// The threads to smoosh with.
+///
+/// Smooshing is associative, so rather than going left to right we can smoosh
+/// neighboring pairs, then neighboring pairs of those, and so on, with the
+/// smooshes at each level of this balanced tree running concurrently.
+/// The marginal and Viterbi results are the same as those of the sequential
+/// constructor (up to rounding), but `smooshed()` holds the nodes of the tree
+/// level by level rather than the left-to-right partial smooshes.
+SmooshableChain::SmooshableChain(SmooshableVector originals, ThreadPool& pool)
+    : originals_(originals), viterbi_paths_unwound_(false), arena_(nullptr) {
+  if (originals.size() <= 1) {
+    return;
+  }
+
+  // The smooshables on the current level of the tree, and for each of them
+  // the index of the rightmost original it covers.
+  int n = originals_.size();
+  std::vector<int> level(n), level_ends(n);
+  for (int i = 0; i < n; i++) {
+    level[i] = level_ends[i] = i;
+  }
+  // Running smooshes hold pointers into smoosheds_, so it must not reallocate.
+  smoosheds_.reserve(n - 1);
+
+  while (level.size() > 1) {
+    std::vector<std::future<std::pair<Smooshable, CompactIndexMatrix>>>
+        results;
+    for (unsigned int i = 0; i + 1 < level.size(); i += 2) {
+      const Smooshable* s_a = (level[i] < n) ? &originals_[level[i]]
+                                             : &smoosheds_[level[i] - n];
+      const Smooshable* s_b = (level[i + 1] < n)
+                                  ? &originals_[level[i + 1]]
+                                  : &smoosheds_[level[i + 1] - n];
+      results.push_back(pool.Submit([s_a, s_b]() {
+        std::pair<Smooshable, Eigen::MatrixXi> result = Smoosh(*s_a, *s_b);
+        return std::make_pair(std::move(result.first),
+                              Narrowed(result.second, s_a->right_flex()));
+      }));
+    }
+
+    // Collect the results in order, so the layout doesn't depend on timing.
+    std::vector<int> next_level, next_level_ends;
+    for (unsigned int i = 0; i + 1 < level.size(); i += 2) {
+      Smooshable smooshed;
+      CompactIndexMatrix viterbi_idx;
+      std::tie(smooshed, viterbi_idx) = results[i / 2].get();
+      smoosheds_.push_back(std::move(smooshed));
+      viterbi_idxs_.push_back(std::move(viterbi_idx));
+      children_.emplace_back(level[i], level[i + 1]);
+      junctions_.push_back(level_ends[i]);
+      spans_.emplace_back(Span(level[i]).first, level_ends[i + 1]);
+      next_level.push_back(n + smoosheds_.size() - 1);
+      next_level_ends.push_back(level_ends[i + 1]);
+    }
+    // An odd one out moves up a level as is.
+    if (level.size() % 2 == 1) {
+      next_level.push_back(level.back());
+      next_level_ends.push_back(level_ends.back());
+    }
+    level = std::move(next_level);
+    level_ends = std::move(next_level_ends);
+  }
+};
+
+
+/// @brief Constructor for a SmooshableChain whose smooshed matrices come from
+/// an arena.
+/// @param[in] originals
+/// A vector of the input smooshables.
+/// @param[in] arena
+/// Where to take the matrices for the smooshed results from.
+///
+/// Smooshes left to right, like the first constructor. Call Release when done
+/// with the chain to give its matrices and bookkeeping back to the arena.
+SmooshableChain::SmooshableChain(SmooshableVector originals,
+                                 SmooshableArena& arena)
+    : originals_(std::move(originals)),
+      viterbi_paths_unwound_(false),
+      arena_(&arena) {
+  LINEARHAM_TRACE("chain smooshing");
+  if (originals_.size() <= 1) {
+    return;
+  }
+  // The bookkeeping comes from the arena too, with room for every smoosh.
+  size_t smoosh_count = originals_.size() - 1;
+  smoosheds_ = arena.TakeSmooshableVector(smoosh_count);
+  viterbi_idxs_ = arena.TakeCompactIndexMatrixVector(smoosh_count);
+  children_ = arena.TakePairVector(smoosh_count);
+  junctions_ = arena.TakeIntVector(smoosh_count);
+  spans_ = arena.TakePairVector(smoosh_count);
+  int last = AddSmoosh(0, 1, 0);
   for (unsigned int i = 2; i < originals_.size(); i++) {
-    SmooshAndAdd(smoosheds_.back(), originals_[i]);
+    last = AddSmoosh(last, i, i - 1);
   };
+};
+
+
+/// @brief Smoosh two smooshables of the chain and record the result.
+/// @param[in] left
+/// Number of the smooshable on the left (see `children_`).
+/// @param[in] right
+/// Number of the smooshable on the right.
+/// @param[in] junction
+/// The boundary between originals that we are smooshing across.
+/// @return
+/// The number of the new smooshable.
+int SmooshableChain::AddSmoosh(int left, int right, int junction) {
+  int n = originals_.size();
+  const Smooshable& s_a =
+      (left < n) ? originals_[left] : smoosheds_[left - n];
+  const Smooshable& s_b =
+      (right < n) ? originals_[right] : smoosheds_[right - n];
+  Smooshable smooshed;
+  CompactIndexMatrix viterbi_idx;
+  if (arena_ == nullptr) {
+    Eigen::MatrixXi wide_viterbi_idx;
+    std::tie(smooshed, wide_viterbi_idx) = Smoosh(s_a, s_b);
+    viterbi_idx = Narrowed(wide_viterbi_idx, s_a.right_flex());
+  } else {
+    smooshed = arena_->TakeSmooshable(s_a.left_flex(), s_b.right_flex(),
+                                      s_a.scaling(), s_a.mode());
+    Eigen::MatrixXi wide_viterbi_idx;
+    if (smooshed.has_viterbi()) {
+      wide_viterbi_idx =
+          arena_->TakeIndexMatrix(s_a.left_flex() + 1, s_b.right_flex() + 1);
+    }
+    Smoosh(s_a, s_b, smooshed, wide_viterbi_idx);
+    if (smooshed.has_viterbi()) {
+      // The wide indices are only scratch, so they go straight back.
+      viterbi_idx = arena_->TakeCompactIndexMatrix(
+          s_a.left_flex() + 1, s_b.right_flex() + 1, s_a.right_flex());
+      viterbi_idx.Assign(wide_viterbi_idx);
+      arena_->Give(std::move(wide_viterbi_idx));
+    }
+  }
+  // Move semantics: smooshed is dead after this call.
+  smoosheds_.push_back(std::move(smooshed));
+  viterbi_idxs_.push_back(std::move(viterbi_idx));
+  children_.emplace_back(left, right);
+  junctions_.push_back(junction);
+  spans_.emplace_back(Span(left).first, Span(right).second);
+  return n + smoosheds_.size() - 1;
+};
+
+
+/// @brief The first and last originals covered by a smooshable of the chain.
+/// @param[in] node
+/// Number of the smooshable (see `children_`).
+std::pair<int, int> SmooshableChain::Span(int node) const {
+  int n = originals_.size();
+  return (node < n) ? std::make_pair(node, node) : spans_[node - n];
+};
+
+
+/// @brief Find a smooshable of the chain covering exactly the given originals,
+/// smooshing one up if there isn't one.
+/// @param[in] first
+/// The first original to cover.
+/// @param[in] last
+/// The last original to cover.
+/// @return
+/// The number of the smooshable.
+///
+/// We start from the longest smooshable we have that begins at `first` or
+/// ends at `last`, and smoosh on one original at a time.
+int SmooshableChain::SpanNode(int first, int last) {
+  int n = originals_.size();
+  int from_first = first, from_last = last;
+  for (unsigned int k = 0; k < smoosheds_.size(); k++) {
+    if (spans_[k].first == first && spans_[k].second <= last &&
+        spans_[k].second > Span(from_first).second) {
+      from_first = n + k;
+    }
+    if (spans_[k].second == last && spans_[k].first >= first &&
+        spans_[k].first < Span(from_last).first) {
+      from_last = n + k;
+    }
+  }
+  int node;
+  if (Span(from_first).second - first >= last - Span(from_last).first) {
+    node = from_first;
+    for (int i = Span(node).second + 1; i <= last; i++) {
+      node = AddSmoosh(node, i, i - 1);
+    }
+  } else {
+    node = from_last;
+    for (int i = Span(node).first - 1; i >= first; i--) {
+      node = AddSmoosh(i, node, i);
+    }
+  }
+  return node;
+};
 
-  // In the example, this will be a*b*c.
-  Eigen::MatrixXi vidx_fully_smooshed = viterbi_idxs.back();
-
-  // Unwind the viterbi paths.
-  for (int fs_i = 0; fs_i < vidx_fully_smooshed.rows(); fs_i++) {
-    for (int fs_j = 0; fs_j < vidx_fully_smooshed.cols(); fs_j++) {
-      std::vector<int> path;
-
-      // Before reading this, take a look at the documentation for Smoosh and
-      // note that the entry of `viterbi_idx` is the starting point for the
-      // Viterbi path in the right hand smoosh.
-      // We will unwind the path moving from right to left, starting with the
-      // fully-smooshed entry a*b*c. From what we just said, this is the start
-      // point for the Viterbi path in c.
-      path.push_back(vidx_fully_smooshed(fs_i, fs_j));
-
-      // Loop through the entries of viterbi_idxs.
-      // Each one of these is a viterbi_idx matrix (not a single index).
-      for (auto viterbi_idx =
-               std::next(viterbi_idxs.rbegin());  // Start at pentiultimate.
-           viterbi_idx != viterbi_idxs.rend();    // Iterate to the start.
-           ++viterbi_idx) {
-        // Say this is our first trip through the loop in our a*b*c example
-        // (in fact, with only 3 originals we will only have one pass total).
-        // As stated above, path.front() has the start point j in c. The
-        // corresponding matrix entry is the previous step in the Viterbi path.
-        assert(path.front() < viterbi_idx->cols());
-        path.insert(path.begin(), (*viterbi_idx)(fs_i, path.front()));
+
+/// @brief Throw out the smoosheds that cover a given original, renumbering
+/// the rest.
+/// @param[in] i
+/// The original.
+///
+/// The children of a smooshed smooshable cover less than it does, so they
+/// are only thrown out if it is.
+void SmooshableChain::DropSmooshesCovering(int i) {
+  int n = originals_.size();
+  std::vector<int> numbers(n + smoosheds_.size(), -1);
+  for (int k = 0; k < n; k++) numbers[k] = k;
+  unsigned int kept = 0;
+  for (unsigned int k = 0; k < smoosheds_.size(); k++) {
+    if (spans_[k].first <= i && i <= spans_[k].second) {
+      if (arena_ != nullptr) {
+        arena_->Give(std::move(smoosheds_[k]));
+        arena_->Give(std::move(viterbi_idxs_[k]));
       }
+      continue;
+    }
+    numbers[n + k] = n + kept;
+    if (kept != k) {
+      smoosheds_[kept] = std::move(smoosheds_[k]);
+      viterbi_idxs_[kept] = std::move(viterbi_idxs_[k]);
+      junctions_[kept] = junctions_[k];
+      spans_[kept] = spans_[k];
+    }
+    children_[kept] = std::make_pair(numbers[children_[k].first],
+                                     numbers[children_[k].second]);
+    kept++;
+  }
+  smoosheds_.erase(smoosheds_.begin() + kept, smoosheds_.end());
+  viterbi_idxs_.erase(viterbi_idxs_.begin() + kept, viterbi_idxs_.end());
+  children_.erase(children_.begin() + kept, children_.end());
+  junctions_.erase(junctions_.begin() + kept, junctions_.end());
+  spans_.erase(spans_.begin() + kept, spans_.end());
+};
+
+
+/// @brief Replace one of the originals and bring the chain up to date.
+/// @param[in] i
+/// Which original to replace.
+/// @param[in] smooshable
+/// The new original, which must have the same flexes as the old one.
+///
+/// Only the smoosheds covering original i are thrown out. The new root is
+/// (0..i-1) * i * (i+1..n-1), where the smooshables for the prefix and the
+/// suffix are kept from before if we have them. The first replacement of a
+/// given original may have to smoosh up the suffix (the sequential
+/// constructors only keep prefixes), but after that replacing the same
+/// original again costs two smooshes, whatever the length of the chain.
+///
+/// Afterwards `smooshed()` holds the nodes of the new tree, with the root
+/// last, and the Viterbi results are those of the new chain.
+void SmooshableChain::Replace(int i, Smooshable smooshable) {
+  int n = originals_.size();
+  assert(0 <= i && i < n);
+  assert(smooshable.left_flex() == originals_[i].left_flex());
+  assert(smooshable.right_flex() == originals_[i].right_flex());
+  originals_[i] = std::move(smooshable);
+  viterbi_paths_ = CompactIndexMatrix();
+  viterbi_paths_unwound_ = false;
+  ClearPosteriorSpans();
+  if (n <= 1) return;
+  DropSmooshesCovering(i);
+
+  int left = (i > 0) ? AddSmoosh(SpanNode(0, i - 1), i, i - 1) : i;
+  if (i < n - 1) AddSmoosh(left, SpanNode(i + 1, n - 1), i);
+};
+
+
+/// @brief Unwind the Viterbi path for one entry of the fully smooshed matrix.
+/// @param[in] row
+/// Row of the entry.
+/// @param[in] col
+/// Column of the entry.
+/// @param[out] path
+/// Buffer of length `path_length()`, which gets the Viterbi path: entry i is
+/// the index at which the path crosses the junction between originals i and
+/// i+1.
+///
+/// Unwinding one path touches each smooshed node once and allocates nothing,
+/// so callers that only want the best path should use this (along with
+/// BestViterbiCell) rather than viterbi_paths().
+void SmooshableChain::ViterbiPath(int row, int col, int* path) const {
+  assert(fully_smooshed().has_viterbi());
+  assert(0 <= row && row <= fully_smooshed().left_flex());
+  assert(0 <= col && col <= fully_smooshed().right_flex());
+  LINEARHAM_TIME(kViterbiUnwinding);
+  UnwindViterbiPath(originals_.size() + smoosheds_.size() - 1, row, col, path);
+};
+
+
+/// @brief Find the entry of the fully smooshed matrix with the largest
+/// Viterbi probability.
+/// @param[out] row
+/// Row of that entry.
+/// @param[out] col
+/// Column of that entry.
+void SmooshableChain::BestViterbiCell(int* row, int* col) const {
+  assert(fully_smooshed().has_viterbi());
+  // Global and log scaling are monotone in the probability, but per-row and
+  // per-column scaling is not.
+  if (fully_smooshed().scaling() == Scaling::kRowCol) {
+    fully_smooshed().LogViterbi().maxCoeff(row, col);
+  } else {
+    fully_smooshed().viterbi().maxCoeff(row, col);
+  }
+};
+
 
-      viterbi_paths_.push_back(std::move(path));
+/// @brief The Viterbi paths for every entry of the fully smooshed matrix, in
+/// row-major order.
+/// @return
+/// A matrix with one path per row, so that row `i * (right_flex + 1) + j`
+/// is the path for the (i, j) entry of the fully smooshed matrix.
+///
+/// These are unwound on the first call, which is not safe to make from
+/// several threads at once. The paths share one buffer, narrowed to the
+/// width that holds the largest flex of a junction. A chain of marginal-only
+/// smooshables, or of a single smooshable, has no Viterbi paths.
+const CompactIndexMatrix& SmooshableChain::viterbi_paths() const {
+  if (viterbi_paths_unwound_) return viterbi_paths_;
+  viterbi_paths_unwound_ = true;
+  if (smoosheds_.empty() || !fully_smooshed().has_viterbi()) {
+    return viterbi_paths_;
+  }
+  const Smooshable& root = fully_smooshed();
+  int max_flex = 0;
+  for (int k = 0; k < path_length(); k++) {
+    max_flex = std::max(max_flex, originals_[k].right_flex());
+  }
+  viterbi_paths_ = CompactIndexMatrix(
+      (root.left_flex() + 1) * (root.right_flex() + 1), path_length(),
+      max_flex);
+  std::vector<int> path(path_length());
+  int cell = 0;
+  for (int fs_i = 0; fs_i <= root.left_flex(); fs_i++) {
+    for (int fs_j = 0; fs_j <= root.right_flex(); fs_j++, cell++) {
+      ViterbiPath(fs_i, fs_j, path.data());
+      for (int k = 0; k < path_length(); k++) {
+        viterbi_paths_.Set(cell, k, path[k]);
+      }
     }
   }
+  return viterbi_paths_;
+};
+
+
+/// @brief The posterior probabilities of where the paths for one entry of the
+/// fully smooshed matrix cross each junction.
+/// @param[in] row
+/// Row of the entry.
+/// @param[in] col
+/// Column of the entry.
+/// @return
+/// Entry k is the distribution of the index at which paths cross the
+/// junction between originals k and k+1, just as entry k of a Viterbi path
+/// is the best such index. If the entry has probability zero the
+/// distributions are all zero.
+///
+/// This is the forward-backward algorithm with smooshables as the steps: the
+/// prefix of the chain up to junction k, times the suffix after it, summed
+/// over the index at the junction, is the entry itself. So the (row, j) entry
+/// of a smooshable covering the prefix times the (j, col) entry of one
+/// covering the suffix, normalized, is the posterior of index j. The
+/// sequential constructors already keep every prefix; the first call
+/// smooshes up whatever prefixes and suffixes the chain is missing (see
+/// SmooshPosteriorSpans), after which each call only reads entries. We take
+/// logs entry by entry so that any Scaling will do, and the normalization
+/// means that the products can't underflow.
+std::vector<Eigen::VectorXd> SmooshableChain::JunctionPosteriors(
+    int row, int col) const {
+  assert(fully_smooshed().has_marginal());
+  assert(0 <= row && row <= fully_smooshed().left_flex());
+  assert(0 <= col && col <= fully_smooshed().right_flex());
+  int n = originals_.size();
+  std::vector<Eigen::VectorXd> posteriors(std::max(n - 1, 0));
+  if (n <= 1) return posteriors;
+  if (prefixes_.empty()) SmooshPosteriorSpans();
+
+  for (int k = 0; k < n - 1; k++) {
+    const Smooshable& prefix = PosteriorSpan(prefixes_[k]);
+    const Smooshable& suffix = PosteriorSpan(suffixes_[k]);
+    Eigen::VectorXd log_posterior(prefix.right_flex() + 1);
+    for (int j = 0; j < log_posterior.size(); j++) {
+      log_posterior(j) =
+          prefix.LogMarginalEntry(row, j) + suffix.LogMarginalEntry(j, col);
+    }
+    double max = log_posterior.maxCoeff();
+    if (!std::isfinite(max)) {
+      posteriors[k].setZero(log_posterior.size());
+      continue;
+    }
+    posteriors[k] = (log_posterior.array() - max).exp();
+    posteriors[k] /= posteriors[k].sum();
+  }
+  return posteriors;
+};
+
+
+/// @brief Find, or smoosh up, the prefixes and suffixes of the chain that
+/// JunctionPosteriors needs.
+///
+/// Smooshed nodes whose span starts at the first original are prefixes, and
+/// those ending at the last are suffixes. The rest are smooshed one original
+/// at a time from their neighbours: missing prefixes in a forward sweep and
+/// missing suffixes in a backward one, in the scaling of the originals. So a
+/// sequential chain costs n - 2 smooshes, all for suffixes.
+void SmooshableChain::SmooshPosteriorSpans() const {
+  int n = originals_.size();
+  int smooshed_count = smoosheds_.size();
+  prefixes_.assign(n - 1, -1);
+  suffixes_.assign(n - 1, -1);
+  for (int k = 0; k < smooshed_count; k++) {
+    int first, last;
+    std::tie(first, last) = spans_[k];
+    if (first == 0 && last < n - 1) prefixes_[last] = n + k;
+    if (last == n - 1 && first > 0) suffixes_[first - 1] = n + k;
+  }
+  prefixes_[0] = 0;
+  suffixes_[n - 2] = n - 1;
+  posterior_smoosheds_.clear();
+  for (int k = 1; k < n - 1; k++) {
+    if (prefixes_[k] >= 0) continue;
+    posterior_smoosheds_.push_back(
+        Smoosh(PosteriorSpan(prefixes_[k - 1]), originals_[k]).first);
+    prefixes_[k] = n + smooshed_count + posterior_smoosheds_.size() - 1;
+  }
+  for (int k = n - 3; k >= 0; k--) {
+    if (suffixes_[k] >= 0) continue;
+    posterior_smoosheds_.push_back(
+        Smoosh(originals_[k + 1], PosteriorSpan(suffixes_[k + 1])).first);
+    suffixes_[k] = n + smooshed_count + posterior_smoosheds_.size() - 1;
+  }
+};
+
+
+/// @brief The smooshable with a given number, counting on from the smoosheds
+/// into `posterior_smoosheds_`.
+const Smooshable& SmooshableChain::PosteriorSpan(int node) const {
+  int n = originals_.size();
+  int smooshed_count = smoosheds_.size();
+  if (node < n) return originals_[node];
+  if (node < n + smooshed_count) return smoosheds_[node - n];
+  return posterior_smoosheds_[node - n - smooshed_count];
+};
+
+
+/// @brief Forget the prefixes and suffixes found by SmooshPosteriorSpans,
+/// which are numbered by their place in the chain.
+void SmooshableChain::ClearPosteriorSpans() {
+  prefixes_.clear();
+  suffixes_.clear();
+  posterior_smoosheds_.clear();
+};
+
+
+/// @brief Unwind the Viterbi path through one smooshable of the chain.
+/// @param[in] node
+/// Number of the smooshable (see `children_`).
+/// @param[in] row
+/// The row of the entry of that smooshable we are unwinding.
+/// @param[in] col
+/// The column of the entry of that smooshable we are unwinding.
+/// @param[out] path
+/// The Viterbi path, which gets the entries for the junctions inside `node`.
+///
+/// Before reading this, take a look at the documentation for Smoosh and note
+/// that the entry of `viterbi_idx` is the starting point for the Viterbi path
+/// in the right hand smoosh, which is also the end point in the left hand
+/// one. So if `node` came from smooshing a and b, the Viterbi path for its
+/// (row, col) entry goes through the (row, j) entry of a and the (j, col)
+/// entry of b, where j is the corresponding entry of `viterbi_idx`.
+void SmooshableChain::UnwindViterbiPath(int node, int row, int col,
+                                        int* path) const {
+  int n = originals_.size();
+  // Originals have nothing left to unwind.
+  if (node < n) return;
+  int j = viterbi_idxs_[node - n](row, col);
+  path[junctions_[node - n]] = j;
+  UnwindViterbiPath(children_[node - n].first, row, j, path);
+  UnwindViterbiPath(children_[node - n].second, j, col, path);
+};
+
+
+/// @brief Give the smooshed matrices, and the vectors that hold them, back to
+/// the arena the chain was built with, leaving only the originals.
+///
+/// The originals are left alone, since they may not have come from the
+/// arena.
+void SmooshableChain::Release() {
+  if (arena_ != nullptr) {
+    arena_->Give(std::move(smoosheds_));
+    arena_->Give(std::move(viterbi_idxs_));
+    arena_->Give(std::move(children_));
+    arena_->Give(std::move(junctions_));
+    arena_->Give(std::move(spans_));
+  }
+  smoosheds_.clear();
+  viterbi_idxs_.clear();
+  children_.clear();
+  junctions_.clear();
+  spans_.clear();
+  viterbi_paths_ = CompactIndexMatrix();
+  viterbi_paths_unwound_ = false;
+  ClearPosteriorSpans();
 };
 }
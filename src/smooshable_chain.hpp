@@ -1,7 +1,8 @@
 #ifndef LINEARHAM_SMOOSHABLE_CHAIN_
 #define LINEARHAM_SMOOSHABLE_CHAIN_
 
-#include "smooshable.hpp"
+#include "smooshable_arena.hpp"
+#include "thread_pool.hpp"
 
 /// @file smooshable_chain.hpp
 /// @brief Headers for SmooshableChain class.
@@ -9,32 +10,76 @@
 namespace linearham {
 
 
-typedef std::vector<Smooshable> SmooshableVector;
-typedef std::vector<Eigen::MatrixXi> IntMatrixVector;
-typedef std::vector<std::vector<int>> IntVectorVector;
-
-
 /// @brief An ordered list of smooshables that have been smooshed together, with
 /// associated information.
 ///
 /// The idea is that you put a collection of smooshables together in a chain
 /// then smoosh them all together. It's nice to have a class for such a chain
 /// so that you can unwind the result in the end.
+///
+/// Each smooshed result records which two smooshables it came from, so the
+/// chain is really a binary tree whose leaves are the originals and whose
+/// root is `smooshed().back()`. Smooshing left to right gives a left-deep
+/// tree; the ThreadPool constructor builds a balanced one.
 class SmooshableChain {
  protected:
   SmooshableVector originals_;
   SmooshableVector smoosheds_;
-  IntVectorVector viterbi_paths_;
+  // Viterbi indices are kept narrowed (see CompactIndexMatrix).
+  CompactIndexMatrixVector viterbi_idxs_;
+  // Smooshables are numbered with the originals first and then the
+  // smoosheds. Entry k of children_ gives the numbers of the two smooshables
+  // that were smooshed to make smoosheds_[k], and entry k of junctions_ says
+  // which boundary between originals it smooshed across.
+  std::vector<std::pair<int, int>> children_;
+  std::vector<int> junctions_;
+  // Entry k of spans_ gives the first and last originals that smoosheds_[k]
+  // covers.
+  std::vector<std::pair<int, int>> spans_;
+  // Filled in by the first call to viterbi_paths(), one path per row.
+  mutable CompactIndexMatrix viterbi_paths_;
+  mutable bool viterbi_paths_unwound_;
+  // Filled in by the first call to JunctionPosteriors. Entry k of prefixes_
+  // (resp. suffixes_) is the number of a smooshable covering originals 0
+  // through k (resp. k + 1 through n - 1), where the numbering goes on past
+  // the smoosheds into posterior_smoosheds_ for spans we had to smoosh up.
+  mutable std::vector<int> prefixes_, suffixes_;
+  mutable SmooshableVector posterior_smoosheds_;
+  // Where smooshed matrices come from, if not the heap.
+  SmooshableArena* arena_;
+
+  int AddSmoosh(int left, int right, int junction);
+  std::pair<int, int> Span(int node) const;
+  int SpanNode(int first, int last);
+  void DropSmooshesCovering(int i);
+  void UnwindViterbiPath(int node, int row, int col, int* path) const;
+  void SmooshPosteriorSpans() const;
+  const Smooshable& PosteriorSpan(int node) const;
+  void ClearPosteriorSpans();
 
  public:
   SmooshableChain(SmooshableVector originals);
+  SmooshableChain(SmooshableVector originals, ThreadPool& pool);
+  SmooshableChain(SmooshableVector originals, SmooshableArena& arena);
 
   const SmooshableVector& originals() const { return originals_; };
   SmooshableVector& originals() { return originals_; };
   const SmooshableVector& smooshed() const { return smoosheds_; };
   SmooshableVector& smooshed() { return smoosheds_; };
-  const IntVectorVector& viterbi_paths() const { return viterbi_paths_; };
-  IntVectorVector& viterbi_paths() { return viterbi_paths_; };
+  const Smooshable& fully_smooshed() const {
+    return smoosheds_.empty() ? originals_.front() : smoosheds_.back();
+  };
+  /// @brief The number of entries in a Viterbi path, one per junction.
+  int path_length() const { return originals_.size() - 1; };
+
+  void ViterbiPath(int row, int col, int* path) const;
+  void BestViterbiCell(int* row, int* col) const;
+  const CompactIndexMatrix& viterbi_paths() const;
+  std::vector<Eigen::VectorXd> JunctionPosteriors(int row, int col) const;
+
+  void Replace(int i, Smooshable smooshable);
+
+  void Release();
 };
 }
 
@@ -0,0 +1,53 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+/// @file thread_pool.cpp
+/// @brief Implementation of the ThreadPool class.
+
+namespace linearham {
+
+
+/// @brief Start up the worker threads.
+/// @param[in] thread_count
+/// How many threads to use. Zero means one per hardware thread.
+ThreadPool::ThreadPool(int thread_count) : stopping_(false) {
+  assert(thread_count >= 0);
+  if (thread_count == 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (int i = 0; i < thread_count; i++) {
+    workers_.emplace_back(&ThreadPool::Work, this);
+  }
+};
+
+
+/// @brief Finish the queued tasks and shut down the worker threads.
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+};
+
+
+/// @brief The loop run by each worker thread.
+void ThreadPool::Work() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+};
+}
@@ -0,0 +1,63 @@
+#ifndef LINEARHAM_THREAD_POOL_
+#define LINEARHAM_THREAD_POOL_
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/// @file thread_pool.hpp
+/// @brief Headers for the ThreadPool class.
+
+namespace linearham {
+
+
+/// @brief A fixed set of worker threads pulling tasks off of a shared queue.
+class ThreadPool {
+ protected:
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stopping_;
+
+  void Work();
+
+ public:
+  ThreadPool(int thread_count);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int size() const { return workers_.size(); };
+
+  template <class F>
+  std::future<typename std::result_of<F()>::type> Submit(F task);
+};
+
+
+/// @brief Queue up a task.
+/// @param[in] task
+/// Something callable with no arguments.
+/// @return
+/// A future for the result of the task.
+template <class F>
+std::future<typename std::result_of<F()>::type> ThreadPool::Submit(F task) {
+  typedef typename std::result_of<F()>::type Result;
+  auto packaged =
+      std::make_shared<std::packaged_task<Result()>>(std::move(task));
+  std::future<Result> result = packaged->get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push([packaged]() { (*packaged)(); });
+  }
+  condition_.notify_one();
+  return result;
+};
+}
+
+#endif  // LINEARHAM_THREAD_POOL_
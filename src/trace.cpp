@@ -0,0 +1,179 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "trace.hpp"
+
+/// @file trace.cpp
+/// @brief Implementation of recording a timeline of a run as a Chrome trace.
+
+namespace linearham {
+
+
+namespace {
+
+struct TraceEvent {
+  const char* name;
+  int64_t start_ns;
+  int64_t duration_ns;
+};
+
+
+// The most recent events of one thread. Only that thread writes them: it
+// fills the slot after the last event and then publishes it by bumping
+// `count` with a release store, so a reader that acquires `count` sees whole
+// events. Once the buffer is full, new events overwrite the oldest.
+struct TraceBuffer {
+  int thread_id;
+  std::vector<TraceEvent> events;
+  std::atomic<uint64_t> count;
+
+  TraceBuffer(int thread_id, int capacity)
+      : thread_id(thread_id), events(capacity), count(0){};
+};
+
+
+std::atomic<bool> enabled(false);
+std::atomic<int> capacity(0);
+std::atomic<int64_t> epoch_ns(0);
+
+
+// Every thread's buffer, kept until exit so that the events of finished
+// threads can still be written.
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+
+Registry& GetRegistry() {
+  static Registry* registry = new Registry;
+  return *registry;
+}
+
+
+int64_t Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+
+// The calling thread's buffer, which it registers on its first event.
+TraceBuffer& LocalBuffer() {
+  thread_local TraceBuffer* buffer = nullptr;
+  if (buffer == nullptr) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.buffers.emplace_back(
+        new TraceBuffer(registry.buffers.size(), capacity.load()));
+    buffer = registry.buffers.back().get();
+  }
+  return *buffer;
+}
+
+
+void Record(const TraceEvent& event) {
+  TraceBuffer& buffer = LocalBuffer();
+  uint64_t count = buffer.count.load(std::memory_order_relaxed);
+  buffer.events[count % buffer.events.size()] = event;
+  buffer.count.store(count + 1, std::memory_order_release);
+}
+
+
+// Nanoseconds as microseconds, the unit of Chrome trace timestamps.
+std::string Microseconds(int64_t ns) {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3) << ns * 1e-3;
+  return out.str();
+}
+}
+
+
+/// @brief Start recording events, throwing away any recorded before.
+/// @param[in] events_per_thread
+/// The size of the ring buffer of a thread that hasn't recorded before.
+/// Threads that have keep the buffers they already have.
+///
+/// This must not be called while other threads are recording.
+void StartTracing(int events_per_thread) {
+  assert(events_per_thread > 0);
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (const auto& buffer : registry.buffers) buffer->count.store(0);
+  capacity.store(events_per_thread);
+  epoch_ns.store(Now());
+  enabled.store(true);
+};
+
+
+/// @brief Stop recording events. Scopes already open are still recorded.
+void StopTracing() { enabled.store(false); };
+
+
+bool TracingEnabled() { return enabled.load(std::memory_order_relaxed); };
+
+
+/// @brief Write every recorded event in the Chrome trace event format.
+/// @param[in] out
+/// Where to write the JSON.
+///
+/// Each scope is a complete ("X") event, with threads numbered in the order
+/// they first recorded. The number of events lost to full ring buffers is
+/// given as `dropped_events` under `otherData`. Threads should be done
+/// recording, for instance by having stopped tracing and joined the workers.
+void WriteTrace(std::ostream& out) {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  int64_t epoch = epoch_ns.load();
+  uint64_t dropped = 0;
+  bool first_event = true;
+  out << "{\"traceEvents\": [";
+  for (const auto& buffer : registry.buffers) {
+    uint64_t count = buffer->count.load(std::memory_order_acquire);
+    uint64_t size = buffer->events.size();
+    uint64_t first = (count > size) ? count - size : 0;
+    dropped += first;
+    out << (first_event ? "\n" : ",\n") << "  {\"name\": \"thread_name\", "
+        << "\"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->thread_id
+        << ", \"args\": {\"name\": \"thread " << buffer->thread_id << "\"}}";
+    first_event = false;
+    for (uint64_t i = first; i < count; i++) {
+      const TraceEvent& event = buffer->events[i % size];
+      out << ",\n  {\"name\": \"" << event.name
+          << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread_id
+          << ", \"ts\": " << Microseconds(event.start_ns - epoch)
+          << ", \"dur\": " << Microseconds(event.duration_ns) << "}";
+    }
+  }
+  out << "\n], \"displayTimeUnit\": \"ms\", \"otherData\": "
+      << "{\"dropped_events\": " << dropped << "}}\n";
+};
+
+
+/// @brief Write every recorded event to a Chrome trace JSON file; see
+/// WriteTrace.
+void WriteTraceFile(const std::string& path) {
+  std::ofstream out(path);
+  if (!out) throw std::runtime_error("Can't open " + path);
+  WriteTrace(out);
+};
+
+
+// TraceScope
+
+TraceScope::TraceScope(const char* name)
+    : name_(TracingEnabled() ? name : nullptr),
+      start_ns_(name_ != nullptr ? Now() : 0){};
+
+
+TraceScope::~TraceScope() {
+  if (name_ != nullptr) Record({name_, start_ns_, Now() - start_ns_});
+};
+}
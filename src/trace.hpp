@@ -0,0 +1,52 @@
+#ifndef LINEARHAM_TRACE_
+#define LINEARHAM_TRACE_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "instrumentation.hpp"
+
+/// @file trace.hpp
+/// @brief Headers for recording a timeline of a run as a Chrome trace.
+///
+/// Stages of the pipeline mark themselves with LINEARHAM_TRACE, which costs
+/// one relaxed atomic load unless tracing has been started. While it is on,
+/// each thread records the start and duration of every marked scope into a
+/// ring buffer of its own, so recording takes no locks and a long run keeps
+/// only the most recent events of each thread. WriteTrace then writes
+/// everything in the Chrome trace event format, which chrome://tracing and
+/// Perfetto can show as one timeline per thread.
+
+namespace linearham {
+
+
+void StartTracing(int events_per_thread);
+void StopTracing();
+bool TracingEnabled();
+void WriteTrace(std::ostream& out);
+void WriteTraceFile(const std::string& path);
+
+
+/// @brief Records the time from its construction to its destruction as an
+/// event of the calling thread, if tracing is on when it is constructed.
+class TraceScope {
+ protected:
+  const char* name_;
+  int64_t start_ns_;
+
+ public:
+  explicit TraceScope(const char* name);
+  ~TraceScope();
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+};
+}
+
+
+/// Trace the rest of the enclosing scope under `name`, which must be a string
+/// literal without characters that need escaping in JSON.
+#define LINEARHAM_TRACE(name)                                                \
+  ::linearham::TraceScope LINEARHAM_CONCAT_(linearham_trace_, __LINE__)( \
+      name)
+
+#endif  // LINEARHAM_TRACE_
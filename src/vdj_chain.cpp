@@ -0,0 +1,654 @@
+#include "vdj_chain.hpp"
+
+#include <algorithm>
+#include <limits>
+#include "instrumentation.hpp"
+#include "trace.hpp"
+
+/// @file vdj_chain.cpp
+/// @brief Building and evaluating V(D)J smooshable chains.
+///
+/// A read is modeled as a chain of seven smooshables:
+///
+///     V padding, V, V-D insertion, D, D-J insertion, J, J padding
+///
+/// joined at the boundaries given by the read's boundsbounds windows, so that
+/// the fully smooshed chain is a 1x1 smooshable holding the probability of
+/// the read under one choice of V, D and J genes.
+/// The V padding accounts for the N's that partis puts on the left of V
+/// genes and the J padding for those on the right of J genes.
+/// The D and J smooshables leave out their landing probabilities, since the
+/// preceding insertion smooshable accounts for how we arrive at the gene.
+///
+/// The first two smooshables only depend on the V gene, the next two only on
+/// the D gene and the last three only on the J gene, so when annotating a read
+/// we smoosh each of these pieces once per gene and then join the pieces for
+/// each combination.
+
+namespace linearham {
+
+
+namespace {
+
+const double kNegInf = -std::numeric_limits<double>::infinity();
+
+// log(exp(a) + exp(b)), allowing for -infinity.
+double LogAdd(double a, double b) {
+  if (a == kNegInf) return b;
+  if (b == kNegInf) return a;
+  double max = std::max(a, b);
+  return max + std::log1p(std::exp(std::min(a, b) - max));
+}
+
+// Fill `genes` with the indices, in one of the store's lists of genes sorted
+// by name, of the candidates of a read, skipping those that aren't in the
+// store or have no relpos. The indices come out in order, so that ties
+// between combinations are broken the same way each run.
+template <class GermlinePtr>
+void CandidateGenes(const PartisRead& read,
+                    const std::vector<GermlinePtr>& sorted,
+                    std::vector<int>& genes) {
+  LINEARHAM_TRACE("germline lookup");
+  genes.clear();
+  if (read.only_genes().empty()) {
+    for (size_t i = 0; i < sorted.size(); i++) {
+      if (read.has_relpos(sorted[i]->name())) genes.push_back(i);
+    }
+    return;
+  }
+  for (const std::string& name : read.only_genes()) {
+    auto it = std::lower_bound(
+        sorted.begin(), sorted.end(), name,
+        [](const GermlinePtr& germline, const std::string& name) {
+          return germline->name() < name;
+        });
+    if (it != sorted.end() && (*it)->name() == name && read.has_relpos(name)) {
+      genes.push_back(it - sorted.begin());
+    }
+  }
+  std::sort(genes.begin(), genes.end());
+}
+
+// The pieces of the chain of smooshables that depend on only one gene; see
+// the top of this file. Each is built with matrices from the arena.
+SmooshableChain VPiece(const PartisRead& read, const VGermline& v_germline,
+                       SmooshableArena& arena) {
+  int v_relpos = read.relpos(v_germline.name());
+  FlexWindow v_l = read.window("v_l"), v_r = read.window("v_r");
+  SmooshableVector originals = arena.TakeSmooshableVector(2);
+  originals.push_back(VPaddingSmooshable(v_germline, read, v_l, arena,
+                                         Scaling::kGlobal, SmooshMode::kBoth));
+  originals.push_back(GermlineSmooshable(v_germline, read, v_relpos, v_l, v_r,
+                                         true, arena, Scaling::kGlobal,
+                                         SmooshMode::kBoth));
+  return SmooshableChain(std::move(originals), arena);
+}
+
+SmooshableChain DPiece(const PartisRead& read, const DGermline& d_germline,
+                       SmooshableArena& arena) {
+  int d_relpos = read.relpos(d_germline.name());
+  FlexWindow v_r = read.window("v_r");
+  FlexWindow d_l = read.window("d_l"), d_r = read.window("d_r");
+  SmooshableVector originals = arena.TakeSmooshableVector(2);
+  originals.push_back(NTInsertionSmooshable(d_germline, d_germline, read,
+                                            d_relpos, v_r, d_l, arena,
+                                            Scaling::kGlobal,
+                                            SmooshMode::kBoth));
+  originals.push_back(GermlineSmooshable(d_germline, read, d_relpos, d_l, d_r,
+                                         false, arena, Scaling::kGlobal,
+                                         SmooshMode::kBoth));
+  return SmooshableChain(std::move(originals), arena);
+}
+
+SmooshableChain JPiece(const PartisRead& read, const JGermline& j_germline,
+                       SmooshableArena& arena) {
+  int j_relpos = read.relpos(j_germline.name());
+  FlexWindow d_r = read.window("d_r");
+  FlexWindow j_l = read.window("j_l"), j_r = read.window("j_r");
+  SmooshableVector originals = arena.TakeSmooshableVector(3);
+  originals.push_back(NTInsertionSmooshable(j_germline, j_germline, read,
+                                            j_relpos, d_r, j_l, arena,
+                                            Scaling::kGlobal,
+                                            SmooshMode::kBoth));
+  originals.push_back(GermlineSmooshable(j_germline, read, j_relpos, j_l, j_r,
+                                         false, arena, Scaling::kGlobal,
+                                         SmooshMode::kBoth));
+  originals.push_back(JPaddingSmooshable(j_germline, read, j_relpos, j_r,
+                                         arena, Scaling::kGlobal,
+                                         SmooshMode::kBoth));
+  return SmooshableChain(std::move(originals), arena);
+}
+
+// Give a piece back to the arena, keeping only its fully smooshed matrix.
+Smooshable ReleasePiece(SmooshableChain piece, SmooshableArena& arena) {
+  assert(!piece.smooshed().empty());
+  Smooshable root = std::move(piece.smooshed().back());
+  piece.Release();
+  arena.Give(std::move(piece.originals()));
+  return root;
+}
+
+// The natural log of an entry of a globally scaled smooshable, without the
+// copy of the whole matrix that LogMarginal and LogViterbi make.
+double UnscaledLog(const Smooshable& s, double entry) {
+  assert(s.scaling() == Scaling::kGlobal);
+  return std::log(entry) - s.scaler_count() * std::log(SCALE_FACTOR);
+}
+}
+
+
+/// @brief Build the smooshable for the N padding on the left of a V gene.
+/// @param[in] n_padding
+/// The padding parameters of the V gene.
+/// @param[in] read
+/// The read.
+/// @param[in] v_l
+/// The window of possible V start points.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+/// @return A 1 x `v_l.size()` smooshable.
+///
+/// Every read position before the V start is emitted by the padding state,
+/// each at the cost of a self-transition and an emission. These
+/// probabilities are geometric in the padding length, so each entry costs
+/// the same however long the padding is, and they are worked out as logs so
+/// that long padding doesn't underflow.
+Smooshable VPaddingSmooshable(const NPadding& n_padding,
+                              const PartisRead& read, FlexWindow v_l,
+                              Scaling scaling, SmooshMode mode) {
+  SmooshableArena arena;
+  return VPaddingSmooshable(n_padding, read, v_l, arena, scaling, mode);
+};
+
+
+/// @brief Build the smooshable for the N padding on the left of a V gene,
+/// with matrices from an arena.
+///
+/// Otherwise the same as the overload without an arena.
+Smooshable VPaddingSmooshable(const NPadding& n_padding,
+                              const PartisRead& read, FlexWindow v_l,
+                              SmooshableArena& arena, Scaling scaling,
+                              SmooshMode mode) {
+  LINEARHAM_TRACE("smooshable construction");
+  const Eigen::VectorXi& indices = read.emission_indices();
+  Eigen::MatrixXd log_padding = arena.TakeMatrix(1, v_l.size());
+  log_padding.setConstant(kNegInf);
+  for (int i = 0; i < v_l.size(); i++) {
+    int pad_length = v_l.start + i;
+    if (pad_length < 0 || pad_length > read.length()) continue;
+    log_padding(0, i) = n_padding.LogPaddingProb(indices.head(pad_length));
+  }
+  Smooshable smooshable = SmooshableFromLogs(log_padding, arena, scaling, mode);
+  arena.Give(std::move(log_padding));
+  return smooshable;
+};
+
+
+/// @brief Build the smooshable for the match of a germline gene to a read.
+/// @param[in] germline
+/// The germline gene.
+/// @param[in] read
+/// The read.
+/// @param[in] relpos
+/// The read position of the first base of the germline gene.
+/// @param[in] left
+/// The window of possible start points of the match.
+/// @param[in] right
+/// The window of possible end points of the match.
+/// @param[in] include_landing
+/// Whether to include the probability of landing at the start point.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+/// @return A `left.size()` x `right.size()` smooshable.
+///
+/// The windows are first clipped to the matches that lie within both the
+/// read and the germline gene, and the probabilities of the rest are zero.
+Smooshable GermlineSmooshable(const Germline& germline,
+                              const PartisRead& read, int relpos,
+                              FlexWindow left, FlexWindow right,
+                              bool include_landing, Scaling scaling,
+                              SmooshMode mode) {
+  SmooshableArena arena;
+  return GermlineSmooshable(germline, read, relpos, left, right,
+                            include_landing, arena, scaling, mode);
+};
+
+
+/// @brief Build the smooshable for the match of a germline gene to a read,
+/// with matrices (and the scratch for the match probabilities) from an arena.
+///
+/// Otherwise the same as the overload without an arena.
+Smooshable GermlineSmooshable(const Germline& germline,
+                              const PartisRead& read, int relpos,
+                              FlexWindow left, FlexWindow right,
+                              bool include_landing, SmooshableArena& arena,
+                              Scaling scaling, SmooshMode mode) {
+  LINEARHAM_TRACE("smooshable construction");
+  Eigen::MatrixXd match = arena.TakeMatrix(left.size(), right.size());
+  match.setZero();
+  int first_start = std::max(std::max(left.start, relpos), 0);
+  int first_end = std::max(right.start, first_start + 1);
+  int end_end = std::min(std::min(right.end, relpos + germline.length() + 1),
+                         read.length() + 1);
+  // Matches have to end after they start.
+  int end_start = std::min(left.end, end_end - 1);
+  if (first_start < end_start && first_end < end_end) {
+    int length = end_end - 1 - first_start;
+    Eigen::MatrixXd emission = arena.TakeMatrix(length, 1);
+    Eigen::MatrixXd transition_block =
+        arena.TakeMatrix(end_start - first_start, end_end - first_end);
+    germline.MatchMatrix(
+        first_start - relpos,
+        read.emission_indices().segment(first_start, length),
+        end_start - first_start - 1, end_end - first_end - 1,
+        match.block(first_start - left.start, first_end - right.start,
+                    end_start - first_start, end_end - first_end),
+        include_landing, emission.col(0), transition_block);
+    arena.Give(std::move(emission));
+    arena.Give(std::move(transition_block));
+  }
+  return arena.TakeSmooshable(std::move(match), scaling, mode);
+};
+
+
+/// @brief Build the smooshable for the non-templated insertion before a
+/// germline gene.
+/// @param[in] nt_insertion
+/// The insertion parameters of the gene.
+/// @param[in] germline
+/// The gene.
+/// @param[in] read
+/// The read.
+/// @param[in] relpos
+/// The read position of the first base of the gene.
+/// @param[in] left
+/// The window of possible end points of the previous gene, which are the
+/// start points of the insertion.
+/// @param[in] right
+/// The window of possible start points of the gene.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+/// @return A `left.size()` x `right.size()` smooshable.
+///
+/// An empty insertion lands directly in the gene. Otherwise we land in an
+/// insertion state, emit the inserted bases while moving between insertion
+/// states, and then land in the gene; the marginal sums over insertion state
+/// paths with the forward algorithm and the Viterbi takes the best one.
+///
+/// Insertions with the same start point share their forward (and best path)
+/// vectors: we run the forward algorithm once from each start point out to
+/// the furthest end point, reading off every end point on the way. This
+/// costs one step per start and base rather than one per start, end and
+/// base.
+Smooshable NTInsertionSmooshable(const NTInsertion& nt_insertion,
+                                 const Germline& germline,
+                                 const PartisRead& read, int relpos,
+                                 FlexWindow left, FlexWindow right,
+                                 Scaling scaling, SmooshMode mode) {
+  SmooshableArena arena;
+  return NTInsertionSmooshable(nt_insertion, germline, read, relpos, left,
+                               right, arena, scaling, mode);
+};
+
+
+/// @brief Build the smooshable for the non-templated insertion before a
+/// germline gene, with matrices (and the forward vectors) from an arena.
+///
+/// Otherwise the same as the overload without an arena.
+Smooshable NTInsertionSmooshable(const NTInsertion& nt_insertion,
+                                 const Germline& germline,
+                                 const PartisRead& read, int relpos,
+                                 FlexWindow left, FlexWindow right,
+                                 SmooshableArena& arena, Scaling scaling,
+                                 SmooshMode mode) {
+  LINEARHAM_TRACE("smooshable construction");
+  const Eigen::VectorXi& indices = read.emission_indices();
+  const Eigen::Map<const Eigen::MatrixXd>& emission =
+      nt_insertion.n_emission_matrix();
+  const Eigen::Map<const Eigen::MatrixXd>& transition =
+      nt_insertion.n_transition();
+  const Eigen::Map<const Eigen::MatrixXd>& landing_out =
+      nt_insertion.n_landing_out();
+  Eigen::MatrixXd marginal = arena.TakeMatrix(left.size(), right.size());
+  Eigen::MatrixXd viterbi = arena.TakeMatrix(left.size(), right.size());
+  marginal.setZero();
+  viterbi.setZero();
+  int state_count = transition.rows();
+  // The forward, best path and next vectors are columns of one matrix.
+  Eigen::MatrixXd vectors = arena.TakeMatrix(state_count, 3);
+  Eigen::Ref<Eigen::VectorXd> forward = vectors.col(0), best = vectors.col(1),
+                              next = vectors.col(2);
+
+  // End points have to be in the read and land in the gene.
+  auto valid_end = [&](int end) {
+    int gpos = end - relpos;
+    return end <= read.length() && gpos >= 0 && gpos < germline.length();
+  };
+  int last_end = std::min(right.end - 1, read.length());
+
+  for (int i = 0; i < left.size(); i++) {
+    int start = left.start + i;
+    if (start < 0 || start > last_end) continue;
+    if (start >= right.start && valid_end(start)) {
+      marginal(i, start - right.start) = viterbi(i, start - right.start) =
+          germline.linear_transition().landing()(start - relpos);
+    }
+    // After the step for base t, the vectors hold the insertions covering
+    // bases start through t, which end at t + 1.
+    for (int t = start; t < last_end; t++) {
+      if (t == start) {
+        forward = nt_insertion.n_landing_in().cwiseProduct(
+            emission.row(indices(t)).transpose());
+        best = forward;
+      } else {
+        next.noalias() = transition.transpose() * forward;
+        forward = next.cwiseProduct(emission.row(indices(t)).transpose());
+        next = (transition.array().colwise() * best.array())
+                   .colwise()
+                   .maxCoeff()
+                   .transpose();
+        best = next.cwiseProduct(emission.row(indices(t)).transpose());
+      }
+      int end = t + 1;
+      if (end < right.start || !valid_end(end)) continue;
+      int j = end - right.start;
+      int gpos = end - relpos;
+      marginal(i, j) = forward.dot(landing_out.col(gpos));
+      viterbi(i, j) = best.cwiseProduct(landing_out.col(gpos)).maxCoeff();
+    }
+  }
+  arena.Give(std::move(vectors));
+  return arena.TakeSmooshable(std::move(marginal), std::move(viterbi), scaling,
+                              mode);
+};
+
+
+/// @brief Build the smooshable for the N padding on the right of a J gene.
+/// @param[in] j_germline
+/// The J gene.
+/// @param[in] read
+/// The read.
+/// @param[in] relpos
+/// The read position of the first base of the J gene.
+/// @param[in] j_r
+/// The window of possible J end points.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+/// @return A `j_r.size()` x 1 smooshable.
+///
+/// Padding can only follow the last base of the J gene, which either goes on
+/// to the padding state or ends the read; matches ending anywhere else must
+/// end with the read. As for VPaddingSmooshable, the padding probabilities
+/// are geometric and worked out as logs.
+Smooshable JPaddingSmooshable(const JGermline& j_germline,
+                              const PartisRead& read, int relpos,
+                              FlexWindow j_r, Scaling scaling,
+                              SmooshMode mode) {
+  SmooshableArena arena;
+  return JPaddingSmooshable(j_germline, read, relpos, j_r, arena, scaling,
+                            mode);
+};
+
+
+/// @brief Build the smooshable for the N padding on the right of a J gene,
+/// with matrices from an arena.
+///
+/// Otherwise the same as the overload without an arena.
+Smooshable JPaddingSmooshable(const JGermline& j_germline,
+                              const PartisRead& read, int relpos,
+                              FlexWindow j_r, SmooshableArena& arena,
+                              Scaling scaling, SmooshMode mode) {
+  LINEARHAM_TRACE("smooshable construction");
+  const Eigen::VectorXi& indices = read.emission_indices();
+  double log_exit_prob = std::log(1. - j_germline.n_self_transition_prob());
+  Eigen::MatrixXd log_padding = arena.TakeMatrix(j_r.size(), 1);
+  log_padding.setConstant(kNegInf);
+  for (int i = 0; i < j_r.size(); i++) {
+    int end = j_r.start + i;
+    if (end > read.length()) continue;
+    if (end - relpos != j_germline.length()) {
+      if (end == read.length()) log_padding(i, 0) = 0.;
+      continue;
+    }
+    log_padding(i, 0) =
+        log_exit_prob +
+        j_germline.LogPaddingProb(indices.segment(end, read.length() - end));
+  }
+  Smooshable smooshable = SmooshableFromLogs(log_padding, arena, scaling, mode);
+  arena.Give(std::move(log_padding));
+  return smooshable;
+};
+
+
+/// @brief Build the chain of smooshables for a read and a choice of genes.
+/// @param[in] read
+/// The read.
+/// @param[in] v_germline
+/// The V gene.
+/// @param[in] d_germline
+/// The D gene.
+/// @param[in] j_germline
+/// The J gene.
+/// @param[in] scaling
+/// How to guard against underflow; see Scaling.
+/// @param[in] mode
+/// Which quantities to store; see SmooshMode.
+/// @return The seven smooshables described at the top of this file.
+SmooshableVector VDJSmooshables(const PartisRead& read,
+                                const VGermline& v_germline,
+                                const DGermline& d_germline,
+                                const JGermline& j_germline,
+                                Scaling scaling, SmooshMode mode) {
+  int v_relpos = read.relpos(v_germline.name());
+  int d_relpos = read.relpos(d_germline.name());
+  int j_relpos = read.relpos(j_germline.name());
+  FlexWindow v_l = read.window("v_l"), v_r = read.window("v_r");
+  FlexWindow d_l = read.window("d_l"), d_r = read.window("d_r");
+  FlexWindow j_l = read.window("j_l"), j_r = read.window("j_r");
+
+  SmooshableVector smooshables;
+  smooshables.reserve(7);
+  smooshables.push_back(
+      VPaddingSmooshable(v_germline, read, v_l, scaling, mode));
+  smooshables.push_back(GermlineSmooshable(v_germline, read, v_relpos, v_l,
+                                           v_r, true, scaling, mode));
+  smooshables.push_back(NTInsertionSmooshable(
+      d_germline, d_germline, read, d_relpos, v_r, d_l, scaling, mode));
+  smooshables.push_back(GermlineSmooshable(d_germline, read, d_relpos, d_l,
+                                           d_r, false, scaling, mode));
+  smooshables.push_back(NTInsertionSmooshable(
+      j_germline, j_germline, read, j_relpos, d_r, j_l, scaling, mode));
+  smooshables.push_back(GermlineSmooshable(j_germline, read, j_relpos, j_l,
+                                           j_r, false, scaling, mode));
+  smooshables.push_back(
+      JPaddingSmooshable(j_germline, read, j_relpos, j_r, scaling, mode));
+  return smooshables;
+};
+
+
+/// @brief Annotate a read using every combination of its candidate genes.
+/// @param[in] read
+/// The read.
+/// @param[in] store
+/// Where to find the genes.
+/// @return The annotation.
+///
+/// Candidate genes that are missing from the store (or from the read's
+/// relpos) are skipped. Each combination is weighted by the product of its
+/// gene probabilities.
+ReadAnnotation AnnotateRead(const PartisRead& read,
+                            const GermlineStore& store) {
+  SmooshableArena arena;
+  return AnnotateRead(read, store, arena, nullptr);
+};
+
+
+/// @brief Annotate a read, smooshing with matrices from an arena.
+/// @param[in] read
+/// The read.
+/// @param[in] store
+/// Where to find the genes.
+/// @param[in] arena
+/// Where to take scratch matrices from. Everything taken is given back, so
+/// a worker thread can keep one arena for all of its reads.
+/// @return The annotation.
+ReadAnnotation AnnotateRead(const PartisRead& read, const GermlineStore& store,
+                            SmooshableArena& arena) {
+  return AnnotateRead(read, store, arena, nullptr);
+};
+
+
+/// @brief Annotate a read, also recording the probability of each gene
+/// combination.
+/// @param[in] read
+/// The read.
+/// @param[in] store
+/// Where to find the genes.
+/// @param[in] arena
+/// Where to take scratch matrices from.
+/// @param[out] combinations
+/// If not null, filled with one entry per combination of candidate genes, in
+/// the order V, then D, then J.
+/// @return The annotation.
+///
+/// The V, D and J pieces of the chain are smooshed once per gene. Each V
+/// piece is then smooshed with each D piece, and the resulting 1 x |d_r|
+/// smooshable is joined with each J piece by a 1 x 1 smoosh, so the work is
+/// O(V * D) smooshes plus O(V * D * J) dot products rather than O(V * D * J)
+/// full chains. Only the fully smooshed matrix of each piece is kept, so the
+/// pieces of the best combination are smooshed again to unwind its Viterbi
+/// path. Every matrix and vector comes from the arena and goes back to it,
+/// so once the arena has seen a read of the same shape nothing is allocated
+/// (bar the combinations, if asked for).
+ReadAnnotation AnnotateRead(const PartisRead& read, const GermlineStore& store,
+                            SmooshableArena& arena,
+                            std::vector<GeneCombination>* combinations) {
+  ReadAnnotation annotation;
+  annotation.name = read.name();
+  annotation.log_likelihood = annotation.log_viterbi = kNegInf;
+  annotation.v_start = annotation.v_end = annotation.d_start =
+      annotation.d_end = annotation.j_start = annotation.j_end = -1;
+  if (combinations != nullptr) combinations->clear();
+  LINEARHAM_COUNT(kReadsAnnotated, 1);
+  LINEARHAM_TRACE("annotate read");
+
+  const std::vector<VGermlinePtr>& v_germlines = store.sorted_v_germlines();
+  const std::vector<DGermlinePtr>& d_germlines = store.sorted_d_germlines();
+  const std::vector<JGermlinePtr>& j_germlines = store.sorted_j_germlines();
+  std::vector<int> v_genes = arena.TakeIntVector(v_germlines.size());
+  std::vector<int> d_genes = arena.TakeIntVector(d_germlines.size());
+  std::vector<int> j_genes = arena.TakeIntVector(j_germlines.size());
+  CandidateGenes(read, v_germlines, v_genes);
+  CandidateGenes(read, d_germlines, d_genes);
+  CandidateGenes(read, j_germlines, j_genes);
+  // Only the fully smooshed matrix of each piece is kept.
+  SmooshableVector v_pieces = arena.TakeSmooshableVector(v_genes.size());
+  SmooshableVector d_pieces = arena.TakeSmooshableVector(d_genes.size());
+  SmooshableVector j_pieces = arena.TakeSmooshableVector(j_genes.size());
+  for (int v : v_genes) {
+    v_pieces.push_back(
+        ReleasePiece(VPiece(read, *v_germlines[v], arena), arena));
+  }
+  for (int d : d_genes) {
+    d_pieces.push_back(
+        ReleasePiece(DPiece(read, *d_germlines[d], arena), arena));
+  }
+  for (int j : j_genes) {
+    j_pieces.push_back(
+        ReleasePiece(JPiece(read, *j_germlines[j], arena), arena));
+  }
+
+  int d_r_size = read.window("d_r").size();
+  Smooshable vd =
+      arena.TakeSmooshable(0, d_r_size - 1, Scaling::kGlobal, SmooshMode::kBoth);
+  Eigen::MatrixXi vd_idx = arena.TakeIndexMatrix(1, d_r_size);
+  Smooshable vdj =
+      arena.TakeSmooshable(0, 0, Scaling::kGlobal, SmooshMode::kBoth);
+  Eigen::MatrixXi vdj_idx = arena.TakeIndexMatrix(1, 1);
+  // The best combination, and where its Viterbi path crosses v_r and d_r.
+  int best_v = -1, best_d = -1, best_j = -1, best_v_r = -1, best_d_r = -1;
+
+  for (size_t v = 0; v < v_genes.size(); v++) {
+    LINEARHAM_TRACE("combination smooshing");
+    const VGermline& v_germline = *v_germlines[v_genes[v]];
+    for (size_t d = 0; d < d_genes.size(); d++) {
+      const DGermline& d_germline = *d_germlines[d_genes[d]];
+      Smoosh(v_pieces[v], d_pieces[d], vd, vd_idx);
+      for (size_t j = 0; j < j_genes.size(); j++) {
+        const JGermline& j_germline = *j_germlines[j_genes[j]];
+        Smoosh(vd, j_pieces[j], vdj, vdj_idx);
+        double log_prior = std::log(v_germline.gene_prob()) +
+                           std::log(d_germline.gene_prob()) +
+                           std::log(j_germline.gene_prob());
+        double log_likelihood =
+            UnscaledLog(vdj, vdj.marginal()(0, 0)) + log_prior;
+        annotation.log_likelihood =
+            LogAdd(annotation.log_likelihood, log_likelihood);
+        if (combinations != nullptr) {
+          combinations->push_back({v_germline.name(), d_germline.name(),
+                                   j_germline.name(), log_likelihood});
+        }
+        double log_viterbi = UnscaledLog(vdj, vdj.viterbi()(0, 0)) + log_prior;
+        if (log_viterbi > annotation.log_viterbi) {
+          annotation.log_viterbi = log_viterbi;
+          best_v = v;
+          best_d = d;
+          best_j = j;
+          best_d_r = vdj_idx(0, 0);
+          best_v_r = vd_idx(0, best_d_r);
+        }
+      }
+    }
+  }
+
+  if (best_v >= 0) {
+    LINEARHAM_TRACE("Viterbi unwinding");
+    const VGermline& v_germline = *v_germlines[v_genes[best_v]];
+    const DGermline& d_germline = *d_germlines[d_genes[best_d]];
+    const JGermline& j_germline = *j_germlines[j_genes[best_j]];
+    annotation.v_gene = v_germline.name();
+    annotation.d_gene = d_germline.name();
+    annotation.j_gene = j_germline.name();
+    // The pieces of the best combination are smooshed again, and each
+    // piece's Viterbi path gives the indices at which the best path crosses
+    // the junctions inside it, within the corresponding boundsbounds
+    // windows.
+    SmooshableChain v_piece = VPiece(read, v_germline, arena);
+    SmooshableChain d_piece = DPiece(read, d_germline, arena);
+    SmooshableChain j_piece = JPiece(read, j_germline, arena);
+    int v_l, d_l, j_lr[2];
+    v_piece.ViterbiPath(0, best_v_r, &v_l);
+    d_piece.ViterbiPath(best_v_r, best_d_r, &d_l);
+    j_piece.ViterbiPath(best_d_r, 0, j_lr);
+    annotation.v_start = read.window("v_l").start + v_l;
+    annotation.v_end = read.window("v_r").start + best_v_r;
+    annotation.d_start = read.window("d_l").start + d_l;
+    annotation.d_end = read.window("d_r").start + best_d_r;
+    annotation.j_start = read.window("j_l").start + j_lr[0];
+    annotation.j_end = read.window("j_r").start + j_lr[1];
+    arena.Give(ReleasePiece(std::move(v_piece), arena));
+    arena.Give(ReleasePiece(std::move(d_piece), arena));
+    arena.Give(ReleasePiece(std::move(j_piece), arena));
+  }
+
+  arena.Give(std::move(vd));
+  arena.Give(std::move(vd_idx));
+  arena.Give(std::move(vdj));
+  arena.Give(std::move(vdj_idx));
+  arena.Give(std::move(v_pieces));
+  arena.Give(std::move(d_pieces));
+  arena.Give(std::move(j_pieces));
+  arena.Give(std::move(v_genes));
+  arena.Give(std::move(d_genes));
+  arena.Give(std::move(j_genes));
+  return annotation;
+};
+}
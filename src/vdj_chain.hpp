@@ -0,0 +1,102 @@
+#ifndef LINEARHAM_VDJ_CHAIN_
+#define LINEARHAM_VDJ_CHAIN_
+
+#include "germline_store.hpp"
+#include "partis_read.hpp"
+#include "smooshable_chain.hpp"
+
+/// @file vdj_chain.hpp
+/// @brief Headers for building and evaluating V(D)J smooshable chains.
+
+namespace linearham {
+
+
+/// @brief The result of annotating a read.
+///
+/// The boundaries are read positions, with each end one past the last
+/// position of its gene. Boundaries and genes are those of the Viterbi path
+/// of the best gene combination; if no combination can produce the read, the
+/// gene names are empty and both log probabilities are -infinity.
+struct ReadAnnotation {
+  std::string name;
+  // The log probability of the read, summed over gene combinations.
+  double log_likelihood;
+  // The log probability of the best path.
+  double log_viterbi;
+  std::string v_gene, d_gene, j_gene;
+  int v_start, v_end, d_start, d_end, j_start, j_end;
+};
+
+
+/// @brief The probability of a read under one combination of genes.
+struct GeneCombination {
+  std::string v_gene, d_gene, j_gene;
+  // The log of the joint probability of the read and the genes, so that
+  // these sum (in log space) to the log likelihood of the annotation.
+  double log_likelihood;
+};
+
+
+Smooshable VPaddingSmooshable(const NPadding& n_padding,
+                              const PartisRead& read, FlexWindow v_l,
+                              Scaling scaling, SmooshMode mode);
+
+Smooshable VPaddingSmooshable(const NPadding& n_padding,
+                              const PartisRead& read, FlexWindow v_l,
+                              SmooshableArena& arena, Scaling scaling,
+                              SmooshMode mode);
+
+Smooshable GermlineSmooshable(const Germline& germline,
+                              const PartisRead& read, int relpos,
+                              FlexWindow left, FlexWindow right,
+                              bool include_landing, Scaling scaling,
+                              SmooshMode mode);
+
+Smooshable GermlineSmooshable(const Germline& germline,
+                              const PartisRead& read, int relpos,
+                              FlexWindow left, FlexWindow right,
+                              bool include_landing, SmooshableArena& arena,
+                              Scaling scaling, SmooshMode mode);
+
+Smooshable NTInsertionSmooshable(const NTInsertion& nt_insertion,
+                                 const Germline& germline,
+                                 const PartisRead& read, int relpos,
+                                 FlexWindow left, FlexWindow right,
+                                 Scaling scaling, SmooshMode mode);
+
+Smooshable NTInsertionSmooshable(const NTInsertion& nt_insertion,
+                                 const Germline& germline,
+                                 const PartisRead& read, int relpos,
+                                 FlexWindow left, FlexWindow right,
+                                 SmooshableArena& arena, Scaling scaling,
+                                 SmooshMode mode);
+
+Smooshable JPaddingSmooshable(const JGermline& j_germline,
+                              const PartisRead& read, int relpos,
+                              FlexWindow j_r, Scaling scaling,
+                              SmooshMode mode);
+
+Smooshable JPaddingSmooshable(const JGermline& j_germline,
+                              const PartisRead& read, int relpos,
+                              FlexWindow j_r, SmooshableArena& arena,
+                              Scaling scaling, SmooshMode mode);
+
+SmooshableVector VDJSmooshables(const PartisRead& read,
+                                const VGermline& v_germline,
+                                const DGermline& d_germline,
+                                const JGermline& j_germline,
+                                Scaling scaling = Scaling::kGlobal,
+                                SmooshMode mode = SmooshMode::kBoth);
+
+ReadAnnotation AnnotateRead(const PartisRead& read,
+                            const GermlineStore& store);
+
+ReadAnnotation AnnotateRead(const PartisRead& read, const GermlineStore& store,
+                            SmooshableArena& arena);
+
+ReadAnnotation AnnotateRead(const PartisRead& read, const GermlineStore& store,
+                            SmooshableArena& arena,
+                            std::vector<GeneCombination>* combinations);
+}
+
+#endif  // LINEARHAM_VDJ_CHAIN_
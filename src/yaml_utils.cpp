@@ -35,6 +35,29 @@ bool is_equal_string_vecs(std::vector<std::string> vec1,
 };
 
 
+/// @brief Do two YAML maps from strings to probabilities agree?
+/// @param[in] node1
+/// A YAML map node.
+/// @param[in] node2
+/// A YAML map node.
+/// @return
+/// If they have the same keys and their probabilities agree to within
+/// EPS_PARSE.
+bool is_equal_prob_maps(YAML::Node node1, YAML::Node node2) {
+  std::map<std::string, double> map1 =
+      node1.as<std::map<std::string, double>>();
+  std::map<std::string, double> map2 =
+      node2.as<std::map<std::string, double>>();
+  if (map1.size() != map2.size()) return false;
+  for (auto it1 = map1.begin(), it2 = map2.begin(); it1 != map1.end();
+       ++it1, ++it2) {
+    if (it1->first != it2->first) return false;
+    if (fabs(it1->second - it2->second) > EPS_PARSE) return false;
+  }
+  return true;
+};
+
+
 /// @brief Parse a YAML map from strings to probabilities.
 /// @param[in] node
 /// A YAML map node.
@@ -118,4 +141,42 @@ std::pair<int, int> find_germline_start_end(YAML::Node root,
 
   return std::make_pair(gstart, gend);
 };
+
+
+/// @brief Get the gene name of a germline YAML file, in the form used by
+/// partis CSV files.
+/// @param[in] root
+/// A YAML root node.
+/// @return
+/// The gene name.
+///
+/// The HMM YAML files spell the allele separator "*" as "_star_", e.g.
+/// IGHV1-2_star_04 is the YAML name of IGHV1-2*04.
+std::string get_gene_name(YAML::Node root) {
+  std::string gname = root["name"].as<std::string>();
+  const std::string star = "_star_";
+  std::string::size_type pos = gname.find(star);
+  if (pos != std::string::npos) gname.replace(pos, star.size(), "*");
+  return gname;
+};
+
+
+/// @brief Figure out whether a germline YAML file describes a V, D or J gene.
+/// @param[in] root
+/// A YAML root node.
+/// @return
+/// One of 'V', 'D' or 'J'.
+///
+/// We go by the insert states, which is what determines which of VGermline,
+/// DGermline and JGermline can be built from the file: V genes have an
+/// "insert_left_N" padding state, J genes have an "insert_right_N" padding
+/// state, and D genes have neither.
+char get_germline_type(YAML::Node root) {
+  int gstart, gend;
+  std::tie(gstart, gend) =
+      find_germline_start_end(root, root["name"].as<std::string>());
+  if (gstart == 2) return 'V';
+  if (gend == (root["states"].size() - 2)) return 'J';
+  return 'D';
+};
 }
@@ -13,6 +13,8 @@ YAML::Node get_yaml_root(std::string yaml_path);
 bool is_equal_string_vecs(std::vector<std::string> vec1,
                           std::vector<std::string> vec2);
 
+bool is_equal_prob_maps(YAML::Node node1, YAML::Node node2);
+
 std::pair<std::vector<std::string>, Eigen::VectorXd> parse_string_prob_map(
     YAML::Node node);
 
@@ -23,6 +25,10 @@ std::pair<std::regex, std::regex> get_regex(std::string gname,
                                             std::vector<std::string> alphabet);
 
 std::pair<int, int> find_germline_start_end(YAML::Node root, std::string gname);
+
+std::string get_gene_name(YAML::Node root);
+
+char get_germline_type(YAML::Node root);
 }
 
 #endif  // LINEARHAM_YAML_UTILS_
@@ -0,0 +1,18 @@
+// Global operator new and delete that count heap allocations, so that a test
+// can check that a hot path makes none. They live apart from the tests so
+// that they aren't inlined into Catch and the standard library.
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+std::atomic<long> operator_new_count(0);
+
+void* operator new(std::size_t size) {
+  operator_new_count++;
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
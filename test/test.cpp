@@ -2,9 +2,26 @@
 #define CATCH_CONFIG_MAIN
 
 #include "catch.hpp"
+#include "fixed_smooshable.hpp"
+#include "germline_file.hpp"
+#include "instrumentation.hpp"
+#include "smooshable_batch.hpp"
+#include "smooshable_cache.hpp"
 #include "smooshable_chain.hpp"
+#include "trace.hpp"
+#include "vdj_chain.hpp"
 #include "../lib/fast-cpp-csv-parser/csv.h"
 
+#include <atomic>
+#include <cstring>
+#include <fstream>
+
+
+// The number of calls to operator new (see allocation_count.cpp), so that a
+// test can check that a hot path makes none. Eigen allocates with malloc
+// instead, which EIGEN_RUNTIME_NO_MALLOC (see SConstruct) lets us forbid.
+extern std::atomic<long> operator_new_count;
+
 
 namespace linearham {
 
@@ -61,6 +78,26 @@ TEST_CASE("SubProductMatrix", "[linalg]") {
 }
 
 
+TEST_CASE("SubProductBlock", "[linalg]") {
+  Eigen::VectorXd e(6);
+  e << 2.5, -1, 2, 0.5, 3, -0.25;
+  Eigen::MatrixXd full(6,6);
+  SubProductMatrix(e, full);
+  for (int row = 0; row < 6; row++) {
+    for (int col = 0; col < 6; col++) {
+      for (int height = 1; row + height <= 6; height++) {
+        for (int width = 1; col + width <= 6; width++) {
+          Eigen::MatrixXd A(height, width);
+          A.setConstant(999);
+          SubProductBlock(e, row, col, A);
+          REQUIRE(A.isApprox(full.block(row, col, height, width)));
+        }
+      }
+    }
+  }
+}
+
+
 TEST_CASE("VectorByIndices", "[linalg]") {
   Eigen::VectorXd b(4), correct_b(4);
   Eigen::MatrixXd A(3,4);
@@ -104,6 +141,86 @@ TEST_CASE("BinaryMax", "[linalg]") {
 }
 
 
+TEST_CASE("BinaryMax agrees with naive max-product", "[linalg]") {
+  // Sizes chosen to exercise both the SIMD tiles and the leftover rows and
+  // columns. Entries come from a small set so that there are lots of ties.
+  std::srand(1);
+  for (int m : {1, 3, 4, 7, 70}) {
+    for (int n : {1, 2, 5}) {
+      for (int p : {1, 4, 6}) {
+        Eigen::MatrixXd A(m, n), B(n, p);
+        for (int i = 0; i < A.size(); i++) A(i) = std::rand() % 4;
+        for (int i = 0; i < B.size(); i++) B(i) = std::rand() % 4;
+        Eigen::MatrixXd C(m, p), correct_C(m, p);
+        Eigen::MatrixXi C_idx(m, p), correct_C_idx(m, p);
+        for (int i = 0; i < m; i++) {
+          for (int k = 0; k < p; k++) {
+            Eigen::VectorXd util =
+                A.row(i).transpose().cwiseProduct(B.col(k));
+            correct_C(i, k) = util.maxCoeff(&correct_C_idx(i, k));
+          }
+        }
+        BinaryMax(A, B, C, C_idx);
+        REQUIRE(C == correct_C);
+        REQUIRE(C_idx == correct_C_idx);
+      }
+    }
+  }
+}
+
+
+TEST_CASE("MaxPlusProduct", "[linalg]") {
+  Eigen::MatrixXd A(2,3);
+  A <<
+  0.50, 0.71, 0.13,
+  0.29, 0.31, 0.37;
+  Eigen::MatrixXd B(3,2);
+  B <<
+  0.30, 0.37,
+  0.29, 0.41,
+  0.11, 0.97;
+  Eigen::MatrixXd C(2,2), correct_C(2,2);
+  Eigen::MatrixXi C_idx(2,2), correct_C_idx(2,2);
+  BinaryMax(A, B, correct_C, correct_C_idx);
+  Eigen::MatrixXd log_A = A.array().log(), log_B = B.array().log();
+  MaxPlusProduct(log_A, log_B, C, C_idx);
+  REQUIRE(C.array().exp().matrix().isApprox(correct_C));
+  REQUIRE(C_idx == correct_C_idx);
+}
+
+
+TEST_CASE("LogSumExpProduct", "[linalg]") {
+  Eigen::MatrixXd A(2,3);
+  A <<
+  0.50, 0.71, 0.13,
+  0,    0,    0;
+  Eigen::MatrixXd B(3,2);
+  B <<
+  0.30, 0.37,
+  0.29, 0.41,
+  0.11, 0.97;
+  Eigen::MatrixXd C(2,2);
+  Eigen::MatrixXd log_A = A.array().log(), log_B = B.array().log();
+  LogSumExpProduct(log_A, log_B, C);
+  REQUIRE(C.array().exp().matrix().isApprox(A * B));
+  // A row of zero probabilities stays at log(0).
+  REQUIRE(C(1, 0) == -std::numeric_limits<double>::infinity());
+
+  // Entries far beyond the range of doubles, where the maxima of the row of A
+  // and the column of B don't line up.
+  log_A <<
+  0,     -2000, -1,
+  -3000, -3001, -3002;
+  log_B <<
+  -2000, 0,
+  0,     -1,
+  -1000, 0;
+  LogSumExpProduct(log_A, log_B, C);
+  REQUIRE(C(0, 0) == Approx(-1001));
+  REQUIRE(C(1, 1) == Approx(-3000 + std::log(1 + 2 * std::exp(-2.))));
+}
+
+
 // Core tests
 
 TEST_CASE("BuildTransition", "[core]") {
@@ -124,6 +241,30 @@ TEST_CASE("BuildTransition", "[core]") {
 }
 
 
+TEST_CASE("LinearTransition", "[core]") {
+  Eigen::VectorXd landing(5);
+  landing << 0.13, 0.17, 0.19, 0.23, 0.29;
+  Eigen::VectorXd next_transition(4);
+  next_transition << 0.2, 0.3, 0, 0.9;
+  Eigen::MatrixXd correct_transition = BuildTransition(landing, next_transition);
+
+  LinearTransition transition(landing, next_transition);
+  REQUIRE(transition.length() == 5);
+  REQUIRE(transition.Dense().isApprox(correct_transition));
+  for (int i = 0; i < 5; i++) {
+    for (int j = 0; j < 5; j++) {
+      REQUIRE(transition(i, j) == Approx(correct_transition(i, j)));
+    }
+  }
+  Eigen::MatrixXd block(2,3);
+  transition.Block(1, 2, block);
+  REQUIRE(block.isApprox(correct_transition.block(1, 2, 2, 3)));
+  // Matches can't pass through the zero transition out of state 2.
+  REQUIRE(transition(1, 3) == 0);
+  REQUIRE(transition(3, 4) > 0);
+}
+
+
 TEST_CASE("BuildMatch", "[core]") {
   Eigen::VectorXd landing(3);
   landing << 0.13, 0.17, 0.19;
@@ -177,6 +318,34 @@ TEST_CASE("Germline", "[germline]") {
   Eigen::MatrixXd transition;
   germline.MatchMatrix(1, emission_indices, 1, 1, match);
   REQUIRE(match.isApprox(correct_match));
+
+  // The flex block agrees with cutting down the full match matrix.
+  Eigen::VectorXd long_landing(6);
+  long_landing << 0.13, 0.17, 0.19, 0.23, 0.29, 0.31;
+  Eigen::MatrixXd long_emission_matrix(2,6);
+  long_emission_matrix <<
+  0.5,  0.71, 0.11, 0.6, 0.2, 0.9,
+  0.29, 0.31, 0.37, 0.4, 0.8, 0.1;
+  Eigen::VectorXd long_next_transition(5);
+  long_next_transition << 0.2, 0.3, 0.9, 0.8, 0.5;
+  Germline long_germline(long_landing, long_emission_matrix,
+                         long_next_transition);
+  Eigen::VectorXi long_emission_indices(4);
+  long_emission_indices << 1, 0, 0, 1;
+  Eigen::VectorXd long_emission(4);
+  long_germline.EmissionVector(long_emission_indices, 1, long_emission);
+  Eigen::MatrixXd full_match(4,4);
+  BuildMatchMatrix(long_germline.transition().block(1, 1, 4, 4),
+                   long_emission, full_match);
+  for (int left_flex = 0; left_flex < 4; left_flex++) {
+    for (int right_flex = 0; right_flex < 4; right_flex++) {
+      Eigen::MatrixXd flex_match(left_flex + 1, right_flex + 1);
+      long_germline.MatchMatrix(1, long_emission_indices, left_flex,
+                                right_flex, flex_match);
+      REQUIRE(flex_match.isApprox(full_match.block(
+          0, 3 - right_flex, left_flex + 1, right_flex + 1)));
+    }
+  }
 }
 
 
@@ -237,15 +406,539 @@ TEST_CASE("Smooshable", "[smooshable]") {
 
   SmooshableVector sv = {s_A, s_B, s_C};
   SmooshableChain chain = SmooshableChain(sv);
-  IntVectorVector correct_viterbi_paths = {{1,0}, {2,1}};
+  Eigen::MatrixXi correct_viterbi_paths(2,2);
+  correct_viterbi_paths <<
+  1,0,
+  2,1;
   REQUIRE(chain.smooshed()[0].viterbi() == correct_AB_viterbi);
   REQUIRE(chain.smooshed().back().viterbi() == correct_ABC_viterbi);
-  REQUIRE(chain.viterbi_paths() == correct_viterbi_paths);
+  REQUIRE(chain.viterbi_paths().ToMatrix() == correct_viterbi_paths);
+  REQUIRE(chain.viterbi_paths().width() == 1);
+  REQUIRE(chain.viterbi_paths().Row(1) == std::vector<int>({2,1}));
+
+  // 0.71*0.29*0.89 is the best entry, and its path is {1,0}.
+  int row, col;
+  chain.BestViterbiCell(&row, &col);
+  REQUIRE(row == 0);
+  REQUIRE(col == 0);
+  std::vector<int> path(chain.path_length());
+  chain.ViterbiPath(1, 0, path.data());
+  REQUIRE(path == chain.viterbi_paths().Row(1));
+  chain.ViterbiPath(row, col, path.data());
+  REQUIRE(path == chain.viterbi_paths().Row(0));
+}
+
+
+TEST_CASE("Log-space Smooshable", "[smooshable]") {
+  Eigen::MatrixXd A(2,3);
+  A <<
+  0.5, 0.71, 0.13,
+  0.29, 0.31, 0.37;
+  Eigen::MatrixXd B(3,2);
+  B <<
+  0.3,  0.37,
+  0.29, 0.41,
+  0.11, 0.97;
+  Eigen::MatrixXd C(2,1);
+  C <<
+  0.89,
+  0.43;
+
+  Smooshable s_A = Smooshable(A, Scaling::kLog);
+  Smooshable s_B = Smooshable(B, Scaling::kLog);
+  Smooshable s_C = Smooshable(C, Scaling::kLog);
+  REQUIRE(s_A.scaling() == Scaling::kLog);
+  REQUIRE(s_A.marginal().isApprox(A.array().log().matrix()));
+
+  Smooshable s_AB;
+  Eigen::MatrixXi AB_viterbi_idx;
+  std::tie(s_AB, AB_viterbi_idx) = Smoosh(s_A, s_B);
+  Eigen::MatrixXd correct_AB_viterbi(2,2);
+  correct_AB_viterbi <<
+  0.71*0.29, 0.71*0.41,
+  0.31*0.29, 0.37*0.97;
+  Eigen::MatrixXi correct_AB_viterbi_idx(2,2);
+  correct_AB_viterbi_idx <<
+  1,1,
+  1,2;
+  REQUIRE(s_AB.LogMarginal().array().exp().matrix().isApprox(A * B));
+  REQUIRE(s_AB.LogViterbi().array().exp().matrix().isApprox(correct_AB_viterbi));
+  REQUIRE(AB_viterbi_idx == correct_AB_viterbi_idx);
+  REQUIRE(s_AB.scaler_count() == 0);
+
+  SmooshableVector sv = {s_A, s_B, s_C};
+  SmooshableChain chain = SmooshableChain(sv);
+  Eigen::MatrixXi correct_viterbi_paths(2,2);
+  correct_viterbi_paths <<
+  1,0,
+  2,1;
+  REQUIRE(chain.viterbi_paths().ToMatrix() == correct_viterbi_paths);
+
+  // Log space and global scaling agree on something that needs rescaling.
+  Eigen::VectorXd landing(3);
+  landing << 1, 1, 1;
+  landing.array() *= SCALE_THRESHOLD * SCALE_THRESHOLD;
+  Eigen::MatrixXd emission_matrix(2,3);
+  emission_matrix <<
+  0.11, 0.13, 0.17,
+  0.89, 0.87, 0.83;
+  Eigen::VectorXd next_transition(2);
+  next_transition << 0.5, 0.25;
+  Germline germline(landing, emission_matrix, next_transition);
+  Eigen::VectorXi emission_indices(3);
+  emission_indices << 1, 0, 0;
+  SmooshableGermline s_global(germline, 0, emission_indices, 1, 1);
+  SmooshableGermline s_log(germline, 0, emission_indices, 1, 1,
+                           Scaling::kLog);
+  REQUIRE(s_global.scaler_count() == 2);
+  REQUIRE(s_log.scaler_count() == 0);
+  REQUIRE(s_log.LogMarginal().isApprox(s_global.LogMarginal()));
+  REQUIRE(s_log.LogViterbi().isApprox(s_global.LogViterbi()));
+}
+
+
+TEST_CASE("Per-row and per-column scaling", "[smooshable]") {
+  // The second row of A and the first column of B are far smaller than the
+  // rest, so their product underflows unless they are scaled separately.
+  Eigen::MatrixXd A(2,2);
+  A <<
+  0.5, 0.5,
+  1e-200, 2e-200;
+  Eigen::MatrixXd B(2,3);
+  B <<
+  1e-200, 0.3, 0.1,
+  1e-200, 0.4, 0.7;
+  Smooshable s_A(A, Scaling::kRowCol), s_B(B, Scaling::kRowCol);
+  Eigen::VectorXi correct_A_row_counts(2), correct_B_col_counts(3);
+  correct_A_row_counts << 0, 2;
+  correct_B_col_counts << 2, 0, 0;
+  REQUIRE(s_A.row_scaler_counts() == correct_A_row_counts);
+  REQUIRE(s_A.col_scaler_counts() == Eigen::VectorXi::Zero(2));
+  REQUIRE(s_B.row_scaler_counts() == Eigen::VectorXi::Zero(2));
+  REQUIRE(s_B.col_scaler_counts() == correct_B_col_counts);
+  REQUIRE(s_A.scaler_count() == 0);
+  REQUIRE(s_A.LogMarginal().isApprox(A.array().log().matrix()));
+
+  Smooshable s_AB, s_log_AB;
+  Eigen::MatrixXi AB_viterbi_idx, log_AB_viterbi_idx;
+  std::tie(s_AB, AB_viterbi_idx) = Smoosh(s_A, s_B);
+  std::tie(s_log_AB, log_AB_viterbi_idx) =
+      Smoosh(Smooshable(A, Scaling::kLog), Smooshable(B, Scaling::kLog));
+  REQUIRE(std::isfinite(s_AB.LogMarginal()(1, 0)));
+  REQUIRE(s_AB.LogMarginal().isApprox(s_log_AB.LogMarginal()));
+  REQUIRE(s_AB.LogViterbi().isApprox(s_log_AB.LogViterbi()));
+  REQUIRE(AB_viterbi_idx == log_AB_viterbi_idx);
+
+  // Unequal scaler counts on the common segment are folded into the product.
+  Eigen::MatrixXd C(3,2);
+  C <<
+  1e-250, 0.2,
+  1e-250, 0.9,
+  1e-250, 0.6;
+  Smooshable s_C(C, Scaling::kRowCol);
+  Smooshable s_BC, s_log_BC;
+  Eigen::MatrixXi BC_viterbi_idx, log_BC_viterbi_idx;
+  std::tie(s_BC, BC_viterbi_idx) = Smoosh(s_B, s_C);
+  std::tie(s_log_BC, log_BC_viterbi_idx) =
+      Smoosh(Smooshable(B, Scaling::kLog), Smooshable(C, Scaling::kLog));
+  REQUIRE(s_BC.LogMarginal().isApprox(s_log_BC.LogMarginal()));
+  REQUIRE(s_BC.LogViterbi().isApprox(s_log_BC.LogViterbi()));
+  REQUIRE(BC_viterbi_idx == log_BC_viterbi_idx);
+
+  // The second column of D has 11 more scaler counts than the first, and the
+  // second row of D has its only term there, which must not underflow.
+  Smooshable s_D(1, 1, Scaling::kRowCol);
+  s_D.marginal() << 0.5, 1e-21, 0., 1e-21;
+  s_D.viterbi() = s_D.marginal();
+  s_D.col_scaler_counts() << 0, 11;
+  Eigen::MatrixXd E(2,2);
+  E <<
+  0.3, 0.7,
+  0.6, 0.4;
+  Smooshable s_DE;
+  Eigen::MatrixXi DE_viterbi_idx;
+  std::tie(s_DE, DE_viterbi_idx) = Smoosh(s_D, Smooshable(E, Scaling::kRowCol));
+  Eigen::MatrixXd correct_log_DE(2,2);
+  correct_log_DE.row(0) = (0.5 * E.row(0)).array().log();
+  correct_log_DE.row(1) =
+      (1e-21 * E.row(1)).array().log() - 11 * std::log(SCALE_FACTOR);
+  Eigen::MatrixXi correct_DE_viterbi_idx(2,2);
+  correct_DE_viterbi_idx <<
+  0, 0,
+  1, 1;
+  REQUIRE(s_DE.LogMarginal().isApprox(correct_log_DE));
+  REQUIRE(s_DE.LogViterbi().isApprox(correct_log_DE));
+  REQUIRE(DE_viterbi_idx == correct_DE_viterbi_idx);
+}
+
+
+TEST_CASE("Smoosh modes", "[smooshable]") {
+  std::srand(3);
+  int flexes[] = {2, 3, 1, 4};
+  Scaling scalings[] = {Scaling::kGlobal, Scaling::kLog, Scaling::kRowCol};
+  for (Scaling scaling : scalings) {
+    SmooshableVector sv_both, sv_marginal, sv_viterbi;
+    for (int i = 0; i < 3; i++) {
+      Eigen::MatrixXd m = 1e-120 * (Eigen::MatrixXd::Random(
+          flexes[i] + 1, flexes[i + 1] + 1).array() + 1.5).matrix();
+      sv_both.push_back(Smooshable(m, scaling));
+      sv_marginal.push_back(Smooshable(m, scaling, SmooshMode::kMarginal));
+      sv_viterbi.push_back(Smooshable(m, scaling, SmooshMode::kViterbi));
+    }
+    REQUIRE(sv_marginal[0].viterbi().size() == 0);
+    REQUIRE(sv_viterbi[0].marginal().size() == 0);
+    REQUIRE(sv_viterbi[0].left_flex() == 2);
+    REQUIRE(sv_viterbi[0].right_flex() == 3);
+
+    SmooshableChain both(sv_both), marginal(sv_marginal), viterbi(sv_viterbi);
+    const Smooshable& s_both = both.smooshed().back();
+    const Smooshable& s_marginal = marginal.smooshed().back();
+    const Smooshable& s_viterbi = viterbi.smooshed().back();
+    REQUIRE(s_marginal.mode() == SmooshMode::kMarginal);
+    REQUIRE(s_marginal.LogMarginal().isApprox(s_both.LogMarginal()));
+    REQUIRE(s_viterbi.LogViterbi().isApprox(s_both.LogViterbi()));
+    REQUIRE(marginal.viterbi_paths().empty());
+    REQUIRE(viterbi.viterbi_paths() == both.viterbi_paths());
+  }
+}
+
+
+TEST_CASE("Fixed-size smooshing", "[smooshable]") {
+  std::srand(4);
+  // Square smooshes with small flex take the fixed-size kernels, and the rest
+  // don't; both should agree with the plain matrix product and BinaryMax.
+  for (int flex : {0, 2, 7, 8}) {
+    Eigen::MatrixXd A = 1e-100 * (Eigen::MatrixXd::Random(flex + 1, flex + 1)
+                                      .array() + 1.5).matrix();
+    Eigen::MatrixXd B = 1e-100 * (Eigen::MatrixXd::Random(flex + 1, flex + 1)
+                                      .array() + 1.5).matrix();
+    Smooshable s_AB;
+    Eigen::MatrixXi AB_viterbi_idx;
+    std::tie(s_AB, AB_viterbi_idx) = Smoosh(Smooshable(A), Smooshable(B));
+    Eigen::MatrixXd correct_viterbi(flex + 1, flex + 1);
+    Eigen::MatrixXi correct_viterbi_idx(flex + 1, flex + 1);
+    BinaryMax(A, B, correct_viterbi, correct_viterbi_idx);
+    REQUIRE(s_AB.LogMarginal().isApprox((A * B).array().log().matrix()));
+    REQUIRE(s_AB.LogViterbi().isApprox(correct_viterbi.array().log().matrix()));
+    REQUIRE(AB_viterbi_idx == correct_viterbi_idx);
+  }
+
+  Eigen::MatrixXd A = Eigen::MatrixXd::Random(3, 2).array() + 1.5;
+  Eigen::MatrixXd B = Eigen::MatrixXd::Random(2, 4).array() + 1.5;
+  Smooshable s_A(A), s_B(B);
+  FixedSmooshable<2, 1> f_A(s_A);
+  FixedSmooshable<1, 3> f_B(s_B);
+  FixedSmooshable<2, 3> f_AB;
+  FixedSmooshable<2, 3>::IndexMatrix f_AB_viterbi_idx;
+  std::tie(f_AB, f_AB_viterbi_idx) = Smoosh(f_A, f_B);
+  Smooshable s_AB;
+  Eigen::MatrixXi AB_viterbi_idx;
+  std::tie(s_AB, AB_viterbi_idx) = Smoosh(s_A, s_B);
+  REQUIRE(f_AB.left_flex() == 2);
+  REQUIRE(f_AB.right_flex() == 3);
+  REQUIRE(f_AB.marginal().isApprox(s_AB.marginal()));
+  REQUIRE(f_AB.viterbi() == s_AB.viterbi());
+  REQUIRE(Eigen::MatrixXi(f_AB_viterbi_idx) == AB_viterbi_idx);
+  REQUIRE(f_AB.ToSmooshable().marginal() == f_AB.marginal());
+}
+
+
+TEST_CASE("CompactIndexMatrix", "[smooshable]") {
+  Eigen::MatrixXi m(2,3);
+  m <<
+  0, 7, 255,
+  3, 1, 2;
+  CompactIndexMatrix narrow(m);
+  REQUIRE(narrow.width() == 1);
+  REQUIRE(narrow.bytes() == 6);
+  REQUIRE(narrow(0, 2) == 255);
+  REQUIRE(narrow.ToMatrix() == m);
+  REQUIRE(narrow.Row(1) == std::vector<int>({3, 1, 2}));
+
+  // Larger values widen the storage.
+  m(1, 0) = 256;
+  CompactIndexMatrix medium(m);
+  REQUIRE(medium.width() == 2);
+  REQUIRE(medium.ToMatrix() == m);
+  m(1, 0) = 70000;
+  CompactIndexMatrix wide(m);
+  REQUIRE(wide.width() == 4);
+  REQUIRE(wide.bytes() == 24);
+  REQUIRE(wide.ToMatrix() == m);
+
+  // Equality is by entries, whatever the width.
+  CompactIndexMatrix also_narrow(2, 3, 70000);
+  also_narrow.Assign(narrow.ToMatrix());
+  REQUIRE(also_narrow == narrow);
+  also_narrow.Set(0, 0, 1);
+  REQUIRE(also_narrow != narrow);
+}
+
+
+TEST_CASE("SmooshableArena", "[smooshable]") {
+  std::srand(5);
+  int flexes[] = {1, 3, 2, 4, 2};
+  SmooshableVector sv;
+  for (int i = 0; i < 4; i++) {
+    Eigen::MatrixXd m = Eigen::MatrixXd::Random(flexes[i] + 1,
+                                                flexes[i + 1] + 1).array() + 1;
+    sv.push_back(Smooshable(m));
+  }
+  SmooshableChain heap_chain(sv);
+
+  SmooshableArena arena;
+  for (int read = 0; read < 3; read++) {
+    SmooshableChain chain(sv, arena);
+    REQUIRE(chain.fully_smooshed().marginal() ==
+            heap_chain.fully_smooshed().marginal());
+    REQUIRE(chain.fully_smooshed().viterbi() ==
+            heap_chain.fully_smooshed().viterbi());
+    REQUIRE(chain.viterbi_paths() == heap_chain.viterbi_paths());
+    chain.Release();
+    REQUIRE(chain.smooshed().empty());
+    // Three smooshes, each with a marginal, a Viterbi and a compact index
+    // matrix, are allocated for the first read and reused after that, along
+    // with scratch index matrices of the two shapes (2 x 3 and 2 x 5).
+    REQUIRE(arena.allocation_count() == 11);
+  }
+
+  Eigen::MatrixXd taken = arena.TakeMatrix(2, 5);
+  REQUIRE(arena.allocation_count() == 11);
+  arena.Give(taken);
+  Smooshable marginal_only =
+      arena.TakeSmooshable(1, 4, Scaling::kGlobal, SmooshMode::kMarginal);
+  REQUIRE(marginal_only.left_flex() == 1);
+  REQUIRE(marginal_only.viterbi().size() == 0);
+  REQUIRE(arena.allocation_count() == 11);
+  // Compact index matrices with the same storage can change shape.
+  CompactIndexMatrix compact = arena.TakeCompactIndexMatrix(3, 2, 255);
+  REQUIRE(arena.allocation_count() == 11);
+  REQUIRE(compact.rows() == 3);
+  REQUIRE(compact.cols() == 2);
+  arena.Give(std::move(compact));
+}
+
+
+TEST_CASE("SmooshableCache", "[smooshable]") {
+  GermlineStore store("data");
+  DGermlinePtr d = store.d_germline("IGHD7-27*01");
+  JGermlinePtr j = store.j_germline("IGHJ4*01");
+  Eigen::VectorXi emission_indices(6);
+  emission_indices << 0, 2, 3, 1, 1, 0;
+
+  SmooshableCache cache(2);
+  SmooshablePtr first = cache.GetGermline(d, 3, emission_indices, 2, 1);
+  SmooshableGermline correct(*d, 3, emission_indices, 2, 1);
+  REQUIRE(first->marginal() == correct.marginal());
+  REQUIRE(first->viterbi() == correct.viterbi());
+  REQUIRE(cache.GetGermline(d, 3, emission_indices, 2, 1) == first);
+  REQUIRE(cache.hit_count() == 1);
+  REQUIRE(cache.miss_count() == 1);
+
+  // Changing any part of the key misses.
+  Eigen::VectorXi other_indices = emission_indices;
+  other_indices(5) = 3;
+  REQUIRE(cache.GetGermline(d, 3, other_indices, 2, 1) != first);
+  REQUIRE(cache.GetGermline(j, 3, emission_indices, 2, 1) != first);
+  REQUIRE(cache.GetGermline(d, 3, emission_indices, 2, 1, Scaling::kLog) !=
+          first);
+  REQUIRE(cache.miss_count() == 4);
+  REQUIRE(cache.size() == 2);
+
+  // A gene of the same name from another store is a different germline.
+  GermlineStore other_store("data");
+  DGermlinePtr other_d = other_store.d_germline("IGHD7-27*01");
+  SmooshablePtr other_first =
+      cache.GetGermline(other_d, 3, emission_indices, 2, 1, Scaling::kLog);
+  REQUIRE(cache.miss_count() == 5);
+  REQUIRE(cache.GetGermline(d, 3, emission_indices, 2, 1, Scaling::kLog) !=
+          other_first);
+  REQUIRE(cache.hit_count() == 2);
+
+  // The first entry was the least recently used, so it's gone, but our
+  // pointer to it is still good.
+  SmooshablePtr rebuilt = cache.GetGermline(d, 3, emission_indices, 2, 1);
+  REQUIRE(rebuilt != first);
+  REQUIRE(rebuilt->marginal() == first->marginal());
+  REQUIRE(cache.miss_count() == 6);
+
+  // An entry keeps its germline alive, so that no other germline can take
+  // its address while the entry lives.
+  std::weak_ptr<const Germline> weak_germline;
+  {
+    GermlinePtr temporary = std::make_shared<const DGermline>(*d);
+    weak_germline = temporary;
+    cache.GetGermline(temporary, 3, emission_indices, 2, 1);
+  }
+  REQUIRE(!weak_germline.expired());
+  cache.Clear();
+  REQUIRE(cache.size() == 0);
+  REQUIRE(weak_germline.expired());
+}
+
+
+TEST_CASE("SmooshableBatch", "[smooshable]") {
+  std::srand(6);
+  SmooshableVector batch_a, batch_b;
+  for (int b = 0; b < 5; b++) {
+    // Small enough that some members need rescaling.
+    Eigen::MatrixXd A = std::pow(1e-70, b) *
+        (Eigen::MatrixXd::Random(3, 4).array() + 1.5).matrix();
+    Eigen::MatrixXd B = std::pow(1e-60, b) *
+        (Eigen::MatrixXd::Random(4, 2).array() + 1.5).matrix();
+    batch_a.push_back(Smooshable(A));
+    batch_b.push_back(Smooshable(B));
+  }
+  // A tie, which should go to the first index as in BinaryMax.
+  batch_a[0].viterbi().row(0).setConstant(1.);
+  batch_b[0].viterbi().col(0).setConstant(1.);
+
+  SmooshableBatch s_a(batch_a), s_b(batch_b);
+  REQUIRE(s_a.size() == 5);
+  REQUIRE(s_a.Get(3).marginal() == batch_a[3].marginal());
+  SmooshableBatch s_ab;
+  BatchIndexMatrix ab_viterbi_idx;
+  std::tie(s_ab, ab_viterbi_idx) = Smoosh(s_a, s_b);
+  REQUIRE(s_ab.left_flex() == 2);
+  REQUIRE(s_ab.right_flex() == 1);
+  for (int b = 0; b < 5; b++) {
+    Smooshable correct;
+    Eigen::MatrixXi correct_viterbi_idx;
+    std::tie(correct, correct_viterbi_idx) = Smoosh(batch_a[b], batch_b[b]);
+    Smooshable member = s_ab.Get(b);
+    REQUIRE(member.scaler_count() == correct.scaler_count());
+    REQUIRE(member.marginal().isApprox(correct.marginal()));
+    REQUIRE(member.viterbi() == correct.viterbi());
+    REQUIRE(GetViterbiIndex(ab_viterbi_idx, 2, b) == correct_viterbi_idx);
+  }
+  REQUIRE(s_ab.scaler_counts()(4) > 0);
+}
+
+
+TEST_CASE("Parallel SmooshableChain", "[smooshable]") {
+  std::srand(2);
+  int flexes[] = {2, 3, 1, 4, 2, 3, 2};
+  SmooshableVector sv;
+  for (int i = 0; i + 1 < 7; i++) {
+    Eigen::MatrixXd m = 0.5 * (Eigen::MatrixXd::Random(flexes[i] + 1,
+                                                       flexes[i + 1] + 1)
+                                   .array() + 1);
+    sv.push_back(Smooshable(m));
+  }
+  ThreadPool pool(3);
+  for (unsigned int length = 1; length <= sv.size(); length++) {
+    SmooshableVector prefix(sv.begin(), sv.begin() + length);
+    SmooshableChain sequential(prefix);
+    SmooshableChain tree(prefix, pool);
+    REQUIRE(tree.viterbi_paths() == sequential.viterbi_paths());
+    if (length > 1) {
+      REQUIRE(tree.smooshed().size() == length - 1);
+      REQUIRE(tree.smooshed().back().marginal().isApprox(
+          sequential.smooshed().back().marginal()));
+      REQUIRE(tree.smooshed().back().viterbi().isApprox(
+          sequential.smooshed().back().viterbi()));
+    }
+  }
 }
 
 
 // Ham comparison tests
 
+TEST_CASE("Replacing in a SmooshableChain", "[smooshable]") {
+  std::srand(6);
+  int flexes[] = {2, 3, 1, 4, 2, 3, 2};
+  SmooshableVector sv;
+  for (int i = 0; i + 1 < 7; i++) {
+    Eigen::MatrixXd m = 0.5 * (Eigen::MatrixXd::Random(flexes[i] + 1,
+                                                       flexes[i + 1] + 1)
+                                   .array() + 1);
+    sv.push_back(Smooshable(m));
+  }
+  ThreadPool pool(2);
+  SmooshableArena arena;
+  SmooshableChain sequential(sv), tree(sv, pool), from_arena(sv, arena);
+  int replacements[] = {2, 2, 4, 0, 5, 2, 3};
+  for (int i : replacements) {
+    Eigen::MatrixXd m = 0.5 * (Eigen::MatrixXd::Random(flexes[i] + 1,
+                                                       flexes[i + 1] + 1)
+                                   .array() + 1);
+    sv[i] = Smooshable(m);
+    SmooshableChain correct(sv);
+    for (SmooshableChain* chain : {&sequential, &tree, &from_arena}) {
+      // Unwind the old paths, to check that they are thrown out.
+      chain->viterbi_paths();
+      chain->Replace(i, sv[i]);
+      REQUIRE(chain->fully_smooshed().marginal().isApprox(
+          correct.fully_smooshed().marginal()));
+      REQUIRE(chain->fully_smooshed().viterbi().isApprox(
+          correct.fully_smooshed().viterbi()));
+      REQUIRE(chain->viterbi_paths() == correct.viterbi_paths());
+    }
+  }
+  // Replacing the same original again only redoes the two smooshes that
+  // cover it.
+  int count = sequential.smooshed().size();
+  sequential.Replace(3, sv[3]);
+  REQUIRE(sequential.smooshed().size() == count);
+  // With an arena, the matrices of the two smooshes are reused.
+  from_arena.Replace(3, sv[3]);
+  int allocation_count = arena.allocation_count();
+  from_arena.Replace(3, sv[3]);
+  REQUIRE(arena.allocation_count() == allocation_count);
+  from_arena.Release();
+}
+
+
+TEST_CASE("Junction posteriors", "[smooshable]") {
+  std::srand(7);
+  int flexes[] = {1, 3, 2, 4, 2};
+  std::vector<Eigen::MatrixXd> ms;
+  SmooshableVector sv_global, sv_log, sv_rowcol;
+  for (int i = 0; i < 4; i++) {
+    ms.push_back(1e-100 * (Eigen::MatrixXd::Random(flexes[i] + 1,
+                                                   flexes[i + 1] + 1)
+                               .array() + 1.));
+    sv_global.push_back(Smooshable(ms[i]));
+    sv_log.push_back(Smooshable(ms[i], Scaling::kLog));
+    sv_rowcol.push_back(Smooshable(ms[i], Scaling::kRowCol));
+  }
+  SmooshableChain global(sv_global), log(sv_log), rowcol(sv_rowcol);
+  // Check against fixing each index of each junction in turn, scaling up so
+  // that the plain products don't underflow.
+  for (Eigen::MatrixXd& m : ms) m *= 1e100;
+  int row = 1, col = 2;
+  std::vector<Eigen::VectorXd> posteriors = global.JunctionPosteriors(row, col);
+  REQUIRE(posteriors.size() == 3);
+  for (int k = 0; k < 3; k++) {
+    Eigen::MatrixXd prefix = ms[0], suffix = ms[3];
+    for (int i = 1; i <= k; i++) prefix = prefix * ms[i];
+    for (int i = 2; i > k; i--) suffix = ms[i] * suffix;
+    Eigen::VectorXd correct = prefix.row(row).transpose().cwiseProduct(
+        suffix.col(col));
+    correct /= correct.sum();
+    REQUIRE(posteriors[k].isApprox(correct));
+    REQUIRE(log.JunctionPosteriors(row, col)[k].isApprox(correct));
+    REQUIRE(rowcol.JunctionPosteriors(row, col)[k].isApprox(correct));
+  }
+  // A balanced tree lacks some prefixes, which get smooshed up; a chain that
+  // has had an original replaced has to find its spans again.
+  ThreadPool pool(2);
+  SmooshableChain balanced(sv_global, pool);
+  std::vector<Eigen::VectorXd> balanced_posteriors =
+      balanced.JunctionPosteriors(row, col);
+  global.Replace(2, sv_global[2]);
+  for (int k = 0; k < 3; k++) {
+    REQUIRE(balanced_posteriors[k].isApprox(posteriors[k]));
+    REQUIRE(global.JunctionPosteriors(row, col)[k].isApprox(posteriors[k]));
+  }
+
+  // An entry that can't happen has no posterior.
+  sv_global[0].marginal().row(0).setZero();
+  SmooshableChain impossible(sv_global);
+  REQUIRE(impossible.JunctionPosteriors(0, 0)[1].isZero());
+}
+
+
 TEST_CASE("Ham Comparison 1", "[ham]") {
   Eigen::VectorXd landing_a(3);
   landing_a << 1, 1, 1;
@@ -467,6 +1160,111 @@ TEST_CASE("YAML", "[io]") {
 }
 
 
+TEST_CASE("GermlineStore", "[io]") {
+  GermlineStore store("data");
+  REQUIRE(store.size() == 6);
+  REQUIRE(get_gene_name(get_yaml_root("data/IGHV1-2_star_04.yaml")) ==
+          "IGHV1-2*04");
+
+  VGermlinePtr v_germline = store.v_germline("IGHV1-2*04");
+  DGermlinePtr d_germline = store.d_germline("IGHD7-27*01");
+  JGermlinePtr j_germline = store.j_germline("IGHJ4*01");
+  REQUIRE(v_germline != nullptr);
+  REQUIRE(d_germline != nullptr);
+  REQUIRE(j_germline != nullptr);
+  REQUIRE(store.v_germline("IGHD7-27*01") == nullptr);
+  REQUIRE(store.j_germline("IGHJ6*02") == nullptr);
+  REQUIRE(v_germline->name() == "IGHV1-2*04");
+  REQUIRE(v_germline->length() == 296);
+
+  // Lookups hand out the same gene rather than a copy.
+  REQUIRE(store.v_germline("IGHV1-2*04") == v_germline);
+  REQUIRE(&v_germline->emission_matrix() ==
+          &store.v_germline("IGHV1-2*04")->emission_matrix());
+
+  VGermline correct_V_Germline(get_yaml_root("data/V_germline_ex.yaml"));
+  VGermlinePtr dummy_v = store.v_germline("dummy_V");
+  REQUIRE(dummy_v->emission_matrix() == correct_V_Germline.emission_matrix());
+  REQUIRE(dummy_v->transition() == correct_V_Germline.transition());
+  REQUIRE(store.d_germline("dummy_D")->n_transition().rows() == 4);
+  REQUIRE(store.j_germline("dummy_J")->n_self_transition_prob() == 0.96);
+}
+
+
+TEST_CASE("GermlineFile", "[io]") {
+  GermlineStore yaml_store("data");
+  WriteGermlineFile(yaml_store, "_build/test/germlines.lhg");
+  GermlineFile file("_build/test/germlines.lhg");
+  REQUIRE(file.records().size() == 6);
+  REQUIRE(file.records()[0].type == 'V');
+  REQUIRE(file.records()[0].name == "IGHV1-2*04");
+  REQUIRE(file.records()[0].length == 296);
+
+  GermlineStore store;
+  file.LoadInto(store);
+  REQUIRE(store.size() == 6);
+  for (const auto& v : yaml_store.v_germlines()) {
+    VGermlinePtr loaded = store.v_germline(v.first);
+    REQUIRE(loaded->emission_matrix() == v.second->emission_matrix());
+    REQUIRE(loaded->transition() == v.second->transition());
+    REQUIRE(loaded->gene_prob() == v.second->gene_prob());
+    REQUIRE(loaded->n_self_transition_prob() ==
+            v.second->n_self_transition_prob());
+    REQUIRE(loaded->n_emission_vector() == v.second->n_emission_vector());
+  }
+  for (const auto& d : yaml_store.d_germlines()) {
+    DGermlinePtr loaded = store.d_germline(d.first);
+    REQUIRE(loaded->emission_matrix() == d.second->emission_matrix());
+    REQUIRE(loaded->transition() == d.second->transition());
+    REQUIRE(loaded->n_landing_in() == d.second->n_landing_in());
+    REQUIRE(loaded->n_landing_out() == d.second->n_landing_out());
+    REQUIRE(loaded->n_emission_matrix() == d.second->n_emission_matrix());
+    REQUIRE(loaded->n_transition() == d.second->n_transition());
+  }
+  for (const auto& j : yaml_store.j_germlines()) {
+    JGermlinePtr loaded = store.j_germline(j.first);
+    REQUIRE(loaded->transition() == j.second->transition());
+    REQUIRE(loaded->n_landing_out() == j.second->n_landing_out());
+    REQUIRE(loaded->n_self_transition_prob() ==
+            j.second->n_self_transition_prob());
+  }
+
+  // Loaded genes map their arrays in the file rather than copying them, and
+  // keep the mapping alive once the GermlineFile is gone.
+  REQUIRE(store.v_germline("IGHV1-2*04")->emission_matrix().data() ==
+          file.records()[0].emission_matrix_data);
+  GermlineStore temporary_store;
+  GermlineFile("_build/test/germlines.lhg").LoadInto(temporary_store);
+  REQUIRE(temporary_store.v_germline("IGHV1-2*04")->emission_matrix() ==
+          yaml_store.v_germline("IGHV1-2*04")->emission_matrix());
+
+  REQUIRE_THROWS(GermlineFile("data/V_germline_ex.yaml"));
+
+  // A gene length too big for the file is caught before it's multiplied.
+  std::ifstream in("_build/test/germlines.lhg", std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+  const std::vector<char> original = bytes;
+  uint64_t first_offset;
+  std::memcpy(&first_offset, bytes.data() + 16, sizeof(first_offset));
+  uint32_t huge_length = 0xFFFFFFFF;
+  std::memcpy(bytes.data() + first_offset + 8, &huge_length,
+              sizeof(huge_length));
+  std::ofstream("_build/test/corrupt.lhg", std::ios::binary)
+      .write(bytes.data(), bytes.size());
+  REQUIRE_THROWS(GermlineFile("_build/test/corrupt.lhg"));
+
+  // So is a record that doesn't start on an 8-byte boundary.
+  bytes = original;
+  uint64_t misaligned_offset = first_offset + 4;
+  std::memcpy(bytes.data() + 16, &misaligned_offset,
+              sizeof(misaligned_offset));
+  std::ofstream("_build/test/corrupt.lhg", std::ios::binary)
+      .write(bytes.data(), bytes.size());
+  REQUIRE_THROWS(GermlineFile("_build/test/corrupt.lhg"));
+}
+
+
 // Partis CSV parsing.
 TEST_CASE("CSV", "[io]") {
   io::CSVReader<3, io::trim_chars<>, io::double_quote_escape<' ','\"'> > in("data/hmm_input.csv");
@@ -485,4 +1283,288 @@ TEST_CASE("CSV", "[io]") {
   REQUIRE(bb_map["v_l"].second == 2);
   REQUIRE(bb_map["d_r"].first == 328);
 }
+
+
+TEST_CASE("PartisRead", "[io]") {
+  io::CSVReader<5, io::trim_chars<>, io::double_quote_escape<' ','\"'> > in("data/hmm_input.csv");
+  in.read_header(io::ignore_extra_column, "names", "seqs", "boundsbounds", "relpos", "only_genes");
+  std::string name, seq, boundsbounds_str, relpos_str, only_genes_str;
+  in.read_row(name, seq, boundsbounds_str, relpos_str, only_genes_str);
+  PartisRead read(name, seq, boundsbounds_str, relpos_str, only_genes_str);
+  REQUIRE(read.name() == "V1-2_04-D2-15_01-J6_01_nodel_Tins297_331");
+  REQUIRE(read.length() == seq.size());
+  REQUIRE(read.emission_indices()(0) == 1);  // C
+  REQUIRE(read.emission_indices()(1) == 0);  // A
+  REQUIRE(read.window("d_l").start == 297);
+  REQUIRE(read.window("d_l").size() == 5);
+  REQUIRE(read.relpos("IGHJ6*02") == 333);
+  REQUIRE(!read.has_relpos("IGHJ4*01"));
+  REQUIRE(read.only_genes().size() == 5);
+  REQUIRE(read.only_genes()[2] == "IGHV1-2*02");
+  REQUIRE_THROWS(read.window("x_l"));
+  REQUIRE_THROWS(SequenceToIndices("ACGX"));
+}
+
+
+// The most likely base at each germline position.
+std::string GermlineSequence(const Germline& germline) {
+  std::string seq;
+  for (int i = 0; i < germline.length(); i++) {
+    int base;
+    germline.emission_matrix().col(i).maxCoeff(&base);
+    seq += NUKE_ALPHABET[base];
+  }
+  return seq;
+}
+
+
+TEST_CASE("VDJ chain", "[vdj]") {
+  GermlineStore store("data");
+  DGermlinePtr d = store.d_germline("IGHD7-27*01");
+
+  // Insertions of length zero land directly in the gene, and longer ones go
+  // through the insertion states.
+  PartisRead ins_read("ins", "ACG", "{}", "{\"IGHD7-27*01\":1}", "");
+  Smooshable nti = NTInsertionSmooshable(*d, *d, ins_read, 1, {0, 2}, {1, 3},
+                                         Scaling::kGlobal, SmooshMode::kBoth);
+  const Eigen::MatrixXd& E = d->n_emission_matrix();
+  Eigen::VectorXd in_A = d->n_landing_in().array() * E.row(0).transpose().array();
+  Eigen::VectorXd in_AC =
+      (d->n_transition().transpose() * in_A).array() * E.row(1).transpose().array();
+  REQUIRE(nti.marginal()(0, 0) == Approx(in_A.dot(d->n_landing_out().col(0))));
+  REQUIRE(nti.marginal()(0, 1) == Approx(in_AC.dot(d->n_landing_out().col(1))));
+  REQUIRE(nti.marginal()(1, 0) == d->linear_transition().landing()(0));
+  REQUIRE(nti.marginal()(1, 1) ==
+          Approx((d->n_landing_in().array() * E.row(1).transpose().array())
+                     .matrix().dot(d->n_landing_out().col(1))));
+  REQUIRE(nti.viterbi()(0, 0) <= nti.marginal()(0, 0));
+  REQUIRE(nti.viterbi()(1, 0) == nti.marginal()(1, 0));
+  // The Viterbi probabilities take the best insertion state path, worked out
+  // here state by state rather than with the shared best-path vectors.
+  const Eigen::MatrixXd& T = d->n_transition();
+  const Eigen::MatrixXd& out = d->n_landing_out();
+  Eigen::VectorXd in_C =
+      d->n_landing_in().array() * E.row(1).transpose().array();
+  Eigen::VectorXd best_AC(in_A.size());
+  double best_A_end = 0., best_AC_end = 0., best_C_end = 0.;
+  for (int j = 0; j < in_A.size(); j++) {
+    best_AC(j) = 0.;
+    for (int i = 0; i < in_A.size(); i++) {
+      best_AC(j) = std::max(best_AC(j), in_A(i) * T(i, j));
+    }
+    best_AC(j) *= E(1, j);
+  }
+  for (int i = 0; i < in_A.size(); i++) {
+    best_A_end = std::max(best_A_end, in_A(i) * out(i, 0));
+    best_AC_end = std::max(best_AC_end, best_AC(i) * out(i, 1));
+    best_C_end = std::max(best_C_end, in_C(i) * out(i, 1));
+  }
+  REQUIRE(nti.scaler_count() == 0);
+  REQUIRE(nti.viterbi()(0, 0) == Approx(best_A_end));
+  REQUIRE(nti.viterbi()(0, 1) == Approx(best_AC_end));
+  REQUIRE(nti.viterbi()(1, 1) == Approx(best_C_end));
+  REQUIRE(nti.viterbi()(0, 1) < nti.marginal()(0, 1));
+
+  // Padding probabilities are geometric in the padding length, and long runs
+  // of padding don't underflow.
+  VGermlinePtr v = store.v_germline("IGHV1-2*04");
+  double log_step = std::log(v->n_self_transition_prob() * 0.25);
+  PartisRead padded("padded", std::string(400, 'A'), "{}", "{}", "");
+  REQUIRE(v->LogPaddingProb(padded.emission_indices().head(3)) ==
+          Approx(3 * log_step));
+  for (Scaling scaling : {Scaling::kGlobal, Scaling::kLog, Scaling::kRowCol}) {
+    Smooshable v_padding = VPaddingSmooshable(*v, padded, {398, 402}, scaling,
+                                              SmooshMode::kBoth);
+    REQUIRE(v_padding.LogMarginal()(0, 0) == Approx(398 * log_step));
+    REQUIRE(v_padding.LogViterbi()(0, 2) == Approx(400 * log_step));
+    REQUIRE(std::isinf(v_padding.LogMarginal()(0, 3)));
+  }
+
+  // Build a read from trimmed germline genes and non-templated insertions.
+  std::string v_seq = GermlineSequence(*store.v_germline("IGHV1-2*04"));
+  std::string d_seq = GermlineSequence(*d);
+  std::string j_seq = GermlineSequence(*store.j_germline("IGHJ4*01"));
+  std::string seq = v_seq.substr(0, 290) + "TT" + d_seq.substr(1) + "CCA" +
+                    j_seq.substr(2);
+  int d_start = 292, d_end = d_start + d_seq.size() - 1;
+  int j_start = d_end + 3, j_end = seq.size();
+  std::stringstream boundsbounds;
+  boundsbounds << "{\"v_l\":[0,2],\"v_r\":[288,293],"
+               << "\"d_l\":[" << d_start - 2 << "," << d_start + 3 << "],"
+               << "\"d_r\":[" << d_end - 2 << "," << d_end + 3 << "],"
+               << "\"j_l\":[" << j_start - 2 << "," << j_start + 3 << "],"
+               << "\"j_r\":[" << j_end - 2 << "," << j_end + 1 << "]}";
+  std::stringstream relpos;
+  relpos << "{\"IGHV1-2*04\":0,\"IGHD7-27*01\":" << d_start - 1
+         << ",\"IGHJ4*01\":" << j_start - 2 << "}";
+  PartisRead read("read", seq, boundsbounds.str(), relpos.str(),
+                  "IGHV1-2*04:IGHD7-27*01:IGHJ4*01:IGHV3-23*01");
+
+  SmooshableVector smooshables =
+      VDJSmooshables(read, *store.v_germline("IGHV1-2*04"), *d,
+                     *store.j_germline("IGHJ4*01"));
+  REQUIRE(smooshables.size() == 7);
+  REQUIRE(smooshables.front().left_flex() == 0);
+  REQUIRE(smooshables.back().right_flex() == 0);
+
+  ReadAnnotation annotation = AnnotateRead(read, store);
+  REQUIRE(annotation.v_gene == "IGHV1-2*04");
+  REQUIRE(annotation.d_gene == "IGHD7-27*01");
+  REQUIRE(annotation.j_gene == "IGHJ4*01");
+  REQUIRE(annotation.v_start == 0);
+  REQUIRE(annotation.d_start == d_start);
+  REQUIRE(annotation.d_end == d_end);
+  REQUIRE(annotation.j_start == j_start);
+  REQUIRE(annotation.j_end == j_end);
+  REQUIRE(std::isfinite(annotation.log_likelihood));
+  REQUIRE(annotation.log_likelihood >= annotation.log_viterbi);
+
+  // With every gene in the store as a candidate, each combination's
+  // probability agrees with smooshing its own chain.
+  relpos.seekp(-1, std::ios_base::end);
+  relpos << ",\"dummy_V\":0,\"dummy_D\":" << d_start - 1
+         << ",\"dummy_J\":" << j_start - 2 << "}";
+  PartisRead all_genes("all_genes", seq, boundsbounds.str(), relpos.str(), "");
+  SmooshableArena arena;
+  std::vector<GeneCombination> combinations;
+  ReadAnnotation all_annotation =
+      AnnotateRead(all_genes, store, arena, &combinations);
+  REQUIRE(combinations.size() == 8);
+  double log_likelihood = -std::numeric_limits<double>::infinity();
+  for (const GeneCombination& combination : combinations) {
+    VGermlinePtr v = store.v_germline(combination.v_gene);
+    DGermlinePtr d = store.d_germline(combination.d_gene);
+    JGermlinePtr j = store.j_germline(combination.j_gene);
+    SmooshableChain chain(VDJSmooshables(all_genes, *v, *d, *j));
+    double correct = chain.fully_smooshed().LogMarginal()(0, 0) +
+                     std::log(v->gene_prob() * d->gene_prob() *
+                              j->gene_prob());
+    if (std::isinf(correct)) {
+      REQUIRE(std::isinf(combination.log_likelihood));
+    } else {
+      REQUIRE(combination.log_likelihood == Approx(correct));
+    }
+    if (std::isfinite(combination.log_likelihood)) {
+      log_likelihood = std::max(log_likelihood, combination.log_likelihood) +
+                       std::log1p(std::exp(
+                           -std::fabs(log_likelihood -
+                                      combination.log_likelihood)));
+    }
+  }
+  REQUIRE(all_annotation.log_likelihood == Approx(log_likelihood));
+  REQUIRE(all_annotation.log_viterbi >= annotation.log_viterbi);
+
+  // Once the arena has seen the read, annotating it again allocates nothing.
+  long new_count = operator_new_count;
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+  Eigen::internal::set_is_malloc_allowed(false);
+#endif
+  ReadAnnotation again = AnnotateRead(all_genes, store, arena);
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+  Eigen::internal::set_is_malloc_allowed(true);
+#endif
+  // Catch allocates as it sets up a REQUIRE, so count before that.
+  new_count = operator_new_count - new_count;
+  REQUIRE(new_count == 0);
+  REQUIRE(again.log_likelihood == all_annotation.log_likelihood);
+  REQUIRE(again.log_viterbi == all_annotation.log_viterbi);
+  REQUIRE(again.v_gene == all_annotation.v_gene);
+  REQUIRE(again.d_start == all_annotation.d_start);
+  REQUIRE(again.j_end == all_annotation.j_end);
+
+  // A read whose genes aren't in the store has no annotation.
+  PartisRead missing("missing", seq, boundsbounds.str(), relpos.str(),
+                     "IGHV3-23*01");
+  ReadAnnotation no_annotation = AnnotateRead(missing, store);
+  REQUIRE(no_annotation.v_gene.empty());
+  REQUIRE(std::isinf(no_annotation.log_likelihood));
+}
+
+
+// Instrumentation tests
+
+TEST_CASE("Instrumentation", "[instrumentation]") {
+  ResetInstrumentation();
+  AddToCounter(Counter::kSmooshFlops, 5);
+  { ScopedTimer timer(Stage::kSmoosh); }
+  // Counts from other threads, including finished ones, are added in.
+  {
+    ThreadPool pool(2);
+    std::vector<std::future<void>> done;
+    for (int i = 0; i < 4; i++) {
+      done.push_back(pool.Submit([]() {
+        AddToCounter(Counter::kSmooshFlops, 10);
+        ScopedTimer timer(Stage::kSmoosh);
+      }));
+    }
+    for (auto& result : done) result.get();
+  }
+  REQUIRE(CounterTotal(Counter::kSmooshFlops) == 45);
+  REQUIRE(CounterTotal(Counter::kScaleIterations) == 0);
+  REQUIRE(StageCalls(Stage::kSmoosh) == 5);
+  REQUIRE(StageNanoseconds(Stage::kSmoosh) >= 0);
+
+  std::ostringstream report;
+  WriteInstrumentationReport(report);
+  REQUIRE(report.str().find("Smoosh FLOPs") != std::string::npos);
+  REQUIRE(report.str().find("Viterbi unwinding") != std::string::npos);
+
+  ResetInstrumentation();
+  REQUIRE(CounterTotal(Counter::kSmooshFlops) == 0);
+  REQUIRE(StageCalls(Stage::kSmoosh) == 0);
+
+#ifdef LINEARHAM_INSTRUMENT
+  // Every max-product kernel is timed, including the fixed-size ones and the
+  // log-space one.
+  Eigen::MatrixXd m = Eigen::MatrixXd::Constant(3, 3, 0.5);
+  for (Scaling scaling : {Scaling::kGlobal, Scaling::kLog}) {
+    Smoosh(Smooshable(m, scaling), Smooshable(m, scaling));
+  }
+  Eigen::MatrixXd big = Eigen::MatrixXd::Constant(10, 10, 0.5);
+  Smoosh(Smooshable(big), Smooshable(big));
+  REQUIRE(StageCalls(Stage::kSmoosh) == 3);
+  REQUIRE(StageCalls(Stage::kMaxProduct) == 3);
+  // Two flops per term, 27 or 1000 terms, for the marginal and the Viterbi.
+  REQUIRE(CounterTotal(Counter::kSmooshFlops) == 2 * 2 * 27 * 2 + 2 * 1000 * 2);
+  ResetInstrumentation();
+#endif
+}
+
+
+TEST_CASE("Trace", "[instrumentation]") {
+  { LINEARHAM_TRACE("before"); }
+  StartTracing(4);
+  REQUIRE(TracingEnabled());
+  for (int i = 0; i < 6; i++) {
+    LINEARHAM_TRACE("outer");
+    LINEARHAM_TRACE("inner");
+  }
+  {
+    ThreadPool pool(1);
+    pool.Submit([]() { LINEARHAM_TRACE("worker"); }).get();
+  }
+  StopTracing();
+  { LINEARHAM_TRACE("after"); }
+
+  std::ostringstream trace;
+  WriteTrace(trace);
+  std::string json = trace.str();
+  auto count = [&json](const std::string& s) {
+    int n = 0;
+    for (size_t pos = json.find(s); pos != std::string::npos;
+         pos = json.find(s, pos + 1)) {
+      n++;
+    }
+    return n;
+  };
+  REQUIRE(json.compare(0, 16, "{\"traceEvents\": ") == 0);
+  // The ring buffer of this thread keeps only its last 4 of 12 events.
+  REQUIRE(count("\"ph\": \"X\"") == 5);
+  REQUIRE(count("\"name\": \"outer\"") == 2);
+  REQUIRE(count("\"name\": \"inner\"") == 2);
+  REQUIRE(count("\"name\": \"worker\"") == 1);
+  REQUIRE(count("before") == 0);
+  REQUIRE(count("after") == 0);
+  REQUIRE(json.find("\"dropped_events\": 8") != std::string::npos);
+}
 }
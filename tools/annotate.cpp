@@ -0,0 +1,172 @@
+// Annotate the reads of a partis hmm_input CSV file, writing one CSV line
+// per read in input order.
+//
+// Usage: annotate [--trace=<trace.json>] <germline directory or file>
+//                 <hmm_input.csv> <output.csv> [threads]
+//
+// The germlines are either a directory of partis germline HMM YAML files or
+// a binary file written by compile_germlines. Rows are read a few at a time
+// and annotated on a pool of worker threads (by default one per core), so
+// memory use doesn't grow with the input. A row that can't be annotated
+// (say, one with an unexpected base) is reported on standard error and
+// written without an annotation, and the run carries on.
+//
+// With --trace, a timeline of each thread's reading, germline lookup,
+// smooshing and writing is written as a Chrome trace JSON file once all reads
+// are done, for viewing in chrome://tracing or Perfetto.
+
+#include <sys/stat.h>
+#include <deque>
+#include <limits>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include "germline_file.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+#include "vdj_chain.hpp"
+#include "../lib/fast-cpp-csv-parser/csv.h"
+
+
+linearham::GermlineStore LoadGermlines(const std::string& path) {
+  LINEARHAM_TRACE("germline loading");
+  linearham::GermlineStore store;
+  struct stat germline_stat;
+  if (stat(path.c_str(), &germline_stat) == 0 &&
+      S_ISDIR(germline_stat.st_mode)) {
+    store = linearham::GermlineStore(path);
+  } else {
+    linearham::GermlineFile(path).LoadInto(store);
+  }
+  return store;
+}
+
+
+// The annotation written for a read that couldn't be annotated, as for a
+// read with no candidate genes.
+linearham::ReadAnnotation FailedAnnotation(const std::string& name,
+                                           const std::string& error) {
+  std::cerr << "Error: read " + name + ": " + error + "\n";
+  linearham::ReadAnnotation annotation;
+  annotation.name = name;
+  annotation.log_likelihood = annotation.log_viterbi =
+      -std::numeric_limits<double>::infinity();
+  annotation.v_start = annotation.v_end = annotation.d_start =
+      annotation.d_end = annotation.j_start = annotation.j_end = -1;
+  return annotation;
+}
+
+
+void WriteAnnotation(std::ostream& out,
+                     const linearham::ReadAnnotation& annotation) {
+  LINEARHAM_TRACE("writing");
+  out << annotation.name << "," << annotation.log_likelihood << ","
+      << annotation.log_viterbi << "," << annotation.v_gene << ","
+      << annotation.d_gene << "," << annotation.j_gene << ","
+      << annotation.v_start << "," << annotation.v_end << ","
+      << annotation.d_start << "," << annotation.d_end << ","
+      << annotation.j_start << "," << annotation.j_end << "\n";
+}
+
+
+// Wait for the oldest read in flight and write its annotation.
+void WriteOldest(std::ostream& out,
+                 std::deque<std::future<linearham::ReadAnnotation>>& pending) {
+  linearham::ReadAnnotation annotation;
+  {
+    LINEARHAM_TRACE("waiting");
+    annotation = pending.front().get();
+  }
+  pending.pop_front();
+  WriteAnnotation(out, annotation);
+}
+
+
+// If tracing, stop and write the trace to `trace_path`, which is then cleared
+// so that the trace is written only once.
+void FinishTrace(std::string& trace_path) {
+  if (trace_path.empty()) return;
+  std::string path;
+  std::swap(path, trace_path);
+  linearham::StopTracing();
+  linearham::WriteTraceFile(path);
+}
+
+
+// The most recent events kept per thread when tracing.
+const int kTraceEventsPerThread = 1 << 18;
+
+
+int main(int argc, char* argv[]) {
+  std::string trace_path;
+  if (argc > 1 && std::string(argv[1]).compare(0, 8, "--trace=") == 0) {
+    trace_path = std::string(argv[1]).substr(8);
+    argv++;
+    argc--;
+  }
+  if (argc != 4 && argc != 5) {
+    std::cerr << "Usage: " << argv[0] << " [--trace=<trace.json>]"
+              << " <germline directory or file> <hmm_input.csv> <output.csv>"
+              << " [threads]" << std::endl;
+    return 1;
+  }
+  std::string germline_path = argv[1];
+  int thread_count = (argc == 5) ? std::stoi(argv[4]) : 0;
+  if (!trace_path.empty()) linearham::StartTracing(kTraceEventsPerThread);
+
+  try {
+    linearham::GermlineStore store = LoadGermlines(germline_path);
+
+    io::CSVReader<5, io::trim_chars<>, io::double_quote_escape<' ', '\"'>>
+        in(argv[2]);
+    in.read_header(io::ignore_extra_column, "names", "seqs", "boundsbounds",
+                   "relpos", "only_genes");
+    std::ofstream out(argv[3]);
+    if (!out) throw std::runtime_error("Can't open " + std::string(argv[3]));
+    out << std::setprecision(10);
+    out << "unique_id,log_likelihood,log_viterbi,v_gene,d_gene,j_gene,"
+        << "v_start,v_end,d_start,d_end,j_start,j_end\n";
+
+    {
+      linearham::ThreadPool pool(thread_count);
+      // Enough rows in flight to keep the workers busy while we wait on the
+      // oldest one.
+      const unsigned int max_pending = 4 * pool.size();
+      std::deque<std::future<linearham::ReadAnnotation>> pending;
+      std::string name, seq, boundsbounds, relpos, only_genes;
+      while (true) {
+        {
+          LINEARHAM_TRACE("reading");
+          if (!in.read_row(name, seq, boundsbounds, relpos, only_genes)) break;
+        }
+        pending.push_back(pool.Submit([name, seq, boundsbounds, relpos,
+                                       only_genes, &store]() {
+          // Each worker keeps its scratch matrices from read to read.
+          thread_local linearham::SmooshableArena arena;
+          try {
+            return linearham::AnnotateRead(
+                linearham::PartisRead(name, seq, boundsbounds, relpos,
+                                      only_genes),
+                store, arena);
+          } catch (const std::exception& e) {
+            return FailedAnnotation(name, e.what());
+          }
+        }));
+        if (pending.size() >= max_pending) WriteOldest(out, pending);
+      }
+      while (!pending.empty()) WriteOldest(out, pending);
+    }
+    // The workers have all been joined by now.
+    FinishTrace(trace_path);
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    // A run that failed is just when the timeline is wanted.
+    try {
+      FinishTrace(trace_path);
+    } catch (const std::exception& trace_error) {
+      std::cerr << "Error: " << trace_error.what() << std::endl;
+    }
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,23 @@
+// Compile a directory of partis germline HMM YAML files into a single binary
+// germline set file that can be memory-mapped by GermlineFile.
+//
+// Usage: compile_germlines <yaml directory> <output file>
+
+#include <iostream>
+#include "germline_file.hpp"
+
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <yaml directory> <output file>"
+              << std::endl;
+    return 1;
+  }
+  linearham::GermlineStore store(argv[1]);
+  linearham::WriteGermlineFile(store, argv[2]);
+  std::cout << "Wrote " << store.v_germlines().size() << " V, "
+            << store.d_germlines().size() << " D and "
+            << store.j_germlines().size() << " J genes to " << argv[2]
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,349 @@
+// Write a synthetic germline set and reads simulated from it, for testing at
+// scale.
+//
+// Usage: simulate <germline directory> <hmm_input.csv> <read count> [seed]
+//
+// The germline directory (created if need be) gets one partis hmmwriter YAML
+// file per gene, which GermlineStore (and so annotate and compile_germlines)
+// can load. The genes have random sequences of realistic lengths, with 5'
+// deletions, 3' deletions, non-templated insertions and padding states
+// parameterized the way partis writes them.
+//
+// Each read is a V, D and J gene drawn according to their gene
+// probabilities, trimmed, joined by random insertions and mutated. The
+// hmm_input CSV has the columns that annotate reads: the boundsbounds windows
+// are a few positions on either side of the true boundaries, and only_genes
+// has the true genes and a decoy of each type, with relpos for all of them.
+// Reads are written as they are simulated, so any number of them can be
+// written in constant memory. The same seed gives the same output.
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+const std::string kAlphabet = "ACGT";
+const int kVCount = 50, kDCount = 25, kJCount = 6;
+// The number of germline positions near the 5' end that can be landed on,
+// and near the 3' end that can exit to the end state.
+const int kLandingCount = 5, kExitCount = 8;
+// The padding probabilities that partis writes, which NPadding checks for.
+const double kVPaddingProb = 0.33333333333333337;
+const double kJPaddingProb = 0.96;
+
+
+struct Gene {
+  // As in partis CSV files (e.g. IGHV1-2*04) and YAML files (IGHV1-2_star_04).
+  std::string name, yaml_name;
+  std::string seq;
+  double gene_prob;
+};
+
+
+// The shortest decimal representation that reads back as the same double.
+std::string FormatProb(double prob) {
+  std::ostringstream out;
+  for (int precision = 15; precision <= 17; precision++) {
+    out.str("");
+    out.precision(precision);
+    out << prob;
+    if (std::stod(out.str()) == prob) break;
+  }
+  return out.str();
+}
+
+
+// Random positive weights summing to total.
+std::vector<double> RandomSplit(int count, double total, std::mt19937& rng) {
+  std::uniform_real_distribution<double> uniform(0.5, 1.5);
+  std::vector<double> weights(count);
+  double sum = 0.;
+  for (double& weight : weights) sum += (weight = uniform(rng));
+  for (double& weight : weights) weight *= total / sum;
+  return weights;
+}
+
+
+// Weights summing to total that fall off geometrically.
+std::vector<double> GeometricSplit(int count, double total) {
+  std::vector<double> weights(count);
+  double sum = 0.;
+  for (int i = 0; i < count; i++) sum += (weights[i] = std::pow(0.5, i));
+  for (double& weight : weights) weight *= total / sum;
+  return weights;
+}
+
+
+std::vector<Gene> RandomGenes(char type, int count, int min_length,
+                              int max_length, std::mt19937& rng) {
+  std::uniform_int_distribution<int> length(min_length, max_length);
+  std::uniform_int_distribution<int> base(0, 3);
+  std::vector<double> gene_probs = RandomSplit(count, 1., rng);
+  std::vector<Gene> genes(count);
+  for (int i = 0; i < count; i++) {
+    std::string family = "IGH" + std::string(1, type) +
+                         std::to_string(i % 7 + 1) + "-" +
+                         std::to_string(i + 1);
+    genes[i].name = family + "*01";
+    genes[i].yaml_name = family + "_star_01";
+    genes[i].seq.resize(length(rng));
+    for (char& c : genes[i].seq) c = kAlphabet[base(rng)];
+    genes[i].gene_prob = gene_probs[i];
+  }
+  return genes;
+}
+
+
+// A YAML flow map from state names to probabilities.
+std::string ProbMap(const std::vector<std::string>& names,
+                    const std::vector<double>& probs) {
+  std::string map = "{";
+  for (unsigned int i = 0; i < names.size(); i++) {
+    if (i > 0) map += ", ";
+    map += names[i] + ": " + FormatProb(probs[i]);
+  }
+  return map + "}";
+}
+
+
+void WriteState(std::ostream& out, const std::string& name,
+                const std::string& emissions, const std::string& germline,
+                const std::string& transitions) {
+  out << "- !!python/object:hmmwriter.State\n";
+  if (emissions.empty()) {
+    out << "  emissions: null\n  extras: {}\n";
+  } else {
+    out << "  emissions:\n    probs: " << emissions << "\n    track: nukes\n"
+        << "  extras: {ambiguous_char: N, ambiguous_emission_prob: 0.25, "
+        << "germline: " << germline << "}\n";
+  }
+  out << "  name: " << name << "\n  transitions: " << transitions << "\n";
+}
+
+
+std::vector<std::string> AlphabetNames(const std::string& prefix) {
+  std::vector<std::string> names;
+  for (char c : kAlphabet) names.push_back(prefix + c);
+  return names;
+}
+
+
+// Emission probabilities that favor one base.
+std::string Emissions(char base, double other_prob) {
+  std::vector<double> probs(4, other_prob);
+  probs[kAlphabet.find(base)] = 1. - 3 * other_prob;
+  return ProbMap(AlphabetNames(""), probs);
+}
+
+
+// Transitions from the init state or an insertion state of a D or J gene:
+// `insert_prob` into the insertion states and the rest onto the first few
+// germline positions.
+std::string LandingTransitions(const Gene& gene, double insert_prob,
+                               std::mt19937& rng) {
+  int landing_count = std::min<int>(kLandingCount, gene.seq.size());
+  std::vector<std::string> names;
+  std::vector<double> probs = GeometricSplit(landing_count, 1. - insert_prob);
+  for (int i = 0; i < landing_count; i++) {
+    names.push_back(gene.yaml_name + "_" + std::to_string(i));
+  }
+  std::vector<std::string> insert_names = AlphabetNames("insert_left_");
+  std::vector<double> insert_probs = RandomSplit(4, insert_prob, rng);
+  names.insert(names.end(), insert_names.begin(), insert_names.end());
+  probs.insert(probs.end(), insert_probs.begin(), insert_probs.end());
+  return ProbMap(names, probs);
+}
+
+
+void WriteGeneYAML(const Gene& gene, char type, const std::string& dir,
+                   std::mt19937& rng) {
+  std::string path = dir + "/" + gene.yaml_name + ".yaml";
+  std::ofstream out(path);
+  if (!out) throw std::runtime_error("Can't open " + path);
+  std::uniform_real_distribution<double> mutation(0.002, 0.04);
+  std::uniform_real_distribution<double> insertion(0.2, 0.6);
+  out << "!!python/object:hmmwriter.HMM\n"
+      << "extras: {gene_prob: " << FormatProb(gene.gene_prob)
+      << ", overall_mute_freq: 0.05}\n"
+      << "name: " << gene.yaml_name << "\nstates:\n";
+
+  std::string first = gene.yaml_name + "_0";
+  if (type == 'V') {
+    std::string transitions = ProbMap({first, "insert_left_N"},
+                                      {1. - kVPaddingProb, kVPaddingProb});
+    WriteState(out, "init", "", "", transitions);
+    WriteState(out, "insert_left_N", Emissions('A', 0.25), "N", transitions);
+  } else {
+    WriteState(out, "init", "", "", LandingTransitions(gene, 0.4, rng));
+    for (char c : kAlphabet) {
+      WriteState(out, std::string("insert_left_") + c, Emissions(c, 0.1),
+                 std::string(1, c),
+                 LandingTransitions(gene, insertion(rng), rng));
+    }
+  }
+
+  int length = gene.seq.size();
+  std::string last_transitions =
+      (type == 'J') ? ProbMap({"end", "insert_right_N"},
+                              {1. - kJPaddingProb, kJPaddingProb})
+                    : "{end: 1.0}";
+  for (int i = 0; i < length; i++) {
+    std::string next = gene.yaml_name + "_" + std::to_string(i + 1);
+    // V and D genes can exit from their last few positions; J genes only
+    // from the last one.
+    int exit_rank = i - (length - 1 - kExitCount);
+    std::string transitions;
+    if (i == length - 1) {
+      transitions = last_transitions;
+    } else if (type != 'J' && exit_rank > 0) {
+      double exit_prob = 0.4 * exit_rank / kExitCount;
+      transitions = ProbMap({next, "end"}, {1. - exit_prob, exit_prob});
+    } else {
+      transitions = "{" + next + ": 1.0}";
+    }
+    WriteState(out, gene.yaml_name + "_" + std::to_string(i),
+               Emissions(gene.seq[i], mutation(rng) / 3),
+               std::string(1, gene.seq[i]), transitions);
+  }
+  if (type == 'J') {
+    WriteState(out, "insert_right_N", Emissions('A', 0.25), "N",
+               last_transitions);
+  }
+  out << "tracks:\n  nukes: [A, C, G, T]\n";
+}
+
+
+const Gene& DrawGene(const std::vector<Gene>& genes,
+                     std::discrete_distribution<int>& distribution,
+                     std::mt19937& rng) {
+  return genes[distribution(rng)];
+}
+
+
+// A gene other than `truth`, chosen uniformly.
+const Gene& DrawDecoy(const std::vector<Gene>& genes, const Gene& truth,
+                      std::mt19937& rng) {
+  std::uniform_int_distribution<int> index(0, genes.size() - 2);
+  int i = index(rng);
+  return (&genes[i] == &truth) ? genes[genes.size() - 1] : genes[i];
+}
+
+
+std::discrete_distribution<int> GeneDistribution(const std::vector<Gene>& genes) {
+  std::vector<double> probs;
+  for (const Gene& gene : genes) probs.push_back(gene.gene_prob);
+  return std::discrete_distribution<int>(probs.begin(), probs.end());
+}
+
+
+// A window of a few positions on either side of a boundary, kept within
+// [0, max).
+std::string Window(const std::string& key, int boundary, int max) {
+  return "\"\"" + key + "\"\":[" + std::to_string(std::max(boundary - 2, 0)) +
+         "," + std::to_string(std::min(boundary + 3, max)) + "]";
+}
+
+
+std::string RandomBases(int length, std::mt19937& rng) {
+  std::uniform_int_distribution<int> base(0, 3);
+  std::string bases(length, 'A');
+  for (char& c : bases) c = kAlphabet[base(rng)];
+  return bases;
+}
+}
+
+
+int main(int argc, char* argv[]) {
+  if (argc != 4 && argc != 5) {
+    std::cerr << "Usage: " << argv[0]
+              << " <germline directory> <hmm_input.csv> <read count> [seed]"
+              << std::endl;
+    return 1;
+  }
+  std::string dir = argv[1];
+  long read_count = std::stol(argv[3]);
+  std::mt19937 rng((argc == 5) ? std::stoul(argv[4]) : 0);
+
+  try {
+    mkdir(dir.c_str(), 0755);
+    struct stat dir_stat;
+    if (stat(dir.c_str(), &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode)) {
+      throw std::runtime_error("Can't make germline directory " + dir);
+    }
+    std::vector<Gene> v_genes = RandomGenes('V', kVCount, 290, 300, rng);
+    std::vector<Gene> d_genes = RandomGenes('D', kDCount, 11, 37, rng);
+    std::vector<Gene> j_genes = RandomGenes('J', kJCount, 44, 63, rng);
+    for (const Gene& gene : v_genes) WriteGeneYAML(gene, 'V', dir, rng);
+    for (const Gene& gene : d_genes) WriteGeneYAML(gene, 'D', dir, rng);
+    for (const Gene& gene : j_genes) WriteGeneYAML(gene, 'J', dir, rng);
+
+    std::ofstream out(argv[2]);
+    if (!out) throw std::runtime_error("Can't open " + std::string(argv[2]));
+    out << "names seqs boundsbounds relpos only_genes\n";
+    std::discrete_distribution<int> v_distribution = GeneDistribution(v_genes);
+    std::discrete_distribution<int> d_distribution = GeneDistribution(d_genes);
+    std::discrete_distribution<int> j_distribution = GeneDistribution(j_genes);
+    std::uniform_int_distribution<int> deletion(0, 3), insertion(0, 6);
+    std::uniform_real_distribution<double> uniform(0., 1.), mut_freq(0., 0.1);
+    std::uniform_int_distribution<int> other_base(1, 3);
+
+    for (long r = 0; r < read_count; r++) {
+      const Gene& v = DrawGene(v_genes, v_distribution, rng);
+      const Gene& d = DrawGene(d_genes, d_distribution, rng);
+      const Gene& j = DrawGene(j_genes, j_distribution, rng);
+      int v_del3 = deletion(rng), d_del5 = deletion(rng),
+          d_del3 = deletion(rng), j_del5 = deletion(rng);
+      std::string seq = v.seq.substr(0, v.seq.size() - v_del3);
+      int v_end = seq.size();
+      seq += RandomBases(insertion(rng), rng);
+      int d_start = seq.size();
+      seq += d.seq.substr(d_del5, d.seq.size() - d_del5 - d_del3);
+      int d_end = seq.size();
+      seq += RandomBases(insertion(rng), rng);
+      int j_start = seq.size();
+      seq += j.seq.substr(j_del5);
+      int length = seq.size();
+      double read_mut_freq = mut_freq(rng);
+      for (char& c : seq) {
+        if (uniform(rng) < read_mut_freq) {
+          c = kAlphabet[(kAlphabet.find(c) + other_base(rng)) % 4];
+        }
+      }
+
+      // Decoys sit where the true gene of their type does.
+      const Gene& v_decoy = DrawDecoy(v_genes, v, rng);
+      const Gene& d_decoy = DrawDecoy(d_genes, d, rng);
+      const Gene& j_decoy = DrawDecoy(j_genes, j, rng);
+      int d_relpos = d_start - d_del5, j_relpos = j_start - j_del5;
+      std::ostringstream relpos;
+      relpos << "\"{\"\"" << v.name << "\"\":0,\"\"" << v_decoy.name
+             << "\"\":0,\"\"" << d.name << "\"\":" << d_relpos << ",\"\""
+             << d_decoy.name << "\"\":" << d_relpos << ",\"\"" << j.name
+             << "\"\":" << j_relpos << ",\"\"" << j_decoy.name
+             << "\"\":" << j_relpos << "}\"";
+      out << "sim" << r << " " << seq << " \"{"
+          << Window("v_l", 0, length + 1) << ","
+          << Window("v_r", v_end, length + 1) << ","
+          << Window("d_l", d_start, length + 1) << ","
+          << Window("d_r", d_end, length + 1) << ","
+          << Window("j_l", j_start, length + 1) << ","
+          << Window("j_r", length, length + 1) << "}\" " << relpos.str()
+          << " " << j.name << ":" << d.name << ":" << v.name << ":"
+          << j_decoy.name << ":" << d_decoy.name << ":" << v_decoy.name
+          << "\n";
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}